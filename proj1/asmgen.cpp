@@ -0,0 +1,780 @@
+/**
+ * @file   asmgen.cpp
+ * @brief  Synthetic assembly source generator
+ *
+ * @description
+ * This program writes reproducible MIPS assembly programs for
+ * the assembler, together with the hex output they must
+ * assemble to. The same size, options and seed always
+ * produce the same program.
+ *
+ * Every row of the assembler's instruction table appears, as
+ * does each pseudo-instruction in the forms it expands to;
+ * branches and jumps go to labels before and after them,
+ * mostly after; immediates and offsets may be %hi and %lo of
+ * text and data labels; loads and stores use both numeric
+ * offsets and data labels; the data segment holds .word tables
+ * and large .space regions.
+ *
+ * usage: asmgen lines [key=value ...]
+ *
+ *   options   seed=N        generator seed                  (default 1)
+ *             labels=F      fraction of text lines labeled  (default 0.05)
+ *             words=N       .word values                    (default lines / 4)
+ *             spaces=N      .space regions                  (default 16)
+ *             space=N       words per .space region         (default 4096)
+ *             out=FILE      assembly output                 (default stdout)
+ *             golden=FILE   expected hex output             (default none)
+ *****************************************************/
+
+#ifndef asmgen_CPP
+#define asmgen_CPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+
+/***************************************
+ *          Random  Class              *
+ **************************************/
+
+//splitmix64; portable so programs are identical across standard libraries
+struct Random
+{
+  unsigned long long state;                       //generator state
+
+  Random(unsigned long long seed);                //default constructor
+  unsigned long long Next();                      //next 64 random bits
+  unsigned int Below(unsigned int bound);         //uniform in [0, bound)
+  double Unit();                                  //uniform in [0, 1)
+};
+
+
+/***************************************
+ *          AsmGen  Class              *
+ **************************************/
+
+//one row per mnemonic, as in the assembler's instruction table
+struct GenInstr
+{
+  const char* name;                               //mnemonic
+  char type;                                      //'r', 'i' or 'j'
+  int op;                                         //op code value
+  int funct;                                      //funct code value
+  const char* operands;                           //operand roles
+};
+
+//pseudo-instruction forms; each expands to a fixed number of words, so
+//label positions are known before any line is written
+enum GenForm
+{
+  FORM_LI16, FORM_LIU16, FORM_LIHI, FORM_LI32, FORM_LA, FORM_MOVE, FORM_NEG, FORM_NOP,
+  FORM_B, FORM_BZ, FORM_CMP, FORM_CMPZ, FORM_CMPI, FORM_JALR
+};
+
+//one row per pseudo-instruction form
+struct GenPseudo
+{
+  const char* name;                               //mnemonic
+  GenForm form;                                   //expansion
+  unsigned int words;                             //words it expands to
+  const char* instr;                              //row it becomes, if only one
+};
+
+//a data label, the value lw and sw use for it and its word index
+struct DataLabel
+{
+  std::string name;                               //label name
+  int value;                                      //first data operand
+  unsigned int index;                             //word index in the image
+};
+
+struct AsmGen
+{
+  unsigned int lines;                             //text instructions
+  double labels;                                  //fraction of text lines labeled
+  unsigned int words;                             //.word values
+  unsigned int spaces;                            //.space regions
+  unsigned int space;                             //words per .space region
+  Random random;                                  //shared generator
+
+  std::vector<unsigned int> rowOf;                //table row of each text line
+  std::vector<unsigned int> wordAt;               //first word of each text line
+  unsigned int textWords;                         //words in .text
+  std::vector<int> labelOf;                       //text label at each line, -1 if none
+  std::vector<unsigned int> labelAt;              //word index of each text label
+  std::vector<DataLabel> dataLabels;              //labels lw and sw may use
+  std::vector<unsigned int> dataWords;            //data segment, zero fill expanded
+  std::string source;                             //generated program
+  std::vector<unsigned int> golden;               //expected words, text then data
+
+  AsmGen(unsigned int lines, unsigned long long seed);  //default constructor
+  void Prepare();                                 //choose rows, place labels, build data
+  void Text();                                    //append .text section
+  void Data();                                    //append .data section
+  int Register(std::string& name);                //random register, its number
+  std::string Number(int value);                  //value in decimal or hex
+  std::string Branch(unsigned int index, unsigned int labelCursor, unsigned int& low);
+  std::string Address(unsigned int& address);     //random label, its byte address
+  void Instruction(unsigned int line, unsigned int& labelCursor);  //one line
+  void Pseudo(const GenPseudo& pseudo, unsigned int index, unsigned int labelCursor);
+};
+
+
+/***************************************
+ *          Tables                     *
+ **************************************/
+
+static const GenInstr genTable[] =
+{
+  { "addu",    'r',  0, 33, "dst" },
+  { "and",     'r',  0, 36, "dst" },
+  { "div",     'r',  0, 26, "st"  },
+  { "mfhi",    'r',  0, 16, "d"   },
+  { "mflo",    'r',  0, 18, "d"   },
+  { "mult",    'r',  0, 24, "st"  },
+  { "or",      'r',  0, 37, "dst" },
+  { "slt",     'r',  0, 42, "dst" },
+  { "subu",    'r',  0, 35, "dst" },
+  { "syscall", 'r',  0, 12, ""    },
+  { "addiu",   'i',  9,  0, "tsi" },
+  { "beq",     'i',  4,  0, "stb" },
+  { "bne",     'i',  5,  0, "stb" },
+  { "lw",      'i', 35,  0, "tos" },
+  { "sw",      'i', 43,  0, "tos" },
+  { "j",       'j',  2,  0, "j"   },
+  { "add",     'r',  0, 32, "dst" },
+  { "sub",     'r',  0, 34, "dst" },
+  { "xor",     'r',  0, 38, "dst" },
+  { "nor",     'r',  0, 39, "dst" },
+  { "sltu",    'r',  0, 43, "dst" },
+  { "movz",    'r',  0, 10, "dst" },
+  { "movn",    'r',  0, 11, "dst" },
+  { "addi",    'i',  8,  0, "tsi" },
+  { "slti",    'i', 10,  0, "tsi" },
+  { "sltiu",   'i', 11,  0, "tsi" },
+  { "andi",    'i', 12,  0, "tsi" },
+  { "ori",     'i', 13,  0, "tsi" },
+  { "xori",    'i', 14,  0, "tsi" },
+  { "lui",     'i', 15,  0, "ti"  },
+  { "sll",     'r',  0,  0, "dta" },
+  { "srl",     'r',  0,  2, "dta" },
+  { "sra",     'r',  0,  3, "dta" },
+  { "sllv",    'r',  0,  4, "dts" },
+  { "srlv",    'r',  0,  6, "dts" },
+  { "srav",    'r',  0,  7, "dts" },
+  { "multu",   'r',  0, 25, "st"  },
+  { "divu",    'r',  0, 27, "st"  },
+  { "mthi",    'r',  0, 17, "s"   },
+  { "mtlo",    'r',  0, 19, "s"   },
+  { "madd",    'r', 28,  0, "st"  },
+  { "maddu",   'r', 28,  1, "st"  },
+  { "mul",     'r', 28,  2, "dst" },
+  { "msub",    'r', 28,  4, "st"  },
+  { "msubu",   'r', 28,  5, "st"  },
+  { "clz",     'r', 28, 32, "cs"  },
+  { "clo",     'r', 28, 33, "cs"  },
+  { "lb",      'i', 32,  0, "tos" },
+  { "lh",      'i', 33,  0, "tos" },
+  { "lwl",     'i', 34,  0, "tos" },
+  { "lbu",     'i', 36,  0, "tos" },
+  { "lhu",     'i', 37,  0, "tos" },
+  { "lwr",     'i', 38,  0, "tos" },
+  { "sb",      'i', 40,  0, "tos" },
+  { "sh",      'i', 41,  0, "tos" },
+  { "swl",     'i', 42,  0, "tos" },
+  { "swr",     'i', 46,  0, "tos" },
+  { "ll",      'i', 48,  0, "tos" },
+  { "sc",      'i', 56,  0, "tos" },
+  { "blez",    'i',  6,  0, "sb"  },
+  { "bgtz",    'i',  7,  0, "sb"  },
+  { "bltz",    'i',  1,  0, "sb"  },
+  { "bgez",    'i',  1,  1, "sb"  },
+  { "bltzal",  'i',  1, 16, "sb"  },
+  { "bgezal",  'i',  1, 17, "sb"  },
+  { "jal",     'j',  3,  0, "j"   },
+  { "jr",      'r',  0,  8, "s"   },
+  { "jalr",    'r',  0,  9, "ds"  },
+  { "tge",     'r',  0, 48, "st"  },
+  { "tgeu",    'r',  0, 49, "st"  },
+  { "tlt",     'r',  0, 50, "st"  },
+  { "tltu",    'r',  0, 51, "st"  },
+  { "teq",     'r',  0, 52, "st"  },
+  { "tne",     'r',  0, 54, "st"  },
+  { "tgei",    'i',  1,  8, "si"  },
+  { "tgeiu",   'i',  1,  9, "si"  },
+  { "tlti",    'i',  1, 10, "si"  },
+  { "tltiu",   'i',  1, 11, "si"  },
+  { "teqi",    'i',  1, 12, "si"  },
+  { "tnei",    'i',  1, 14, "si"  },
+  { "break",   'r',  0, 13, ""    },
+};
+
+//li takes its shortest form, so each form gets a value range of its own;
+//compares against $zero and constants are separate forms
+static const GenPseudo pseudoTable[] =
+{
+  { "li",   FORM_LI16,  1, "addiu" }, { "li",   FORM_LIU16, 1, "ori"  },
+  { "li",   FORM_LIHI,  1, "lui"   }, { "li",   FORM_LI32,  2, NULL   },
+  { "la",   FORM_LA,    2, NULL    }, { "move", FORM_MOVE,  1, "addu" },
+  { "not",  FORM_MOVE,  1, "nor"   }, { "neg",  FORM_NEG,   1, "sub"  },
+  { "negu", FORM_NEG,   1, "subu"  }, { "nop",  FORM_NOP,   1, "sll"  },
+  { "b",    FORM_B,     1, "beq"   }, { "beqz", FORM_BZ,    1, "beq"  },
+  { "bnez", FORM_BZ,    1, "bne"   }, { "jalr", FORM_JALR,  1, "jalr" },
+  { "blt",  FORM_CMP,   2, NULL    }, { "bgt",  FORM_CMP,   2, NULL   },
+  { "ble",  FORM_CMP,   2, NULL    }, { "bge",  FORM_CMP,   2, NULL   },
+  { "bltu", FORM_CMP,   2, NULL    }, { "bgtu", FORM_CMP,   2, NULL   },
+  { "bleu", FORM_CMP,   2, NULL    }, { "bgeu", FORM_CMP,   2, NULL   },
+  { "blt",  FORM_CMPZ,  1, NULL    }, { "bgt",  FORM_CMPZ,  1, NULL   },
+  { "ble",  FORM_CMPZ,  1, NULL    }, { "bge",  FORM_CMPZ,  1, NULL   },
+  { "blt",  FORM_CMPI,  2, NULL    }, { "bgt",  FORM_CMPI,  2, NULL   },
+  { "ble",  FORM_CMPI,  2, NULL    }, { "bge",  FORM_CMPI,  2, NULL   },
+  { "bltu", FORM_CMPI,  2, NULL    }, { "bgtu", FORM_CMPI,  2, NULL   },
+  { "bleu", FORM_CMPI,  2, NULL    }, { "bgeu", FORM_CMPI,  2, NULL   },
+};
+
+static const unsigned int genRows = sizeof(genTable) / sizeof(genTable[0]);
+static const unsigned int pseudoRows = sizeof(pseudoTable) / sizeof(pseudoTable[0]);
+
+static const char* genRegs[] =
+{
+  "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+  "$t0",   "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+  "$s0",   "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+  "$t8",   "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra",
+};
+
+
+/***************************************
+ *          Random Definitions         *
+ **************************************/
+
+Random::Random(unsigned long long seed) : state(seed)
+{
+}
+
+unsigned long long Random::Next()
+{
+  unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+unsigned int Random::Below(unsigned int bound)
+{
+  //multiply-shift, bias is below 2^-32
+  return (unsigned int)(((Next() >> 32) * bound) >> 32);
+}
+
+double Random::Unit()
+{
+  return (Next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/***************************************
+ *          AsmGen Definitions         *
+ **************************************/
+
+AsmGen::AsmGen(unsigned int lines, unsigned long long seed) : lines(lines), labels(0.05),
+                                                             words(lines / 4), spaces(16),
+                                                             space(4096), random(seed)
+{
+}
+
+//table row of a mnemonic
+static const GenInstr& Find(const char* name)
+{
+  unsigned int row = 0;
+  while (row + 1 < genRows && std::string(genTable[row].name) != name)
+    ++row;
+  return genTable[row];
+}
+
+//machine word of a row; r type rows put funct in the low bits next to
+//the shift amount, regimm rows (op 1) put it in rt
+static unsigned int Encode(const GenInstr& instr, int rs, int rt, int rd, unsigned int low)
+{
+  if (instr.type == 'r')
+    low |= instr.funct;
+  else if (instr.op == 1)
+    rt = instr.funct;
+  return (instr.op << 26) | (rs << 21) | (rt << 16) | (rd << 11) | low;
+}
+
+//%hi rounds so that adding the sign extended %lo gives the address
+static unsigned int High(unsigned int address)
+{
+  return ((address + 0x8000) >> 16) & 0xffff;
+}
+
+void AsmGen::Prepare()
+{
+  //rows first, they fix the word index of every line; the first line is
+  //always labeled, so every branch has a target
+  rowOf.assign(lines, 0);
+  wordAt.assign(lines, 0);
+  labelOf.assign(lines, -1);
+  textWords = 0;
+  for (unsigned int i = 0; i < lines; ++i)
+  {
+    rowOf[i] = random.Below(genRows + pseudoRows);
+    wordAt[i] = textWords;
+    if (i == 0 || random.Unit() < labels)
+    {
+      labelOf[i] = labelAt.size();
+      labelAt.push_back(textWords);
+    }
+    textWords += rowOf[i] < genRows ? 1 : pseudoTable[rowOf[i] - genRows].words;
+  }
+
+  //.word tables and .space regions interleaved; each table line and each
+  //region is labeled, with its first operand as the label's value
+  std::string text = "\t.data\n";
+  unsigned int wordsLeft = words;
+  unsigned int spacesLeft = spaces;
+  unsigned int tables = 0;
+  while (wordsLeft > 0 || spacesLeft > 0)
+  {
+    bool takeSpace = spacesLeft > 0
+                     && (wordsLeft == 0 || random.Below(wordsLeft / 8 + spacesLeft) < spacesLeft);
+    DataLabel label;
+    label.index = textWords + dataWords.size();
+    if (takeSpace)
+    {
+      label.name = "S" + std::to_string(spaces - spacesLeft);
+      label.value = space;
+      text += label.name + ":\t.space " + std::to_string(space) + "\n";
+      dataWords.resize(dataWords.size() + space, 0);
+      --spacesLeft;
+    }
+    else
+    {
+      unsigned int count = std::min(wordsLeft, 1 + random.Below(8));
+      label.name = "D" + std::to_string(tables++);
+      text += label.name + ":\t.word ";
+      for (unsigned int w = 0; w < count; ++w)
+      {
+        int value = (int)(unsigned int)random.Next();
+        if (value == -2147483647 - 1)
+          value = 0;
+        if (w == 0)
+          label.value = value;
+        text += (w == 0 ? "" : ", ") + std::to_string(value);
+        dataWords.push_back(value);
+      }
+      text += "\n";
+      wordsLeft -= count;
+    }
+    dataLabels.push_back(label);
+  }
+  source.swap(text);
+  return;
+}
+
+int AsmGen::Register(std::string& name)
+{
+  //$0 is the only alias, spelled both ways
+  int number = random.Below(32);
+  name = number == 0 && random.Below(2) ? "$0" : genRegs[number];
+  return number;
+}
+
+std::string AsmGen::Number(int value)
+{
+  //hex is read as a 32 bit pattern, so both spellings give the same word
+  if (random.Below(4) != 0)
+    return std::to_string(value);
+  char text[16];
+  std::snprintf(text, sizeof(text), "0x%x", (unsigned int)value);
+  return text;
+}
+
+std::string AsmGen::Branch(unsigned int index, unsigned int labelCursor, unsigned int& low)
+{
+  //mostly forward, a few labels either side of the branch word at index;
+  //labels too far away for 16 bits fall back to the nearest one
+  int pick = (int)labelCursor - 3 + (int)random.Below(12);
+  pick = std::max(0, std::min(pick, (int)labelAt.size() - 1));
+  int distance = (int)labelAt[pick] - (int)(index + 1);
+  if (distance < -32768 || distance > 32767)
+  {
+    pick = std::min(labelCursor, (unsigned int)labelAt.size() - 1);
+    distance = (int)labelAt[pick] - (int)(index + 1);
+    if (distance > 32767)
+    {
+      pick = labelCursor - 1;
+      distance = (int)labelAt[pick] - (int)(index + 1);
+    }
+  }
+  low = distance & 0xffff;
+  return "L" + std::to_string(pick);
+}
+
+std::string AsmGen::Address(unsigned int& address)
+{
+  //text labels address their word, data labels their first word
+  if (random.Below(2) && !dataLabels.empty())
+  {
+    const DataLabel& label = dataLabels[random.Below(dataLabels.size())];
+    address = 4 * label.index;
+    return label.name;
+  }
+  unsigned int pick = random.Below(labelAt.size());
+  address = 4 * labelAt[pick];
+  return "L" + std::to_string(pick);
+}
+
+void AsmGen::Instruction(unsigned int line, unsigned int& labelCursor)
+{
+  //labels either stand alone or share a line with their instruction
+  unsigned int index = wordAt[line];
+  if (labelOf[line] >= 0)
+  {
+    source += "L" + std::to_string(labelOf[line]) + ":";
+    source += random.Below(2) ? "\n\t" : " ";
+  }
+  else
+    source += "\t";
+  while (labelCursor < labelAt.size() && labelAt[labelCursor] < index)
+    ++labelCursor;
+
+  if (rowOf[line] >= genRows)
+  {
+    Pseudo(pseudoTable[rowOf[line] - genRows], index, labelCursor);
+    return;
+  }
+
+  const GenInstr& instr = genTable[rowOf[line]];
+  source += instr.name;
+  int rs = 0, rt = 0, rd = 0;
+  unsigned int low = 0;
+  std::string offset;
+  for (const char* role = instr.operands; *role != '\0'; ++role)
+  {
+    std::string name;
+    switch (*role)
+    {
+      case 'd': rd = Register(name); break;
+      case 's': rs = Register(name); break;
+      case 't': rt = Register(name); break;
+      case 'c': rd = rt = Register(name); break;
+      case 'a':
+      {
+        unsigned int shift = random.Below(32);
+        low = shift << 6;
+        name = std::to_string(shift);
+        break;
+      }
+      case 'i':
+      {
+        //now and then the high or low half of a label's address
+        if (random.Below(8) == 0)
+        {
+          unsigned int address = 0;
+          bool high = random.Below(2);
+          name = (high ? "%hi(" : "%lo(") + Address(address) + ")";
+          low = high ? High(address) : address & 0xffff;
+          break;
+        }
+        int imm = (int)random.Below(65536) - 32768;
+        low = imm & 0xffff;
+        name = std::to_string(imm);
+        break;
+      }
+      case 'o':
+      {
+        //written as offset(base), base follows as the next role
+        unsigned int kind = random.Below(8);
+        if (kind == 0)
+        {
+          unsigned int address = 0;
+          offset = "%lo(" + Address(address) + ")";
+          low = address & 0xffff;
+        }
+        else if (kind < 5 && !dataLabels.empty())
+        {
+          const DataLabel& label = dataLabels[random.Below(dataLabels.size())];
+          low = label.value & 0xffff;
+          offset = label.name;
+        }
+        else
+        {
+          int imm = (int)random.Below(65536) - 32768;
+          low = imm & 0xffff;
+          offset = std::to_string(imm);
+        }
+        continue;
+      }
+      case 'b': name = Branch(index, labelCursor, low); break;
+      default:
+      {
+        unsigned int pick = random.Below(labelAt.size());
+        low = labelAt[pick] & 0x3ffffff;
+        name = "L" + std::to_string(pick);
+        break;
+      }
+    }
+
+    bool first = role == instr.operands;
+    if (!offset.empty())
+    {
+      source += ", " + offset + "(" + name + ")";
+      offset.clear();
+    }
+    else
+      source += (first ? " " : ", ") + name;
+  }
+  source += "\n";
+  golden.push_back(Encode(instr, rs, rt, rd, low));
+  return;
+}
+
+void AsmGen::Pseudo(const GenPseudo& pseudo, unsigned int index, unsigned int labelCursor)
+{
+  //the expansions ExpandPseudo makes, worked out independently
+  const int at = 1;
+  std::string a, b, target;
+  int ra = Register(a);
+  int rb = Register(b);
+  unsigned int low = 0;
+  source += pseudo.name;
+  switch (pseudo.form)
+  {
+    case FORM_LI16:
+    {
+      int value = (int)random.Below(65536) - 32768;
+      source += " " + a + ", " + Number(value);
+      golden.push_back(Encode(Find(pseudo.instr), 0, ra, 0, value & 0xffff));
+      break;
+    }
+    case FORM_LIU16:
+    {
+      int value = 32768 + (int)random.Below(32768);
+      source += " " + a + ", " + Number(value);
+      golden.push_back(Encode(Find(pseudo.instr), 0, ra, 0, value));
+      break;
+    }
+    case FORM_LIHI:
+    {
+      unsigned int high = 1 + random.Below(0xffff);
+      source += " " + a + ", " + Number((int)(high << 16));
+      golden.push_back(Encode(Find(pseudo.instr), 0, ra, 0, high));
+      break;
+    }
+    case FORM_LI32:
+    {
+      //a high half of 0xffff with the low sign bit set fits one addiu
+      unsigned int high = 1 + random.Below(0xfffe);
+      unsigned int half = 1 + random.Below(0xffff);
+      source += " " + a + ", " + Number((int)(high << 16 | half));
+      golden.push_back(Encode(Find("lui"), 0, ra, 0, high));
+      golden.push_back(Encode(Find("ori"), ra, ra, 0, half));
+      break;
+    }
+    case FORM_LA:
+    {
+      unsigned int address = 0;
+      source += " " + a + ", " + Address(address);
+      golden.push_back(Encode(Find("lui"), 0, ra, 0, High(address)));
+      golden.push_back(Encode(Find("addiu"), ra, ra, 0, address & 0xffff));
+      break;
+    }
+    case FORM_MOVE:
+      source += " " + a + ", " + b;
+      golden.push_back(Encode(Find(pseudo.instr), rb, 0, ra, 0));
+      break;
+    case FORM_NEG:
+      source += " " + a + ", " + b;
+      golden.push_back(Encode(Find(pseudo.instr), 0, rb, ra, 0));
+      break;
+    case FORM_NOP:
+      golden.push_back(Encode(Find(pseudo.instr), 0, 0, 0, 0));
+      break;
+    case FORM_B:
+      source += " " + Branch(index, labelCursor, low);
+      golden.push_back(Encode(Find(pseudo.instr), 0, 0, 0, low));
+      break;
+    case FORM_BZ:
+      source += " " + a + ", " + Branch(index, labelCursor, low);
+      golden.push_back(Encode(Find(pseudo.instr), ra, 0, 0, low));
+      break;
+    case FORM_JALR:
+      source += " " + a;
+      golden.push_back(Encode(Find(pseudo.instr), ra, 0, 31, 0));
+      break;
+    default:
+    {
+      //bgt and ble swap their operands into blt and bge
+      std::string name = pseudo.name;
+      bool isUnsigned = name.size() == 4;
+      bool swap = name.compare(1, 2, "gt") == 0 || name.compare(1, 2, "le") == 0;
+      bool less = name.compare(1, 2, "lt") == 0 || name.compare(1, 2, "gt") == 0;
+
+      //registers other than $zero, which would take the one branch form
+      ra = 1 + random.Below(31);
+      rb = 1 + random.Below(31);
+      a = genRegs[ra];
+      b = genRegs[rb];
+      if (pseudo.form == FORM_CMPZ)
+      {
+        static const char* zero[] = { "$zero", "$0", "0" };
+        source += " " + a + ", " + zero[random.Below(3)] + ", " + Branch(index, labelCursor, low);
+        const char* branch = less ? (swap ? "bgtz" : "bltz") : (swap ? "blez" : "bgez");
+        golden.push_back(Encode(Find(branch), ra, 0, 0, low));
+        break;
+      }
+
+      //x > c and x <= c test x < c + 1, so the constant stays below 32767
+      if (pseudo.form == FORM_CMPI)
+      {
+        int value = isUnsigned ? 1 + (int)random.Below(32766) : (int)random.Below(65534) - 32767;
+        if (value == 0)
+          value = 1;
+        source += " " + a + ", " + std::to_string(value) + ", " + Branch(index + 1, labelCursor, low);
+        golden.push_back(Encode(Find(isUnsigned ? "sltiu" : "slti"), ra, at, 0,
+                                (value + (swap ? 1 : 0)) & 0xffff));
+        golden.push_back(Encode(Find(less != swap ? "bne" : "beq"), at, 0, 0, low));
+        break;
+      }
+
+      source += " " + a + ", " + b + ", " + Branch(index + 1, labelCursor, low);
+      golden.push_back(Encode(Find(isUnsigned ? "sltu" : "slt"), swap ? rb : ra, swap ? ra : rb,
+                              at, 0));
+      golden.push_back(Encode(Find(less ? "bne" : "beq"), at, 0, 0, low));
+      break;
+    }
+  }
+  source += "\n";
+  return;
+}
+
+void AsmGen::Text()
+{
+  std::string data;
+  data.swap(source);
+  source.reserve(lines * 24 + data.size());
+  source += "\t.text\n";
+  unsigned int labelCursor = 0;
+  for (unsigned int i = 0; i < lines; ++i)
+    Instruction(i, labelCursor);
+  source += "\n";
+  source += data;
+  return;
+}
+
+void AsmGen::Data()
+{
+  golden.insert(golden.end(), dataWords.begin(), dataWords.end());
+  return;
+}
+
+
+/******************************
+ *            Main            *
+ *****************************/
+
+//write text to path, stdout if empty; false on error
+bool WriteFile(const std::string& path, const std::string& text)
+{
+  std::FILE* out = path.empty() ? stdout : std::fopen(path.c_str(), "wb");
+  if (out == NULL)
+    return false;
+  bool written = std::fwrite(text.data(), 1, text.size(), out) == text.size();
+  if (out != stdout)
+    written = std::fclose(out) == 0 && written;
+  return written;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " lines [key=value ...]" << std::endl;
+    return 1;
+  }
+
+  unsigned int lines = std::strtoul(argv[1], NULL, 10);
+  if (lines == 0)
+  {
+    std::cerr << "lines must be positive." << std::endl;
+    return 1;
+  }
+
+  //options
+  unsigned long long seed = 1;
+  std::string outPath;
+  std::string goldenPath;
+  for (int i = 2; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg.compare(0, 5, "seed=") == 0)
+      seed = std::strtoull(arg.c_str() + 5, NULL, 10);
+  }
+
+  AsmGen gen(lines, seed);
+  for (int i = 2; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : arg.c_str() + eq + 1;
+
+    if (key == "labels")
+      gen.labels = std::strtod(value, NULL);
+    else if (key == "words")
+      gen.words = std::strtoul(value, NULL, 10);
+    else if (key == "spaces")
+      gen.spaces = std::strtoul(value, NULL, 10);
+    else if (key == "space")
+      gen.space = std::strtoul(value, NULL, 10);
+    else if (key == "out")
+      outPath = value;
+    else if (key == "golden")
+      goldenPath = value;
+    else if (key != "seed")
+    {
+      std::cerr << "Unknown option " << arg << "." << std::endl;
+      return 1;
+    }
+  }
+  if (gen.space == 0 && gen.spaces > 0)
+  {
+    std::cerr << "space must be positive." << std::endl;
+    return 1;
+  }
+
+  gen.Prepare();
+  gen.Text();
+  gen.Data();
+  if (!WriteFile(outPath, gen.source))
+  {
+    std::cerr << "Error writing " << outPath << "." << std::endl;
+    return 1;
+  }
+
+  //same layout as the assembler's hex output
+  if (!goldenPath.empty())
+  {
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string hex(1 + 9 * gen.golden.size(), '\n');
+    for (size_t i = 0; i < gen.golden.size(); ++i)
+    {
+      for (int d = 0; d < 8; ++d)
+        hex[1 + 9 * i + d] = hexDigits[(gen.golden[i] >> (28 - 4 * d)) & 0xf];
+    }
+    if (!WriteFile(goldenPath, hex))
+    {
+      std::cerr << "Error writing " << goldenPath << "." << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,1792 @@
+/**
+ * @file   assembler.cpp
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Simple MIPS Assembler library
+ *
+ * @description
+ * Instruction tables, the flat command IR, label
+ * resolution and machine code emission behind
+ * assembler.h.
+ *****************************************************/
+
+#ifndef assembler_CPP
+#define assembler_CPP
+
+#include "assembler.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+
+
+/********************************************
+ *            Instruction Tables            *
+ ********************************************/
+
+//adding an instruction is adding a row; the MIPS32 integer instruction set
+//less the privileged, coprocessor and delay slot sensitive likely branches
+constexpr InstrDesc instrTable[] =
+{
+  { "addu",    'r',  0, 33, "dst" },
+  { "and",     'r',  0, 36, "dst" },
+  { "div",     'r',  0, 26, "st"  },
+  { "mfhi",    'r',  0, 16, "d"   },
+  { "mflo",    'r',  0, 18, "d"   },
+  { "mult",    'r',  0, 24, "st"  },
+  { "or",      'r',  0, 37, "dst" },
+  { "slt",     'r',  0, 42, "dst" },
+  { "subu",    'r',  0, 35, "dst" },
+  { "syscall", 'r',  0, 12, ""    },
+  { "addiu",   'i',  9,  0, "tsi" },
+  { "beq",     'i',  4,  0, "stb" },
+  { "bne",     'i',  5,  0, "stb" },
+  { "lw",      'i', 35,  0, "tos" },
+  { "sw",      'i', 43,  0, "tos" },
+  { "j",       'j',  2,  0, "j"   },
+
+  //arithmetic, logic and compares
+  { "add",     'r',  0, 32, "dst" },
+  { "sub",     'r',  0, 34, "dst" },
+  { "xor",     'r',  0, 38, "dst" },
+  { "nor",     'r',  0, 39, "dst" },
+  { "sltu",    'r',  0, 43, "dst" },
+  { "movz",    'r',  0, 10, "dst" },
+  { "movn",    'r',  0, 11, "dst" },
+  { "addi",    'i',  8,  0, "tsi" },
+  { "slti",    'i', 10,  0, "tsi" },
+  { "sltiu",   'i', 11,  0, "tsi" },
+  { "andi",    'i', 12,  0, "tsi" },
+  { "ori",     'i', 13,  0, "tsi" },
+  { "xori",    'i', 14,  0, "tsi" },
+  { "lui",     'i', 15,  0, "ti"  },
+
+  //shifts
+  { "sll",     'r',  0,  0, "dta" },
+  { "srl",     'r',  0,  2, "dta" },
+  { "sra",     'r',  0,  3, "dta" },
+  { "sllv",    'r',  0,  4, "dts" },
+  { "srlv",    'r',  0,  6, "dts" },
+  { "srav",    'r',  0,  7, "dts" },
+
+  //multiply and divide
+  { "multu",   'r',  0, 25, "st"  },
+  { "divu",    'r',  0, 27, "st"  },
+  { "mthi",    'r',  0, 17, "s"   },
+  { "mtlo",    'r',  0, 19, "s"   },
+  { "madd",    'r', 28,  0, "st"  },
+  { "maddu",   'r', 28,  1, "st"  },
+  { "mul",     'r', 28,  2, "dst" },
+  { "msub",    'r', 28,  4, "st"  },
+  { "msubu",   'r', 28,  5, "st"  },
+  { "clz",     'r', 28, 32, "cs"  },
+  { "clo",     'r', 28, 33, "cs"  },
+
+  //loads and stores
+  { "lb",      'i', 32,  0, "tos" },
+  { "lh",      'i', 33,  0, "tos" },
+  { "lwl",     'i', 34,  0, "tos" },
+  { "lbu",     'i', 36,  0, "tos" },
+  { "lhu",     'i', 37,  0, "tos" },
+  { "lwr",     'i', 38,  0, "tos" },
+  { "sb",      'i', 40,  0, "tos" },
+  { "sh",      'i', 41,  0, "tos" },
+  { "swl",     'i', 42,  0, "tos" },
+  { "swr",     'i', 46,  0, "tos" },
+  { "ll",      'i', 48,  0, "tos" },
+  { "sc",      'i', 56,  0, "tos" },
+
+  //branches, jumps and calls
+  { "blez",    'i',  6,  0, "sb"  },
+  { "bgtz",    'i',  7,  0, "sb"  },
+  { "bltz",    'i',  1,  0, "sb"  },
+  { "bgez",    'i',  1,  1, "sb"  },
+  { "bltzal",  'i',  1, 16, "sb"  },
+  { "bgezal",  'i',  1, 17, "sb"  },
+  { "jal",     'j',  3,  0, "j"   },
+  { "jr",      'r',  0,  8, "s"   },
+  { "jalr",    'r',  0,  9, "ds"  },
+
+  //traps and breakpoints
+  { "tge",     'r',  0, 48, "st"  },
+  { "tgeu",    'r',  0, 49, "st"  },
+  { "tlt",     'r',  0, 50, "st"  },
+  { "tltu",    'r',  0, 51, "st"  },
+  { "teq",     'r',  0, 52, "st"  },
+  { "tne",     'r',  0, 54, "st"  },
+  { "tgei",    'i',  1,  8, "si"  },
+  { "tgeiu",   'i',  1,  9, "si"  },
+  { "tlti",    'i',  1, 10, "si"  },
+  { "tltiu",   'i',  1, 11, "si"  },
+  { "teqi",    'i',  1, 12, "si"  },
+  { "tnei",    'i',  1, 14, "si"  },
+  { "break",   'r',  0, 13, ""    },
+};
+
+//pseudo-instructions, expanded by ExpandPseudo into rows of instrTable
+enum PseudoOp
+{
+  PSEUDO_LI, PSEUDO_LA, PSEUDO_MOVE, PSEUDO_NOT, PSEUDO_NEG, PSEUDO_NEGU, PSEUDO_NOP, PSEUDO_B,
+  PSEUDO_BEQZ, PSEUDO_BNEZ, PSEUDO_BLT, PSEUDO_BGT, PSEUDO_BLE, PSEUDO_BGE,
+  PSEUDO_BLTU, PSEUDO_BGTU, PSEUDO_BLEU, PSEUDO_BGEU, PSEUDO_JALR
+};
+
+struct PseudoDesc
+{
+  const char*               name;                     //mnemonic
+  PseudoOp                  op;                       //expansion
+};
+
+constexpr PseudoDesc pseudoTable[] =
+{
+  { "li",   PSEUDO_LI   }, { "la",   PSEUDO_LA   }, { "move", PSEUDO_MOVE },
+  { "not",  PSEUDO_NOT  }, { "neg",  PSEUDO_NEG  }, { "negu", PSEUDO_NEGU },
+  { "nop",  PSEUDO_NOP  },
+  { "b",    PSEUDO_B    }, { "beqz", PSEUDO_BEQZ }, { "bnez", PSEUDO_BNEZ },
+  { "blt",  PSEUDO_BLT  }, { "bgt",  PSEUDO_BGT  }, { "ble",  PSEUDO_BLE  },
+  { "bge",  PSEUDO_BGE  }, { "bltu", PSEUDO_BLTU }, { "bgtu", PSEUDO_BGTU },
+  { "bleu", PSEUDO_BLEU }, { "bgeu", PSEUDO_BGEU }, { "jalr", PSEUDO_JALR },
+};
+
+constexpr RegDesc regTable[] =
+{
+  { "$zero",  0 }, { "$0",  0 }, { "$at",  1 }, { "$v0",  2 }, { "$v1",  3 },
+  { "$a0",    4 }, { "$a1", 5 }, { "$a2",  6 }, { "$a3",  7 }, { "$t0",  8 },
+  { "$t1",    9 }, { "$t2", 10 }, { "$t3", 11 }, { "$t4", 12 }, { "$t5", 13 },
+  { "$t6",   14 }, { "$t7", 15 }, { "$s0", 16 }, { "$s1", 17 }, { "$s2", 18 },
+  { "$s3",   19 }, { "$s4", 20 }, { "$s5", 21 }, { "$s6", 22 }, { "$s7", 23 },
+  { "$t8",   24 }, { "$t9", 25 }, { "$k0", 26 }, { "$k1", 27 }, { "$gp", 28 },
+  { "$sp",   29 }, { "$fp", 30 }, { "$ra", 31 },
+};
+
+//perfect hash over a table's names: FNV-1a with a seed searched for at
+//compile time so that every name lands in its own slot
+template <size_t Slots>
+struct NameHash
+{
+  unsigned int              seed = 0;                 //collision free seed
+  bool                      found = false;            //false if no seed works
+  short                     slot[Slots] = {};         //table index + 1, 0 = empty
+};
+
+constexpr unsigned int HashName(std::string_view name, unsigned int seed)
+{
+  unsigned int hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < name.size(); ++i)
+  {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash ^ (hash >> 16);
+}
+
+template <size_t Slots, typename Entry, size_t N>
+constexpr NameHash<Slots> BuildNameHash(const Entry (&table)[N])
+{
+  NameHash<Slots> result;
+  for (unsigned int seed = 0; seed < 100000 && !result.found; ++seed)
+  {
+    NameHash<Slots> trial;
+    trial.seed = seed;
+    trial.found = true;
+    for (size_t i = 0; i < N && trial.found; ++i)
+    {
+      size_t slot = HashName(table[i].name, seed) & (Slots - 1);
+      if (trial.slot[slot] != 0)
+        trial.found = false;
+      trial.slot[slot] = short(i + 1);
+    }
+    if (trial.found)
+      result = trial;
+  }
+  return result;
+}
+
+//table index of name, -1 if not in table
+template <size_t Slots, typename Entry, size_t N>
+int LookupName(const NameHash<Slots>& hash, const Entry (&table)[N], std::string_view name)
+{
+  int entry = hash.slot[HashName(name, hash.seed) & (Slots - 1)] - 1;
+  if (entry < 0 || name != table[entry].name)
+    return -1;
+  return entry;
+}
+
+constexpr NameHash<512> instrHash = BuildNameHash<512>(instrTable);
+constexpr NameHash<128> regHash = BuildNameHash<128>(regTable);
+constexpr NameHash<64> pseudoHash = BuildNameHash<64>(pseudoTable);
+static_assert(instrHash.found, "no perfect hash seed for instrTable, grow its slot count");
+static_assert(regHash.found, "no perfect hash seed for regTable, grow its slot count");
+static_assert(pseudoHash.found, "no perfect hash seed for pseudoTable, grow its slot count");
+
+
+
+
+/***********************************************
+ *               Command Methods               *
+ ***********************************************/
+
+Command::Command(int lineNum, int srcLine) : lineNum(lineNum), srcLine(srcLine)
+{
+}
+
+
+
+const InstrDesc* Command::GetDesc() const
+{
+  return instr < 0 ? NULL : &instrTable[instr];
+}
+
+
+
+char Command::GetLabelRole() const
+{
+  if (half != 0)
+    return half;
+  if (instr < 0)
+    return 0;
+  for (const char* role = instrTable[instr].operands; *role != '\0'; ++role)
+  {
+    if (*role == 'o' || *role == 'b' || *role == 'j')
+      return *role;
+  }
+  return 0;
+}
+
+
+
+std::string Command::GetRIJType()
+{
+  if (instr < 0)
+    return "0";
+  return std::string(1, instrTable[instr].type);
+}
+
+
+
+int Command::GetOp()
+{
+  return instr < 0 ? 0 : instrTable[instr].op;
+}
+
+
+
+int Command::GetReg(std::string_view reg)
+{
+  int entry = LookupName(regHash, regTable, reg);
+
+  //argument not a register
+  if (entry < 0)
+    return 99;
+  return regTable[entry].number;
+}
+
+
+
+int Command::FindInstr(std::string_view name)
+{
+  return LookupName(instrHash, instrTable, name);
+}
+
+
+
+int Command::GetFunct()
+{ 
+  return instr < 0 ? 0 : instrTable[instr].funct;
+}
+
+
+
+void Command::ResolveMachine()
+{
+  //unknown instructions encode as 0
+  if (instr < 0)
+    return;
+
+  //16 bit fields hold the two's complement of signed values,
+  //branch offsets are relative to the following instruction
+  const InstrDesc& desc = instrTable[instr];
+  int low = 0;
+  switch (GetLabelRole())
+  {
+    case 'b': low = (imm - (lineNum + 1)) & 0xffff; break;
+    case 'j': low = imm & 0x3ffffff; break;
+    case 'u': low = ((4 * imm + 0x8000) >> 16) & 0xffff; break;
+    case 'l': low = (4 * imm) & 0xffff; break;
+    default:  low = imm & 0xffff; break;
+  }
+
+  //r type rows keep a shift amount in imm
+  if (desc.type == 'r')
+    low = (imm & 31) << 6 | desc.funct;
+  else if (desc.op == 1)
+    low |= desc.funct << 16;
+  machine = (desc.op << 26) | (rs << 21) | (rt << 16) | (rd << 11) | low;
+}
+
+
+
+/*********************************************
+ *               Label Methods               *
+ *********************************************/
+
+Label::Label(int lineNum, int symbol, char type) : lineNum(lineNum), symbol(symbol), type(type)
+{
+}
+
+
+
+/*********************************************
+ *            DataSegment Methods            *
+ *********************************************/
+
+void DataSegment::AddWord(int lineNum, int value)
+{
+  //extend the last range if this word directly follows it
+  if (ranges.empty() || ranges.back().type != 'w' ||
+      ranges.back().lineNum + ranges.back().count != lineNum)
+  {
+    DataRange range = { lineNum, 0, 'w', words.size() };
+    ranges.push_back(range);
+  }
+  ++ranges.back().count;
+  words.push_back(value);
+}
+
+
+
+void DataSegment::AddSpace(int lineNum, int count)
+{
+  if (count <= 0)
+    return;
+  if (!ranges.empty() && ranges.back().type == 's' &&
+      ranges.back().lineNum + ranges.back().count == lineNum)
+  {
+    ranges.back().count += count;
+    return;
+  }
+  DataRange range = { lineNum, count, 's', 0 };
+  ranges.push_back(range);
+}
+
+
+
+long long DataSegment::Size() const
+{
+  long long size = 0;
+  for (size_t i = 0; i < ranges.size(); ++i)
+    size += ranges[i].count;
+  return size;
+}
+
+
+
+/*********************************************
+ *            SymbolTable Methods            *
+ *********************************************/
+
+int SymbolTable::Intern(std::string_view name)
+{
+  std::unordered_map<std::string_view, int>::iterator found = ids.find(name);
+  if (found != ids.end())
+    return found->second;
+
+  int id = symbols.size();
+  ids.emplace(name, id);
+  symbols.emplace_back();
+  symbols.back().name = name;
+  return id;
+}
+
+
+
+int SymbolTable::Define(std::string_view name, int lineNum, int srcLine, const int* value,
+                        std::vector<Command>& cmdList)
+{
+  int id = Intern(name);
+  Symbol& symbol = symbols[id];
+
+  //first definition wins, as with the old front to back label search;
+  //a chunk's table reports later definitions when it is merged, against
+  //the first definition in the whole source
+  if (symbol.defined)
+  {
+    if (local)
+      redefinitions.emplace_back(id, srcLine);
+    else
+      Report(srcLine, "duplicate label ", name,
+             ", first defined on line " + std::to_string(symbol.srcLine) + ".");
+    ++duplicates;
+    return id;
+  }
+
+  symbol.defined = true;
+  symbol.lineNum = lineNum;
+  symbol.srcLine = srcLine;
+  if (value != NULL)
+  {
+    symbol.hasValue = true;
+    symbol.value = *value;
+  }
+
+  //backpatch forward references
+  if (deferred)
+    return id;
+  for (size_t i = 0; i < symbol.fixups.size(); ++i)
+    Patch(symbol, cmdList[symbol.fixups[i]]);
+  std::vector<int>().swap(symbol.fixups);
+  return id;
+}
+
+
+
+void SymbolTable::Reference(std::string_view name, int command, std::vector<Command>& cmdList)
+{
+  int id = Intern(name);
+  Symbol& symbol = symbols[id];
+
+  cmdList[command].symbol = id;
+  if (deferred)
+    return;
+  if (symbol.defined)
+    Patch(symbol, cmdList[command]);
+  else
+    symbol.fixups.push_back(command);
+}
+
+
+
+void SymbolTable::Patch(Symbol& symbol, Command& command)
+{
+  //offsets (lw, sw) take the label's first data operand,
+  //branches and jumps take the labeled word's index
+  if (command.GetLabelRole() == 'o')
+  {
+    if (!symbol.hasValue)
+    {
+      Report(command.srcLine, "label ", symbol.name, " has no data to use as an offset.");
+      ++errors;
+      return;
+    }
+    command.imm = symbol.value;
+  }
+  else
+    command.imm = symbol.lineNum;
+}
+
+
+
+int SymbolTable::ReportUnresolved(std::vector<Command>& cmdList)
+{
+  int unresolved = 0;
+  for (size_t i = 0; i < symbols.size(); ++i)
+  {
+    for (size_t j = 0; j < symbols[i].fixups.size(); ++j)
+    {
+      Report(cmdList[symbols[i].fixups[j]].srcLine, "undefined label ", symbols[i].name, ".");
+      ++unresolved;
+    }
+  }
+  return unresolved;
+}
+
+
+
+void SymbolTable::Report(int srcLine, std::string_view before, std::string_view name,
+                         std::string_view after)
+{
+  std::string message = "Line " + std::to_string(srcBase + srcLine) + ": ";
+  message.append(before);
+  message.append(name);
+  message.append(after);
+  messages.push_back(message);
+  return;
+}
+
+
+
+void SymbolTable::SortMessages()
+{
+  //serial and parallel runs find messages in different orders; every
+  //message starts with "Line N: "
+  std::sort(messages.begin(), messages.end(), [](const std::string& a, const std::string& b)
+  {
+    int lineA = std::atoi(a.c_str() + 5);
+    int lineB = std::atoi(b.c_str() + 5);
+    return lineA != lineB ? lineA < lineB : a < b;
+  });
+  return;
+}
+
+
+
+/*********************************************
+ *              Lexer Methods                *
+ *********************************************/
+
+Tokenizer::Tokenizer(std::string_view text, const char* delims) : rest(text), delims(delims)
+{
+}
+
+
+
+bool Tokenizer::Next(std::string_view& token)
+{
+  size_t start = rest.find_first_not_of(delims);
+  if (start == std::string_view::npos)
+  {
+    rest = std::string_view();
+    return false;
+  }
+  size_t end = rest.find_first_of(delims, start);
+  if (end == std::string_view::npos)
+    end = rest.size();
+  token = rest.substr(start, end - start);
+  rest.remove_prefix(end);
+  return true;
+}
+
+
+
+bool ParseInt(std::string_view token, int& value)
+{
+  const char* first = token.data();
+  const char* last = first + token.size();
+  if (first != last && *first == '+')
+    ++first;
+
+  //hex is a 32 bit pattern, so 0xffffffff is -1
+  if (last - first > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X'))
+  {
+    unsigned int word = 0;
+    std::from_chars_result result = std::from_chars(first + 2, last, word, 16);
+    if (result.ec != std::errc() || result.ptr != last)
+      return false;
+    value = (int)word;
+    return true;
+  }
+  std::from_chars_result result = std::from_chars(first, last, value);
+  return result.ec == std::errc() && result.ptr == last && first != last;
+}
+
+
+
+std::string_view Trim(std::string_view text)
+{
+  size_t start = text.find_first_not_of(" \t\r");
+  if (start == std::string_view::npos)
+    return std::string_view();
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(start, end - start + 1);
+}
+
+
+
+/*********************************************
+ *            ObjectBuffer Methods           *
+ *********************************************/
+
+void ObjectBuffer::Put(const char* data, size_t count)
+{
+  bytes.insert(bytes.end(), data, data + count);
+  return;
+}
+
+
+
+void ObjectBuffer::Put8(unsigned int value)
+{
+  bytes.push_back(char(value));
+  return;
+}
+
+
+
+void ObjectBuffer::Put16(unsigned int value)
+{
+  if (little)
+  {
+    Put8(value);
+    Put8(value >> 8);
+  }
+  else
+  {
+    Put8(value >> 8);
+    Put8(value);
+  }
+  return;
+}
+
+
+
+void ObjectBuffer::Put32(unsigned int value)
+{
+  if (little)
+  {
+    Put16(value);
+    Put16(value >> 16);
+  }
+  else
+  {
+    Put16(value >> 16);
+    Put16(value);
+  }
+  return;
+}
+
+
+
+void ObjectBuffer::PutHex(unsigned int value)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+  char line[9];
+  for (int i = 7; i >= 0; --i)
+  {
+    line[i] = hexDigits[value & 0xf];
+    value >>= 4;
+  }
+  line[8] = '\n';
+  Put(line, sizeof(line));
+  return;
+}
+
+
+
+void ObjectBuffer::Patch32(size_t offset, unsigned int value)
+{
+  ObjectBuffer word;
+  word.little = little;
+  word.Put32(value);
+  std::memcpy(&bytes[offset], &word.bytes[0], 4);
+  return;
+}
+
+
+
+void ObjectBuffer::Align(size_t boundary)
+{
+  while (bytes.size() % boundary != 0)
+    Put8(0);
+  return;
+}
+
+
+
+
+/*********************************************
+ *             PhaseStats Methods            *
+ *********************************************/
+
+std::atomic<unsigned long long> heapAllocs(0);
+std::atomic<unsigned long long> heapBytes(0);
+
+
+
+PhaseStats::PhaseStats() : mark(std::chrono::steady_clock::now()), allocsMark(heapAllocs),
+                           bytesMark(heapBytes)
+{
+  //fixed order, so every report has the same fields
+  static const char* names[] = { "read", "parse", "resolve", "encode", "emit", "write" };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+  {
+    phases.push_back(PhaseTime());
+    phases.back().name = names[i];
+  }
+}
+
+
+
+void PhaseStats::End(std::string_view name)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  unsigned long long allocs = heapAllocs;
+  unsigned long long bytes = heapBytes;
+
+  size_t i = 0;
+  while (i < phases.size() && phases[i].name != name)
+    ++i;
+  if (i == phases.size())
+  {
+    phases.push_back(PhaseTime());
+    phases.back().name = name;
+  }
+  phases[i].ms += std::chrono::duration<double, std::milli>(now - mark).count();
+  phases[i].allocs += allocs - allocsMark;
+  phases[i].bytes += bytes - bytesMark;
+
+  mark = now;
+  allocsMark = allocs;
+  bytesMark = bytes;
+  return;
+}
+
+
+
+double PhaseStats::TotalMs() const
+{
+  double total = 0;
+  for (size_t i = 0; i < phases.size(); ++i)
+    total += phases[i].ms;
+  return total;
+}
+
+
+
+std::string PhaseStats::Json(std::string_view file, int lines, int threads, long peakKb) const
+{
+  //file names are passed through except for quotes and backslashes
+  std::string json = "{\"file\":\"";
+  for (size_t i = 0; i < file.size(); ++i)
+  {
+    if (file[i] == '"' || file[i] == '\\')
+      json.push_back('\\');
+    json.push_back(file[i]);
+  }
+
+  char field[128];
+  double total = TotalMs();
+  std::snprintf(field, sizeof(field),
+                "\",\"lines\":%d,\"threads\":%d,\"ms\":%.3f,\"lines_per_s\":%.0f,"
+                "\"peak_rss_kb\":%ld,\"phases\":{",
+                lines, threads, total, total > 0 ? lines / (total / 1000) : 0.0, peakKb);
+  json += field;
+  for (size_t i = 0; i < phases.size(); ++i)
+  {
+    std::snprintf(field, sizeof(field), "%s\"%.*s\":{\"ms\":%.3f,\"allocs\":%llu,\"bytes\":%llu}",
+                  i == 0 ? "" : ",", (int)phases[i].name.size(), phases[i].name.data(),
+                  phases[i].ms, phases[i].allocs, phases[i].bytes);
+    json += field;
+  }
+  json += "}}";
+  return json;
+}
+
+
+
+/**************************************************
+ *               Non-member Methods               *
+ *************************************************/
+
+std::ostream& operator << (std::ostream& os, const Command& command)
+{
+  //for debugging
+  //output Command data mambers
+  os << "Instruction: " << (command.instr < 0 ? "unknown" : instrTable[command.instr].name)
+     << " rs " << int(command.rs) << " rt " << int(command.rt) << " rd " << int(command.rd)
+     << " imm " << command.imm << std::endl;
+
+  os << "Line Number:      " << command.lineNum << std::endl;
+
+  os << "Source Line:      " << command.srcLine << std::endl;
+
+  os << "Machine: " << std::setw(8) << std::hex << std::setfill('0') << command.machine << std::endl;
+
+  os << std::dec;
+  return os;
+}
+
+
+
+std::ostream& operator << (std::ostream& os, const DataRange& range)
+{
+  //for debugging
+  //output data range members
+  os << "Line Number:      " << range.lineNum << std::endl;
+
+  os << "Range Type:       " << range.type << std::endl;
+
+  os << "Word Count:       " << range.count << std::endl;
+
+  return os;
+}
+
+
+
+std::ostream& operator << (std::ostream& os, const Label& label)
+{
+  //for debugging
+  //output label data mambers
+  os << "Symbol: " << label.symbol << std::endl;
+
+  os << "Line Number:      " << label.lineNum << std::endl;
+
+  os << "Instruciton Type: " << label.type << std::endl;
+
+  os << "Machine: " << std::setw(8) << std::hex << std::setfill('0') << label.machine << std::endl;
+
+  os << std::dec;
+  return os;
+}
+
+
+
+//decode one instruction line into the command at cmdList[command];
+//label operands are registered with the symbol table
+void ParseCommand(std::string_view line, int command, std::vector<Command>& cmdList,
+                  SymbolTable& symbols)
+{
+  Tokenizer tokens(line, ", ()");
+  std::string_view token;
+  if (!tokens.Next(token))
+    return;
+
+  //classify once, every later step reads the table row
+  Command& newCommand = cmdList[command];
+  newCommand.instr = LookupName(instrHash, instrTable, token);
+  if (newCommand.instr < 0)
+    return;
+
+  //fill fields from operands in the order the table row lists them
+  for (const char* role = instrTable[newCommand.instr].operands; *role != '\0'; ++role)
+  {
+    if (!tokens.Next(token))
+      break;
+
+    //%hi(label) and %lo(label) take the place of an immediate or offset
+    if ((*role == 'i' || *role == 'o') && (token == "%hi" || token == "%lo"))
+    {
+      newCommand.half = token == "%hi" ? 'u' : 'l';
+      if (tokens.Next(token))
+        ResolveLabels(command, token, cmdList, symbols);
+      continue;
+    }
+
+    switch (*role)
+    {
+      case 'd': newCommand.rd = Command::GetReg(token); break;
+      case 's': newCommand.rs = Command::GetReg(token); break;
+      case 't': newCommand.rt = Command::GetReg(token); break;
+      case 'c': newCommand.rd = newCommand.rt = Command::GetReg(token); break;
+      case 'i':
+        if (!ParseInt(token, newCommand.imm))
+        {
+          symbols.Report(newCommand.srcLine, "invalid immediate ", token, ".");
+          ++symbols.errors;
+        }
+        break;
+      case 'a':
+        if (!ParseInt(token, newCommand.imm))
+        {
+          symbols.Report(newCommand.srcLine, "invalid shift amount ", token, ".");
+          ++symbols.errors;
+        }
+        break;
+
+      //numeric operands are used as written, anything else is a label
+      default:
+        if (!ParseInt(token, newCommand.imm))
+          ResolveLabels(command, token, cmdList, symbols);
+        break;
+    }
+  }
+}
+
+
+
+//append one command of an expansion at the chunk's next word
+static int AddCommand(Chunk& chunk, std::string_view name, int rd, int rs, int rt, int imm)
+{
+  chunk.cmdList.emplace_back(chunk.index++, chunk.srcLine);
+  Command& command = chunk.cmdList.back();
+  command.instr = LookupName(instrHash, instrTable, name);
+  command.rd = rd;
+  command.rs = rs;
+  command.rt = rt;
+  command.imm = imm;
+  return chunk.cmdList.size() - 1;
+}
+
+
+
+//label or numeric target operand of the command just added
+static void AddTarget(Chunk& chunk, int command, std::string_view target)
+{
+  if (!ParseInt(target, chunk.cmdList[command].imm))
+    ResolveLabels(command, target, chunk.cmdList, chunk.symbols);
+  return;
+}
+
+
+
+//shortest sequence putting value in reg: one addiu, ori or lui when the
+//value allows, else lui then ori
+static void AddConstant(Chunk& chunk, int reg, int value)
+{
+  unsigned int word = (unsigned int)value;
+  if (value >= -32768 && value <= 32767)
+    AddCommand(chunk, "addiu", 0, 0, reg, value);
+  else if (word <= 0xffff)
+    AddCommand(chunk, "ori", 0, 0, reg, value);
+  else
+  {
+    AddCommand(chunk, "lui", 0, 0, reg, word >> 16);
+    if ((word & 0xffff) != 0)
+      AddCommand(chunk, "ori", 0, reg, reg, word & 0xffff);
+  }
+  return;
+}
+
+
+
+bool ExpandPseudo(std::string_view line, Chunk& chunk)
+{
+  Tokenizer tokens(line, ", ()");
+  std::string_view name;
+  if (!tokens.Next(name))
+    return false;
+  int entry = LookupName(pseudoHash, pseudoTable, name);
+  if (entry < 0)
+    return false;
+
+  //missing operands read as empty, which is no register and no number
+  std::string_view operand[3];
+  int count = 0;
+  while (count < 3 && tokens.Next(operand[count]))
+    ++count;
+  int a = Command::GetReg(operand[0]);
+  int b = Command::GetReg(operand[1]);
+  const int at = 1;
+
+  PseudoOp op = pseudoTable[entry].op;
+  switch (op)
+  {
+    case PSEUDO_LI:
+    {
+      int value = 0;
+      if (!ParseInt(operand[1], value))
+      {
+        chunk.symbols.Report(chunk.srcLine, "invalid immediate ", operand[1], ".");
+        ++chunk.symbols.errors;
+        return true;
+      }
+      AddConstant(chunk, a, value);
+      return true;
+    }
+    case PSEUDO_LA:
+    {
+      //addresses are final only once labels resolve, so always two words
+      int value = 0;
+      if (ParseInt(operand[1], value))
+      {
+        AddConstant(chunk, a, value);
+        return true;
+      }
+      int high = AddCommand(chunk, "lui", 0, 0, a, 0);
+      chunk.cmdList[high].half = 'u';
+      ResolveLabels(high, operand[1], chunk.cmdList, chunk.symbols);
+      int low = AddCommand(chunk, "addiu", 0, a, a, 0);
+      chunk.cmdList[low].half = 'l';
+      ResolveLabels(low, operand[1], chunk.cmdList, chunk.symbols);
+      return true;
+    }
+    case PSEUDO_MOVE: AddCommand(chunk, "addu", a, b, 0, 0); return true;
+    case PSEUDO_NOT:  AddCommand(chunk, "nor", a, b, 0, 0); return true;
+    case PSEUDO_NEG:  AddCommand(chunk, "sub", a, 0, b, 0); return true;
+    case PSEUDO_NEGU: AddCommand(chunk, "subu", a, 0, b, 0); return true;
+    case PSEUDO_NOP:  AddCommand(chunk, "sll", 0, 0, 0, 0); return true;
+    case PSEUDO_B:    AddTarget(chunk, AddCommand(chunk, "beq", 0, 0, 0, 0), operand[0]); return true;
+    case PSEUDO_BEQZ: AddTarget(chunk, AddCommand(chunk, "beq", 0, a, 0, 0), operand[1]); return true;
+    case PSEUDO_BNEZ: AddTarget(chunk, AddCommand(chunk, "bne", 0, a, 0, 0), operand[1]); return true;
+
+    //jalr rs links through $ra; jalr rd, rs is the table row
+    case PSEUDO_JALR:
+      if (count > 1)
+        return false;
+      AddCommand(chunk, "jalr", 31, a, 0, 0);
+      return true;
+    default:
+      break;
+  }
+
+  //compare and branch: bgt and ble swap their operands into blt and bge
+  bool isUnsigned = op == PSEUDO_BLTU || op == PSEUDO_BGTU || op == PSEUDO_BLEU
+                    || op == PSEUDO_BGEU;
+  bool swap = op == PSEUDO_BGT || op == PSEUDO_BLE || op == PSEUDO_BGTU || op == PSEUDO_BLEU;
+  bool less = op == PSEUDO_BLT || op == PSEUDO_BGT || op == PSEUDO_BLTU || op == PSEUDO_BGTU;
+  int value = 0;
+  bool isConstant = b == 99 && ParseInt(operand[1], value);
+  if (b == 99 && !isConstant)
+  {
+    chunk.symbols.Report(chunk.srcLine, "invalid register or immediate ", operand[1], ".");
+    ++chunk.symbols.errors;
+    return true;
+  }
+  if (isConstant && value == 0)
+  {
+    b = 0;
+    isConstant = false;
+  }
+
+  //against $zero a signed compare is one branch
+  if (!isUnsigned && !isConstant && (a == 0 || b == 0))
+  {
+    int reg = a == 0 ? b : a;
+    bool regFirst = (a != 0) != swap;                 //reg is the left side of "<"
+    const char* branch = less ? (regFirst ? "bltz" : "bgtz") : (regFirst ? "bgez" : "blez");
+    AddTarget(chunk, AddCommand(chunk, branch, 0, reg, 0, 0), operand[2]);
+    return true;
+  }
+
+  //x < c is one slti; x > c is !(x < c + 1) and x <= c is x < c + 1, so
+  //swapped compares test c + 1 and branch the other way
+  if (isConstant)
+  {
+    long long bound = isUnsigned ? (long long)(unsigned int)value : (long long)value;
+    bound += swap ? 1 : 0;
+    bool fits = isUnsigned ? bound <= 32767 || (bound >= 0xffff8000LL && bound <= 0xffffffffLL)
+                           : bound >= -32768 && bound <= 32767;
+    if (fits)
+    {
+      AddCommand(chunk, isUnsigned ? "sltiu" : "slti", 0, a, at, (int)bound);
+      AddTarget(chunk, AddCommand(chunk, less != swap ? "bne" : "beq", 0, at, 0, 0), operand[2]);
+      return true;
+    }
+    AddConstant(chunk, at, value);
+    b = at;
+  }
+
+  int left = swap ? b : a;
+  int right = swap ? a : b;
+  AddCommand(chunk, isUnsigned ? "sltu" : "slt", at, left, right, 0);
+  AddTarget(chunk, AddCommand(chunk, less ? "bne" : "beq", 0, at, 0, 0), operand[2]);
+  return true;
+}
+
+
+
+void ResolveLabels(int command, std::string_view label, std::vector<Command>& cmdList,
+                   SymbolTable& symbols)
+{
+  symbols.Reference(label, command, cmdList);
+}
+
+
+
+void ReadLine(std::string_view lineIn, Chunk& chunk)
+{
+  //.globl and .extern names are shared with other files, in either section
+  if (lineIn.substr(0, 6) == ".globl" || lineIn.substr(0, 7) == ".extern")
+  {
+    Tokenizer names(lineIn, ", \t");
+    std::string_view name;
+    names.Next(name);
+    if (name == ".globl" || name == ".extern")
+    {
+      while (names.Next(name))
+        chunk.symbols.symbols[chunk.symbols.Intern(name)].global = true;
+      return;
+    }
+  }
+
+  //.text section - process .text instructions
+  if (!chunk.inData)
+  {
+    //if .data section is entered, break out of .text loop
+    if (lineIn == ".data")
+    {
+      chunk.inData = 1;
+      return;
+    }
+    //ignore .text instruction
+    if(lineIn == ".text")
+    {
+      return;
+    }
+
+    //only labels contain ':'
+    //store labels in seperate list
+    size_t result = lineIn.find(':');
+    if (result != std::string_view::npos)
+    {
+      std::string_view name;
+      Tokenizer(lineIn.substr(0, result), " \t").Next(name);
+      int symbol = chunk.symbols.Define(name, chunk.index, chunk.srcLine, NULL, chunk.cmdList);
+      chunk.lblList.emplace_back(chunk.index, symbol, 't');
+
+      //text labels have same lineNum as next command, which may
+      //follow on the same line
+      lineIn = Trim(lineIn.substr(result + 1));
+      if (lineIn.empty())
+        return;
+    }
+
+    //if not a label...
+    //pseudo-instructions add their own commands
+    if (ExpandPseudo(lineIn, chunk))
+      return;
+
+    //determine type of instruction, push onto command list
+    chunk.cmdList.emplace_back(chunk.index, chunk.srcLine);
+    ParseCommand(lineIn, chunk.cmdList.size() - 1, chunk.cmdList, chunk.symbols);
+    ++chunk.index;
+    return;
+  }
+
+  //.data section - process .data instructions
+  Tokenizer tokens(lineIn, ", ():\t");
+  std::string_view name;
+  std::string_view directive;
+  if (!tokens.Next(name))
+    return;
+  if (name[0] == '.')
+  {
+    //unlabeled directive
+    directive = name;
+    name = std::string_view();
+  }
+  else
+    tokens.Next(directive);
+
+  //first operand is the label's value for lw and sw offsets
+  std::string_view first;
+  int value = 0;
+  Tokenizer operands = tokens;
+  bool hasValue = operands.Next(first) && ParseInt(first, value);
+  int symbol = -1;
+  if (!name.empty())
+    symbol = chunk.symbols.Define(name, chunk.index, chunk.srcLine, hasValue ? &value : NULL,
+                                  chunk.cmdList);
+
+  if (symbol >= 0)
+    chunk.lblList.emplace_back(chunk.index, symbol, directive == ".word" ? 'w' : 's');
+
+  //process .word allocations
+  if (directive == ".word")
+  {
+    std::string_view word;
+    while (tokens.Next(word))
+    {
+      int wordValue = 0;
+      if (!ParseInt(word, wordValue))
+      {
+        chunk.symbols.Report(chunk.srcLine, "invalid .word value ", word, ".");
+        ++chunk.symbols.errors;
+      }
+      chunk.data.AddWord(chunk.index, wordValue);
+      ++chunk.index;
+    }
+  }
+
+  //.space needs a size of 0 or more
+  else if (directive == ".space" && (!hasValue || value < 0))
+  {
+    chunk.symbols.Report(chunk.srcLine, "invalid .space size ",
+                         first.empty() ? std::string_view("(none)") : first, ".");
+    ++chunk.symbols.errors;
+  }
+
+  //process .space allocations
+  //one zero word per byte reserved, kept as a single range
+  else if (value > 0)
+  {
+    chunk.data.AddSpace(chunk.index, value);
+    chunk.index += value;
+  }
+}
+
+
+
+void ReadChunk(Chunk& chunk)
+{
+  std::string_view source = chunk.text;
+  chunk.cmdList.reserve(source.size() / 16);
+  size_t lineStart = 0;
+  while (lineStart < source.size())
+  {
+    size_t lineEnd = source.find('\n', lineStart);
+    if (lineEnd == std::string_view::npos)
+      lineEnd = source.size();
+    std::string_view lineIn = Trim(source.substr(lineStart, lineEnd - lineStart));
+    lineStart = lineEnd + 1;
+
+    //skip blank lines
+    ++chunk.srcLine;
+    if (!lineIn.empty())
+      ReadLine(lineIn, chunk);
+  }
+}
+
+
+
+void AssembleSerial(std::string_view source, Chunk& program, PhaseStats* stats)
+{
+  //labels are backpatched while reading, so parse includes resolving
+  program.text = source;
+  ReadChunk(program);
+  if (stats != NULL)
+    stats->End("parse");
+
+  //resolve machine codes in cmdList
+  for (size_t i = 0; i < program.cmdList.size(); ++i)
+  {
+    program.cmdList[i].ResolveMachine();
+  }
+  if (stats != NULL)
+    stats->End("encode");
+}
+
+
+
+size_t FindDataStart(std::string_view source)
+{
+  //everything after the first ".data" line is data
+  for (size_t at = source.find(".data"); at != std::string_view::npos;
+       at = source.find(".data", at + 1))
+  {
+    size_t lineStart = source.rfind('\n', at);
+    lineStart = lineStart == std::string_view::npos ? 0 : lineStart + 1;
+    size_t lineEnd = source.find('\n', at);
+    if (lineEnd == std::string_view::npos)
+      lineEnd = source.size();
+    if (Trim(source.substr(lineStart, lineEnd - lineStart)) == ".data")
+      return lineStart;
+  }
+  return source.size();
+}
+
+
+
+void SplitChunks(std::string_view source, int threads, std::vector<Chunk>& chunks)
+{
+  size_t dataStart = FindDataStart(source);
+
+  //cut at line starts near every 1/threads of the source, and at the
+  //start of .data so no chunk holds both sections
+  std::vector<size_t> cuts(1, 0);
+  for (int t = 1; t < threads; ++t)
+  {
+    size_t cut = source.find('\n', source.size() * t / threads);
+    cut = cut == std::string_view::npos ? source.size() : cut + 1;
+    if (dataStart > cuts.back() && dataStart < cut)
+      cuts.push_back(dataStart);
+    if (cut > cuts.back() && cut < source.size())
+      cuts.push_back(cut);
+  }
+  if (dataStart > cuts.back() && dataStart < source.size())
+    cuts.push_back(dataStart);
+  cuts.push_back(source.size());
+
+  //chunks report source lines counted from the start of the file
+  chunks.resize(cuts.size() - 1);
+  int srcBase = 0;
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    chunks[c].text = source.substr(cuts[c], cuts[c + 1] - cuts[c]);
+    chunks[c].inData = cuts[c] >= dataStart;
+    chunks[c].symbols.srcBase = srcBase;
+    srcBase += std::count(chunks[c].text.begin(), chunks[c].text.end(), '\n');
+  }
+  return;
+}
+
+
+
+void ReadChunks(std::vector<Chunk>& chunks, int threads)
+{
+  //lex, classify and encode register and immediate fields concurrently
+  RunWorkers(chunks.size(), threads, [&](size_t c)
+  {
+    if (chunks[c].cached)
+      return;
+    chunks[c].symbols.deferred = true;
+    chunks[c].symbols.local = true;
+    ReadChunk(chunks[c]);
+  });
+  return;
+}
+
+
+
+void AssembleParallel(std::string_view source, int threads, Chunk& program, PhaseStats* stats)
+{
+  std::vector<Chunk> chunks;
+  SplitChunks(source, threads, chunks);
+  ReadChunks(chunks, threads);
+  if (stats != NULL)
+    stats->End("parse");
+  MergeChunks(chunks, threads, program, stats);
+  return;
+}
+
+
+
+unsigned long long HashBytes(std::string_view text, unsigned long long seed)
+{
+  //eight bytes per multiply, then splitmix64's finalizer so every bit
+  //depends on every input byte
+  unsigned long long hash = seed ^ (text.size() * 0x9E3779B97F4A7C15ULL);
+  size_t at = 0;
+  for (; at + 8 <= text.size(); at += 8)
+  {
+    unsigned long long word;
+    std::memcpy(&word, text.data() + at, sizeof(word));
+    hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 29;
+  }
+  unsigned long long tail = 0;
+  std::memcpy(&tail, text.data() + at, text.size() - at);
+  hash = (hash ^ tail) * 0x94D049BB133111EBULL;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+  return hash ^ (hash >> 31);
+}
+
+
+
+void SplitBlocks(std::string_view source, std::vector<Chunk>& chunks)
+{
+  size_t dataStart = FindDataStart(source);
+
+  //a block ends after a line whose hash has its low 6 bits clear, giving
+  //blocks of about 64 lines whose ends depend only on nearby text; the
+  //block's hash is built from its lines' hashes
+  size_t blockStart = 0;
+  int lines = 0;
+  int srcBase = 0;
+  unsigned long long blockHash = 0;
+  auto cut = [&](size_t end)
+  {
+    chunks.emplace_back();
+    Chunk& chunk = chunks.back();
+    chunk.text = source.substr(blockStart, end - blockStart);
+    chunk.inData = blockStart >= dataStart;
+    chunk.symbols.srcBase = srcBase;
+    srcBase += lines;
+    chunk.hash = HashBytes(std::string_view((const char*)&blockHash, sizeof(blockHash)),
+                           chunk.inData);
+    blockStart = end;
+    lines = 0;
+    blockHash = 0;
+  };
+
+  size_t lineStart = 0;
+  while (lineStart < source.size())
+  {
+    if (lineStart == dataStart && lineStart > blockStart)
+      cut(lineStart);
+
+    const char* newline = (const char*)std::memchr(source.data() + lineStart, '\n',
+                                                   source.size() - lineStart);
+    size_t lineEnd = newline == NULL ? source.size() : newline - source.data() + 1;
+    unsigned long long hash = HashBytes(source.substr(lineStart, lineEnd - lineStart), 0);
+    blockHash = (blockHash ^ hash) * 0x9E3779B97F4A7C15ULL + lines;
+    ++lines;
+    if ((lines >= 8 && (hash & 63) == 0) || lines >= 1024)
+      cut(lineEnd);
+    lineStart = lineEnd;
+  }
+  if (blockStart < source.size())
+    cut(source.size());
+  return;
+}
+
+
+
+void MergeChunks(std::vector<Chunk>& chunks, int threads, Chunk& program, PhaseStats* stats)
+{
+  //word and source line numbering of every chunk
+  std::vector<int> base(chunks.size());
+  std::vector<int> srcBase(chunks.size());
+  std::vector<size_t> cmdBase(chunks.size());
+  int index = 0;
+  int srcLine = 0;
+  size_t commands = 0;
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    base[c] = index;
+    srcBase[c] = srcLine;
+    cmdBase[c] = commands;
+    index += chunks[c].index;
+    srcLine += chunks[c].srcLine;
+    commands += chunks[c].cmdList.size();
+  }
+
+  //merge symbol tables in source order, so the first definition still wins
+  SymbolTable& symbols = program.symbols;
+  symbols.deferred = true;
+  size_t localSymbols = 0;
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    localSymbols += chunks[c].symbols.symbols.size();
+    symbols.errors += chunks[c].symbols.errors;
+    std::vector<std::string>& messages = chunks[c].symbols.messages;
+    symbols.messages.insert(symbols.messages.end(), messages.begin(), messages.end());
+  }
+  symbols.ids.reserve(localSymbols);
+  std::vector< std::vector<int> > globalId(chunks.size());
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    std::vector<Symbol>& local = chunks[c].symbols.symbols;
+    globalId[c].resize(local.size());
+    for (size_t i = 0; i < local.size(); ++i)
+    {
+      if (local[i].defined)
+        globalId[c][i] = symbols.Define(local[i].name, base[c] + local[i].lineNum,
+                                        srcBase[c] + local[i].srcLine,
+                                        local[i].hasValue ? &local[i].value : NULL,
+                                        program.cmdList);
+      else
+        globalId[c][i] = symbols.Intern(local[i].name);
+      symbols.symbols[globalId[c][i]].global |= local[i].global;
+    }
+
+    //the chunk's own duplicates, now that earlier chunks' labels are known
+    std::vector< std::pair<int, int> >& later = chunks[c].symbols.redefinitions;
+    for (size_t i = 0; i < later.size(); ++i)
+      symbols.Define(local[later[i].first].name, 0, srcBase[c] + later[i].second, NULL,
+                     program.cmdList);
+  }
+
+  //rebase labels and data serially, they are few
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    for (size_t i = 0; i < chunks[c].lblList.size(); ++i)
+    {
+      Label label = chunks[c].lblList[i];
+      label.lineNum += base[c];
+      label.symbol = globalId[c][label.symbol];
+      program.lblList.push_back(label);
+    }
+
+    const DataSegment& data = chunks[c].data;
+    for (size_t r = 0; r < data.ranges.size(); ++r)
+    {
+      DataRange range = data.ranges[r];
+      range.lineNum += base[c];
+      range.first += program.data.words.size();
+      program.data.ranges.push_back(range);
+    }
+    program.data.words.insert(program.data.words.end(), data.words.begin(), data.words.end());
+  }
+  if (stats != NULL)
+    stats->End("resolve");
+
+  //fix up label fields and finish encoding concurrently; references that
+  //need a diagnostic are left for the serial pass below
+  program.cmdList.resize(commands, Command(0, 0));
+  std::vector< std::vector<size_t> > problems(chunks.size());
+  RunWorkers(chunks.size(), threads, [&](size_t c)
+  {
+    std::vector<Command>& local = chunks[c].cmdList;
+    for (size_t i = 0; i < local.size(); ++i)
+    {
+      Command& command = program.cmdList[cmdBase[c] + i];
+      command = local[i];
+      command.lineNum += base[c];
+      command.srcLine += srcBase[c];
+      if (command.symbol >= 0)
+      {
+        command.symbol = globalId[c][command.symbol];
+        Symbol& symbol = symbols.symbols[command.symbol];
+        if (symbol.defined && (symbol.hasValue || command.GetLabelRole() != 'o'))
+          symbols.Patch(symbol, command);
+        else
+          problems[c].push_back(cmdBase[c] + i);
+      }
+      command.ResolveMachine();
+    }
+    std::vector<Command>().swap(local);
+  });
+
+  //undefined labels and labels without data, reported in source order
+  for (size_t c = 0; c < problems.size(); ++c)
+  {
+    for (size_t i = 0; i < problems[c].size(); ++i)
+    {
+      Command& command = program.cmdList[problems[c][i]];
+      Symbol& symbol = symbols.symbols[command.symbol];
+      if (symbol.defined)
+        symbols.Patch(symbol, command);
+      else
+        symbol.fixups.push_back(problems[c][i]);
+    }
+  }
+  if (stats != NULL)
+    stats->End("encode");
+
+  program.index = index;
+  program.srcLine = srcLine;
+  program.inData = !chunks.empty() && chunks.back().inData;
+  return;
+}
+
+
+
+std::vector<unsigned int> ImageWords(const Chunk& program)
+{
+  std::vector<unsigned int> words;
+  words.reserve(program.cmdList.size() + program.data.Size());
+  for (size_t i = 0; i < program.cmdList.size(); ++i)
+    words.push_back(program.cmdList[i].machine);
+
+  const DataSegment& data = program.data;
+  for (size_t i = 0; i < data.ranges.size(); ++i)
+  {
+    const DataRange& range = data.ranges[i];
+    if (range.type == 'w')
+      words.insert(words.end(), data.words.begin() + range.first,
+                   data.words.begin() + range.first + range.count);
+    else
+      words.resize(words.size() + range.count, 0);
+  }
+  return words;
+}
+
+
+
+void EmitHex(const std::vector<unsigned int>& words, ObjectBuffer& out)
+{
+  out.bytes.reserve(1 + 9 * words.size());
+  out.Put8('\n');
+  for (size_t i = 0; i < words.size(); ++i)
+    out.PutHex(words[i]);
+  return;
+}
+
+
+
+void EmitRaw(const std::vector<unsigned int>& words, ObjectBuffer& out)
+{
+  out.bytes.reserve(4 * words.size());
+  for (size_t i = 0; i < words.size(); ++i)
+    out.Put32(words[i]);
+  return;
+}
+
+
+
+void EmitElf(const Chunk& program, std::vector<unsigned int>& words, ObjectBuffer& out)
+{
+  //section indices and names
+  enum { NONE, TEXT, DATA, RELTEXT, SYMTAB, STRTAB, SHSTRTAB, SECTIONS };
+  static const char shstrtab[] = "\0.text\0.data\0.rel.text\0.symtab\0.strtab\0.shstrtab";
+  static const unsigned int shName[SECTIONS] = { 0, 1, 7, 13, 23, 31, 39 };
+
+  int textWords = program.cmdList.size();
+  const std::vector<Symbol>& symbols = program.symbols.symbols;
+
+  //section of every symbol: 't', 'd', or 0 if defined in another file
+  std::vector<char> section(symbols.size(), 0);
+  for (size_t i = 0; i < program.lblList.size(); ++i)
+  {
+    const Label& label = program.lblList[i];
+    if (symbols[label.symbol].lineNum == label.lineNum && section[label.symbol] == 0)
+      section[label.symbol] = label.type == 't' ? 't' : 'd';
+  }
+
+  //symbol table order: null, section symbols, locals, then globals;
+  //undefined labels are globals the linker must find elsewhere
+  std::vector<int> order;
+  std::vector<int> elfIndex(symbols.size(), 0);
+  int firstGlobal = 3;
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    if (pass == 1)
+      firstGlobal = 3 + order.size();
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+      bool global = symbols[i].global || !symbols[i].defined;
+      bool used = symbols[i].defined || symbols[i].global || !symbols[i].fixups.empty();
+      if (used && global == (pass == 1))
+      {
+        elfIndex[i] = 3 + order.size();
+        order.push_back(i);
+      }
+    }
+  }
+
+  //relocations; fields are rewritten to hold the addend. Labels resolved
+  //here are relocated against their section, so only lw/sw offsets and
+  //branches within .text need none. A %hi field holds the high half of
+  //its addend and the matching %lo field the low half, as the linker
+  //pairs them
+  std::vector<unsigned int> relocs;
+  for (int i = 0; i < textWords; ++i)
+  {
+    const Command& command = program.cmdList[i];
+    if (command.symbol < 0)
+      continue;
+    const Symbol& symbol = symbols[command.symbol];
+    char where = section[command.symbol];
+    int offset = where == 'd' ? symbol.lineNum - textWords : symbol.lineNum;
+    unsigned int target = where == 0 ? elfIndex[command.symbol] : (where == 't' ? 1 : 2);
+    unsigned int type;
+    switch (command.GetLabelRole())
+    {
+      case 'o':
+        if (where != 0)
+          continue;
+        type = RELOC_VALUE16;
+        words[i] &= ~0xffffu;
+        break;
+      case 'b':
+        if (where == 't')
+          continue;
+        type = RELOC_PC16;
+        words[i] = (words[i] & ~0xffffu) | ((where == 0 ? -1 : offset - 1) & 0xffff);
+        break;
+      case 'u':
+      case 'l':
+      {
+        unsigned int addend = where == 0 ? 0 : 4 * offset;
+        type = command.GetLabelRole() == 'u' ? RELOC_HI16 : RELOC_LO16;
+        addend = type == RELOC_HI16 ? (addend + 0x8000) >> 16 : addend;
+        words[i] = (words[i] & ~0xffffu) | (addend & 0xffff);
+        break;
+      }
+      default:
+        type = RELOC_26;
+        words[i] = (words[i] & ~0x3ffffffu) | ((where == 0 ? 0 : offset) & 0x3ffffff);
+        break;
+    }
+    relocs.push_back(4 * i);
+    relocs.push_back(target << 8 | type);
+  }
+
+  out.bytes.reserve(52 + 4 * words.size() + 4 * relocs.size() + 32 * order.size() + 40 * SECTIONS);
+
+  //ELF header, section header offset patched at the end
+  static const char ident[] = { 0x7f, 'E', 'L', 'F', 1 };
+  out.Put(ident, sizeof(ident));
+  out.Put8(out.little ? 1 : 2);                       //EI_DATA
+  out.Put8(1);                                        //EI_VERSION
+  out.Align(16);
+  out.Put16(1);                                       //ET_REL
+  out.Put16(8);                                       //EM_MIPS
+  out.Put32(1);                                       //EV_CURRENT
+  out.Put32(0);                                       //entry
+  out.Put32(0);                                       //no program headers
+  size_t shoffAt = out.bytes.size();
+  out.Put32(0);
+  out.Put32(0x50001000);                              //MIPS32, o32 ABI
+  out.Put16(52);
+  out.Put16(0);
+  out.Put16(0);
+  out.Put16(40);
+  out.Put16(SECTIONS);
+  out.Put16(SHSTRTAB);
+
+  //section contents; offsets[i] and sizes[i] for the headers
+  size_t offsets[SECTIONS] = {};
+  size_t sizes[SECTIONS] = {};
+
+  offsets[TEXT] = out.bytes.size();
+  for (int i = 0; i < textWords; ++i)
+    out.Put32(words[i]);
+  sizes[TEXT] = out.bytes.size() - offsets[TEXT];
+
+  offsets[DATA] = out.bytes.size();
+  for (size_t i = textWords; i < words.size(); ++i)
+    out.Put32(words[i]);
+  sizes[DATA] = out.bytes.size() - offsets[DATA];
+
+  offsets[RELTEXT] = out.bytes.size();
+  for (size_t i = 0; i < relocs.size(); ++i)
+    out.Put32(relocs[i]);
+  sizes[RELTEXT] = out.bytes.size() - offsets[RELTEXT];
+
+  //labels are valued at their byte offset in their section; data labels
+  //with an operand are objects carrying that operand, their lw/sw offset,
+  //as their size
+  std::string strtab(1, '\0');
+  offsets[SYMTAB] = out.bytes.size();
+  out.bytes.resize(out.bytes.size() + 16, 0);
+  for (int sectionIndex = TEXT; sectionIndex <= DATA; ++sectionIndex)
+  {
+    out.Put32(0);
+    out.Put32(0);
+    out.Put32(0);
+    out.Put8(3);                                      //STB_LOCAL, STT_SECTION
+    out.Put8(0);
+    out.Put16(sectionIndex);
+  }
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    const Symbol& symbol = symbols[order[i]];
+    char where = section[order[i]];
+    bool isObject = where == 'd' && symbol.hasValue;
+    out.Put32(strtab.size());
+    out.Put32(where == 0 ? 0 : 4 * (where == 'd' ? symbol.lineNum - textWords : symbol.lineNum));
+    out.Put32(isObject ? symbol.value : 0);
+    out.Put8((symbol.global || !symbol.defined) << 4 | isObject);
+    out.Put8(0);
+    out.Put16(where == 0 ? 0 : (where == 't' ? TEXT : DATA));
+    strtab.append(symbol.name.data(), symbol.name.size());
+    strtab.push_back('\0');
+  }
+  sizes[SYMTAB] = out.bytes.size() - offsets[SYMTAB];
+
+  offsets[STRTAB] = out.bytes.size();
+  out.Put(strtab.data(), strtab.size());
+  sizes[STRTAB] = strtab.size();
+
+  offsets[SHSTRTAB] = out.bytes.size();
+  out.Put(shstrtab, sizeof(shstrtab));
+  sizes[SHSTRTAB] = sizeof(shstrtab);
+
+  //section headers
+  out.Align(4);
+  out.Patch32(shoffAt, out.bytes.size());
+  static const unsigned int type[SECTIONS] = { 0, 1, 1, 9, 2, 3, 3 };
+  static const unsigned int flags[SECTIONS] = { 0, 6, 3, 0, 0, 0, 0 };
+  static const unsigned int link[SECTIONS] = { 0, 0, 0, SYMTAB, STRTAB, 0, 0 };
+  static const unsigned int entsize[SECTIONS] = { 0, 0, 0, 8, 16, 0, 0 };
+  for (int i = 0; i < SECTIONS; ++i)
+  {
+    out.Put32(shName[i]);
+    out.Put32(type[i]);
+    out.Put32(flags[i]);
+    out.Put32(0);                                     //address
+    out.Put32(offsets[i]);
+    out.Put32(sizes[i]);
+    out.Put32(link[i]);
+    out.Put32(i == RELTEXT ? TEXT : (i == SYMTAB ? firstGlobal : 0));
+    out.Put32(i == NONE ? 0 : (i <= SYMTAB ? 4 : 1));
+    out.Put32(entsize[i]);
+  }
+  return;
+}
+
+
+
+Assembly Assemble(std::string_view source)
+{
+  Assembly result;
+  Chunk program;
+  AssembleSerial(source, program, NULL);
+  int unresolved = program.symbols.ReportUnresolved(program.cmdList);
+  program.symbols.SortMessages();
+  result.ok = unresolved == 0 && program.symbols.errors == 0;
+  result.diagnostics.swap(program.symbols.messages);
+
+  std::vector<unsigned int> words = ImageWords(program);
+  result.text.assign(words.begin(), words.begin() + program.cmdList.size());
+  result.data.assign(words.begin() + program.cmdList.size(), words.end());
+  result.srcLines.reserve(program.cmdList.size());
+  for (size_t i = 0; i < program.cmdList.size(); ++i)
+    result.srcLines.push_back(program.cmdList[i].srcLine);
+
+  //first definition of every label
+  std::vector<Symbol>& symbols = program.symbols.symbols;
+  std::vector<char> listed(symbols.size(), 0);
+  for (size_t i = 0; i < program.lblList.size(); ++i)
+  {
+    const Label& label = program.lblList[i];
+    const Symbol& symbol = symbols[label.symbol];
+    if (listed[label.symbol] || symbol.lineNum != label.lineNum)
+      continue;
+    listed[label.symbol] = 1;
+    result.symbols.push_back(AsmSymbol{ std::string(symbol.name), label.lineNum, label.type,
+                                        symbol.srcLine, symbol.global, symbol.hasValue,
+                                        symbol.value });
+  }
+  return result;
+}
+
+#endif
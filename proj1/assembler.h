@@ -0,0 +1,420 @@
+/**
+ * @file   assembler.h
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Simple MIPS Assembler library
+ *
+ * @description
+ * Classes and functions that turn MIPS assembly source
+ * held in memory into machine words. Nothing here opens
+ * files or writes to streams; main.cpp is one front end.
+ *****************************************************/
+
+#ifndef assembler_H
+#define assembler_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+
+/********************************************
+ *            Instruction Tables            *
+ ********************************************/
+
+//operand roles, one character per source operand in token order
+//  d rd     s rs     t rt     i 16b immediate     a 5b shift amount
+//  c rd, copied to rt as clz and clo require
+//  o 16b offset, label -> label's first data operand
+//  b 16b branch offset, label -> index relative to next instruction
+//  j 26b jump target, label -> index
+//an 'i' or 'o' operand written %hi(label) or %lo(label) takes the high or
+//low half of the label's byte address instead, the high half rounded so
+//that adding the sign extended low half gives the address
+struct InstrDesc
+{
+  const char*               name;                     //mnemonic
+  char                      type;                     //'r', 'i' or 'j'
+  int                       op;                       //op code value
+  int                       funct;                    //funct code value, or rt code
+                                                      //of REGIMM (op 1) rows
+  const char*               operands;                 //operand roles
+};
+
+struct RegDesc
+{
+  const char*               name;                     //register name
+  int                       number;                   //register value
+};
+
+//instrTable and regTable rows live in assembler.cpp
+
+
+/********************************************
+ *               Command Class              *
+ ********************************************/
+
+//one instruction of the flat IR; operands are decoded to numbers when the
+//line is read, so later passes never touch text
+struct Command
+{
+  int                       lineNum;                  //asmFile line number
+  int                       srcLine = 0;              //line number in source text
+  short                     instr = -1;               //instrTable index, -1 if unknown
+  unsigned char             rs = 0;                   //register operands,
+  unsigned char             rt = 0;                   //99 if not a register
+  unsigned char             rd = 0;
+  char                      half = 0;                 //'u' %hi or 'l' %lo label operand, else 0
+  int                       imm = 0;                  //immediate, shift amount, offset or
+                                                      //target index
+  int                       symbol = -1;              //symbol id of label operand, -1 if none
+  int                       machine = 0;              //machine code
+ 
+  Command(int, int);                                  //constructor
+  const InstrDesc* GetDesc() const;                   //table row, NULL if unknown
+  char GetLabelRole() const;                          //role of label operand, 'u' or 'l'
+                                                      //for %hi or %lo, 0 if none
+  std::string GetRIJType();                           //determine R, I or J type instructions
+  int GetOp();                                        //returns op code value
+  static int GetReg(std::string_view);                //returns register value
+  static int FindInstr(std::string_view);             //instrTable index of mnemonic, -1 if unknown
+  int GetFunct();                                     //returns funct code value
+  void ResolveMachine();                              //assembly instruction -> machine code
+};
+
+/******************************************
+ *               Label Class              *
+ ******************************************/
+
+struct Label
+{
+  int                       lineNum;                  //asmFile line number
+  int                       symbol = -1;              //symbol id of label name, -1 if none
+  char                      type = 't';               //'t' text label, 'w' .word, 's' .space
+  int                       machine = 0;              //machine code
+ 
+  Label(int, int, char);                              //constructor
+};
+
+/******************************************
+ *            DataSegment Class           *
+ ******************************************/
+
+//run of consecutive data words of one kind
+struct DataRange
+{
+  int                       lineNum;                  //index of first word
+  int                       count;                    //number of words
+  char                      type;                     //'w' .word values, 's' .space zero fill
+  size_t                    first;                    //first value in DataSegment::words, 'w' only
+};
+
+//.data contents as typed ranges; zero fill is never materialized, so memory
+//scales with the number of directives rather than the space reserved
+struct DataSegment
+{
+  std::vector<DataRange>    ranges;                   //ranges in address order
+  std::vector<int>          words;                    //values of all 'w' ranges
+
+  void AddWord(int, int);                             //append initialized word at index
+  void AddSpace(int, int);                            //append zero filled words at index
+  long long Size() const;                             //total number of words
+};
+
+
+
+
+/******************************************
+ *            SymbolTable Class           *
+ ******************************************/
+
+struct Symbol
+{
+  std::string_view          name;                     //label name, view into source
+  bool                      defined = false;          //label seen yet
+  int                       lineNum = -1;             //index of labeled word
+  int                       srcLine = 0;              //source line of definition
+  bool                      hasValue = false;         //data label with an operand
+  int                       value = 0;                //first data operand, lw/sw offset
+  bool                      global = false;           //.globl or .extern, visible to other files
+  std::vector<int>          fixups;                   //commands referencing it before definition
+};
+
+//labels are interned once into a hash table keyed by views of the source;
+//references to defined labels are patched immediately, forward references
+//when the label is defined
+struct SymbolTable
+{
+  std::unordered_map<std::string_view, int> ids;      //label name -> symbol id
+  std::vector<Symbol>       symbols;                  //symbols by id
+  int                       errors = 0;               //bad references and operands reported
+  int                       duplicates = 0;           //duplicate labels reported
+  std::vector<std::string>  messages;                 //diagnostics, in the order found
+  bool                      deferred = false;         //only record references, word
+                                                      //indices are not final yet
+  bool                      local = false;            //one chunk's table, merged later
+  int                       srcBase = 0;              //source lines before the table's
+                                                      //text, added to reported lines
+  std::vector< std::pair<int, int> > redefinitions;   //symbol id and source line of
+                                                      //later definitions, local only
+
+  int Intern(std::string_view);                       //symbol id, created if new
+  int Define(std::string_view, int, int, const int*,
+             std::vector<Command>&);                  //define label, patch waiting fixups
+  void Reference(std::string_view, int,
+                 std::vector<Command>&);              //patch now or when defined
+  void Patch(Symbol&, Command&);                      //label operand -> resolved value
+  int ReportUnresolved(std::vector<Command>&);        //report undefined labels, return count
+  void Report(int, std::string_view,
+              std::string_view, std::string_view);    //add "Line N: ..." message
+  void SortMessages();                                //order messages by line, then text
+};
+
+
+
+
+/******************************************
+ *              Lexer Classes             *
+ ******************************************/
+
+//splits text at any delimiter character, skipping empty tokens
+struct Tokenizer
+{
+  std::string_view          rest;                     //text not yet tokenized
+  const char*               delims;                   //delimiter characters
+
+  Tokenizer(std::string_view, const char*);           //constructor
+  bool Next(std::string_view&);                       //next token, false at end
+};
+
+
+
+/******************************************
+ *               Chunk Class              *
+ ******************************************/
+
+//everything read from one stretch of source lines; the serial assembler
+//reads the whole file as one chunk, the parallel assembler splits it at
+//line boundaries and numbers words from 0 in every chunk until merged
+struct Chunk
+{
+  std::string_view          text;                     //source lines
+  unsigned long long        hash = 0;                 //hash of text and inData
+  bool                      cached = false;           //read from the cache, not text
+  bool                      inData = 0;               //reading .data section
+  int                       index = 0;                //index of next word
+  int                       srcLine = 0;              //source lines read
+  std::vector<Command>      cmdList;                  //instructions
+  std::vector<Label>        lblList;                  //labels
+  DataSegment               data;                     //.data contents
+  SymbolTable               symbols;                  //labels by name
+};
+
+
+
+
+/******************************************
+ *           ObjectBuffer Class           *
+ ******************************************/
+
+//assembler output is built whole in memory and written with one call
+struct ObjectBuffer
+{
+  std::vector<char>         bytes;                    //output image
+  bool                      little = false;           //byte order of binary fields
+
+  void Put(const char*, size_t);                      //append raw bytes
+  void Put8(unsigned int);                            //append one byte
+  void Put16(unsigned int);                           //append halfword in byte order
+  void Put32(unsigned int);                           //append word in byte order
+  void PutHex(unsigned int);                          //append 8 hex digits and newline
+  void Patch32(size_t, unsigned int);                 //overwrite word at offset
+  void Align(size_t);                                 //zero pad to a multiple
+};
+
+//relocation types; the lw/sw offset of this assembler is a label's first
+//data operand, which no standard MIPS relocation computes
+enum RelocType
+{
+  RELOC_26      = 4,                                  //R_MIPS_26, j target
+  RELOC_HI16    = 5,                                  //R_MIPS_HI16, %hi of address
+  RELOC_LO16    = 6,                                  //R_MIPS_LO16, %lo of address
+  RELOC_PC16    = 10,                                 //R_MIPS_PC16, branch offset
+  RELOC_VALUE16 = 0xf0                                //label's first data operand
+};
+
+
+
+
+/******************************************
+ *            PhaseStats Class            *
+ ******************************************/
+
+//heap calls so far; only a front end that replaces operator new counts
+//them, otherwise they stay zero
+extern std::atomic<unsigned long long> heapAllocs;
+extern std::atomic<unsigned long long> heapBytes;
+
+//totals of one phase
+struct PhaseTime
+{
+  std::string_view          name;                     //phase name
+  double                    ms = 0;                   //wall time
+  unsigned long long        allocs = 0;               //heap allocations
+  unsigned long long        bytes = 0;                //heap bytes allocated
+};
+
+//wall time and heap use of each assembler phase; a phase runs from the
+//previous End call to its own, and phases ended twice add up
+struct PhaseStats
+{
+  std::vector<PhaseTime>    phases;                   //read, parse, resolve, encode, emit, write
+  std::chrono::steady_clock::time_point mark;         //end of previous phase
+  unsigned long long        allocsMark;               //heapAllocs at mark
+  unsigned long long        bytesMark;                //heapBytes at mark
+
+  PhaseStats();                                       //first phase starts now
+  void End(std::string_view);                         //charge time since mark to phase
+  double TotalMs() const;                             //sum of every phase
+  std::string Json(std::string_view, int, int, long) const;  //one line report
+};
+
+
+
+
+/******************************************
+ *             Assembly Class             *
+ ******************************************/
+
+//a label as reported by Assemble
+struct AsmSymbol
+{
+  std::string               name;                     //label name
+  int                       index;                    //index of labeled word
+  char                      type;                     //'t' text label, 'w' .word, 's' .space
+  int                       srcLine;                  //source line of definition
+  bool                      global;                   //.globl or .extern
+  bool                      hasValue;                 //data label with an operand
+  int                       value;                    //first data operand, lw/sw offset
+};
+
+//everything Assemble produces; words are numbered as in the hex output,
+//text from index 0 and data right after it
+struct Assembly
+{
+  std::vector<unsigned int> text;                     //machine code
+  std::vector<unsigned int> data;                     //.data words, zero fill expanded
+  std::vector<int>          srcLines;                 //source line of each text word
+  std::vector<AsmSymbol>    symbols;                  //labels in definition order
+  std::vector<std::string>  diagnostics;              //"Line N: ..." messages in order found
+  bool                      ok = false;               //false if any label did not resolve
+};
+
+
+
+
+/*********************************************
+ *            Function Prototypes            *
+ ********************************************/
+
+//parse a whole token as a decimal int or a 0x hex word, false if it is
+//not one
+bool ParseInt(std::string_view, int&);
+
+//trim leading and trailing blanks
+std::string_view Trim(std::string_view);
+
+//expand a pseudo-instruction line into chunk's commands, false if the
+//line is not one; expansions never depend on label values, so their
+//length is known while reading
+bool ExpandPseudo(std::string_view, Chunk&);
+
+//decode an instruction line into cmdList[command]
+void ParseCommand(std::string_view, int, std::vector<Command>&, SymbolTable&);
+
+//resolve label operand of cmdList[command], now or once defined
+void ResolveLabels(int, std::string_view, std::vector<Command>&, SymbolTable&);
+
+//read one trimmed, non-blank source line into chunk
+void ReadLine(std::string_view, Chunk&);
+
+//read every line of chunk.text
+void ReadChunk(Chunk&);
+
+//assemble source on one thread, labels backpatched as they are read
+void AssembleSerial(std::string_view, Chunk&, PhaseStats*);
+
+//offset of the first ".data" line, size of source if none
+size_t FindDataStart(std::string_view);
+
+//cut source into chunks at line starts, one per thread
+void SplitChunks(std::string_view, int, std::vector<Chunk>&);
+
+//read every chunk not already cached, threads at a time
+void ReadChunks(std::vector<Chunk>&, int);
+
+//number chunks, merge their symbol tables and finish encoding
+void MergeChunks(std::vector<Chunk>&, int, Chunk&, PhaseStats*);
+
+//assemble source split across threads, merged into program
+void AssembleParallel(std::string_view, int, Chunk&, PhaseStats*);
+
+//64-bit hash of text, eight bytes at a time
+unsigned long long HashBytes(std::string_view, unsigned long long);
+
+//cut source into chunks at line starts chosen by content, so an edit
+//moves no cut outside the chunks it touches
+void SplitBlocks(std::string_view, std::vector<Chunk>&);
+
+//text words then data words, zero fill expanded
+std::vector<unsigned int> ImageWords(const Chunk&);
+
+//blank line, then one hex word per line
+void EmitHex(const std::vector<unsigned int>&, ObjectBuffer&);
+
+//words back to back in the buffer's byte order
+void EmitRaw(const std::vector<unsigned int>&, ObjectBuffer&);
+
+//ELF32 MIPS relocatable with .text, .data, a symbol per label and a
+//relocation per label field that depends on where the linker puts it
+void EmitElf(const Chunk&, std::vector<unsigned int>&, ObjectBuffer&);
+
+//assemble source held in memory; no file or stream I/O, so harnesses can
+//assemble many snippets in one process
+Assembly Assemble(std::string_view);
+
+//debug listings
+std::ostream& operator << (std::ostream&, const Command&);
+std::ostream& operator << (std::ostream&, const DataRange&);
+std::ostream& operator << (std::ostream&, const Label&);
+
+//run work(0) .. work(count - 1) on up to threads threads
+template <typename Work>
+void RunWorkers(size_t count, int threads, Work work)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&]()
+  {
+    for (size_t i = next++; i < count; i = next++)
+      work(i);
+  };
+  if (threads <= 1 || count <= 1)
+  {
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads && t < (int)count; ++t)
+    workers.emplace_back(worker);
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  return;
+}
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * @file   batch.cpp
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Batch runs of one program over many inputs
+ *
+ * @description
+ * Input parsing and the work-stealing runner behind
+ * batch.h.
+ *****************************************************/
+
+#ifndef batch_CPP
+#define batch_CPP
+
+#include "batch.h"
+#include "assembler.h"
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/*********************************************
+ *              Helper Functions             *
+ *********************************************/
+
+//run one instance on a worker's machine, reusing its streams
+static void RunOne(Machine& machine, const Machine& image, std::istringstream& in,
+                   std::ostringstream& out, BatchRun& run)
+{
+  std::string text;
+  for (size_t k = 0; k < run.inputs.size(); ++k)
+  {
+    text += std::to_string(run.inputs[k]);
+    text += ' ';
+  }
+  in.clear();
+  in.str(text);
+  out.str(std::string());
+
+  machine.Restore(image);
+  run.stop = machine.Run(in, out);
+  run.output = out.str();
+  run.fault = machine.fault;
+  run.pc = machine.pc;
+  run.executed = machine.executed;
+  return;
+}
+
+
+
+
+/*********************************************
+ *             Function Definitions          *
+ *********************************************/
+
+bool ReadInputs(std::string_view text, std::vector<BatchRun>& runs, int& badLine)
+{
+  int line = 0;
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view rest = text.substr(0, end);
+    text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+    ++line;
+
+    BatchRun run;
+    for (;;)
+    {
+      size_t start = rest.find_first_not_of(" \t\r");
+      if (start == std::string_view::npos)
+        break;
+      rest = rest.substr(start);
+      std::string_view token = rest.substr(0, rest.find_first_of(" \t\r"));
+      rest = rest.substr(token.size());
+
+      int value;
+      if (!ParseInt(token, value))
+      {
+        badLine = line;
+        return false;
+      }
+      run.inputs.push_back(value);
+    }
+    runs.push_back(run);
+  }
+  return true;
+}
+
+
+
+void RunBatch(const Machine& image, std::vector<BatchRun>& runs, int threads)
+{
+  size_t count = runs.size();
+  if (threads < 1 || count == 0)
+    threads = 1;
+  else if ((size_t)threads > count)
+    threads = (int)count;
+
+  std::vector<BatchShare> shares(threads);
+  for (int t = 0; t < threads; ++t)
+  {
+    shares[t].next = count * t / threads;
+    shares[t].end = count * (t + 1) / threads;
+  }
+
+  //the copy of the machine is made once per worker; its own share
+  //first, then the others' from the next one on
+  auto worker = [&](int self)
+  {
+    Machine machine = image;
+    std::istringstream in;
+    std::ostringstream out;
+    for (int k = 0; k < threads; ++k)
+    {
+      BatchShare& share = shares[(self + k) % threads];
+      for (size_t i = share.next++; i < share.end; i = share.next++)
+        RunOne(machine, image, in, out, runs[i]);
+    }
+  };
+  if (threads == 1)
+  {
+    worker(0);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+    workers.emplace_back(worker, t);
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  return;
+}
+
+#endif
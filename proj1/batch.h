@@ -0,0 +1,71 @@
+/**
+ * @file   batch.h
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Batch runs of one program over many inputs
+ *
+ * @description
+ * One loaded and decoded Machine is run once per input
+ * set, on several threads. Each worker keeps its own copy
+ * of the machine and, between runs, copies back from the
+ * loaded one only the pages the last run stored into.
+ *****************************************************/
+
+#ifndef batch_H
+#define batch_H
+
+#include "simulator.h"
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/******************************************
+ *             BatchRun Class             *
+ ******************************************/
+
+//one instance: the values syscall 5 reads, in order, then 0 once they
+//run out, and what running on them did
+struct BatchRun
+{
+  std::vector<int>          inputs;                   //values to read
+  std::string               output;                   //what syscall 1 printed
+  StopReason                stop = STOP_END;          //why the run ended
+  std::string               fault;                    //reason of STOP_FAULT
+  unsigned int              pc = 0;                   //word index where it stopped
+  unsigned long long        executed = 0;             //instructions run
+};
+
+
+
+
+/******************************************
+ *            BatchShare Class            *
+ ******************************************/
+
+//a worker's contiguous share of the runs; its owner takes runs from the
+//front, and a worker done with its own share takes from the others' the
+//same way, so shares are on separate cache lines
+struct alignas(64) BatchShare
+{
+  std::atomic<size_t>       next{0};                  //next run to take, may pass end
+  size_t                    end = 0;                  //one past the share's last run
+};
+
+
+
+
+/*********************************************
+ *            Function Prototypes            *
+ ********************************************/
+
+//one run per line of text, holding whitespace separated ints; false
+//with the 1 based line of the first bad value
+bool ReadInputs(std::string_view, std::vector<BatchRun>&, int&);
+
+//run every instance from image's loaded state on up to threads threads;
+//image itself is left untouched
+void RunBatch(const Machine&, std::vector<BatchRun>&, int);
+
+#endif
@@ -0,0 +1,87 @@
+#!/bin/sh
+#throughput benchmark for the assembler
+#generates reproducible sources and their expected hex once, then
+#assembles each on one thread and on BENCH_THREADS threads, checks the
+#output against the expected hex and reports lines/s, time per phase
+#and peak RSS from --stats; then checks both report a source's errors
+#the same way
+#
+#environment: BENCH_LINES    text lines per source    (default 200000)
+#             BENCH_THREADS  threads of parallel run  (default 4)
+#             BENCH_ASM      assembler binary         (default bench/main)
+
+cd "$(dirname "$0")" || exit 1
+LINES=${BENCH_LINES:-200000}
+THREADS=${BENCH_THREADS:-4}
+ASM=${BENCH_ASM:-./main}
+SOURCES=sources/$LINES
+OUT=$SOURCES/out.hex
+
+mkdir -p "$SOURCES"
+gen()
+{
+  name=$1
+  shift
+  if [ ! -f "$SOURCES/$name.s" ]; then
+    ../asmgen "$LINES" "$@" seed=42 out="$SOURCES/$name.s" golden="$SOURCES/$name.hex" || exit 1
+  fi
+}
+
+#generator arguments follow the name, line count and seed are added by gen
+gen plain
+gen labels   labels=0.5
+gen sparse   labels=0.001
+gen words    words=$((LINES * 2))
+gen space    spaces=256 space=65536
+
+#value of a numeric field in the --stats line, "field" or "phase.field"
+field()
+{
+  case $2 in
+    *.*) echo "$1" | sed "s/.*\"${2%%.*}\":{\"${2#*.}\":\([0-9.]*\).*/\1/" ;;
+    *)   echo "$1" | sed "s/.*\"$2\":\([0-9.]*\).*/\1/" ;;
+  esac
+}
+
+failed=0
+printf "%-8s %3s %12s %8s %8s %8s %8s %8s %8s %10s %6s\n" source j lines/s read_ms parse_ms \
+       resolve_ms encode_ms emit_ms write_ms rss_kb golden
+for source in "$SOURCES"/*.s; do
+  name=$(basename "$source" .s)
+  for j in 1 "$THREADS"; do
+    stats=$("$ASM" -j "$j" --stats --out="$OUT" "$source" 2>&1 | grep '^{')
+    if cmp -s "$OUT" "$SOURCES/$name.hex"; then
+      check=ok
+    else
+      check=FAIL
+      failed=1
+    fi
+    printf "%-8s %3s %12s %8s %8s %8s %8s %8s %8s %10s %6s\n" "$name" "$j" \
+           "$(field "$stats" lines_per_s)" "$(field "$stats" read.ms)" \
+           "$(field "$stats" parse.ms)" "$(field "$stats" resolve.ms)" \
+           "$(field "$stats" encode.ms)" "$(field "$stats" emit.ms)" \
+           "$(field "$stats" write.ms)" "$(field "$stats" peak_rss_kb)" "$check"
+  done
+done
+
+#labels.s with a duplicate label, an undefined label and a bad immediate
+#every quarter of its text, not named .s so the loop above skips it
+ERRORS=$SOURCES/errors.src
+if [ ! -f "$ERRORS" ]; then
+  awk -v every=$((LINES / 4 + 1)) '
+    /^[ \t]*\.data/ { data = 1 }
+    { print }
+    !data && NR % every == 0 { print "L0: nop"; print "\tj undefined" NR; print "\taddiu $t0, $zero, bad" NR }
+  ' "$SOURCES/labels.s" > "$ERRORS"
+fi
+"$ASM" -j 1 --out="$OUT" "$ERRORS" 2> "$SOURCES/errors.1"
+"$ASM" -j "$THREADS" --out="$OUT" "$ERRORS" 2> "$SOURCES/errors.$THREADS"
+if cmp -s "$SOURCES/errors.1" "$SOURCES/errors.$THREADS" && [ -s "$SOURCES/errors.1" ]; then
+  check=ok
+else
+  check=FAIL
+  failed=1
+fi
+printf "%-8s %3s %s\n" errors "$THREADS" "$(grep -c '^Line' "$SOURCES/errors.1") messages match j 1: $check"
+rm -f "$OUT" "$SOURCES/errors.1" "$SOURCES/errors.$THREADS"
+exit $failed
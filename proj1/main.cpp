@@ -12,414 +12,573 @@
 #ifndef main_CPP
 #define main_CPP
 
+#include "assembler.h"
+#include "simulator.h"
+#include "native.h"
+#include "optimizer.h"
+#include "batch.h"
 #include <iostream>
-#include <iomanip>
-#include <fstream>
 #include <string>
-#include <list>
-#include <boost/tokenizer.hpp>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cctype>
 
 
-/********************************************
- *               Command Class              *
- ********************************************/
+/******************************************
+ *            SourceFile Class            *
+ ******************************************/
 
-struct Command
-{
-  int                       lineNum;                  //asmFile line number
-  std::vector<std::string>  tokens_vec;               //vector to store tokens
-  std::string               type = "empty";           //instruction type
-  int                       machine = 0;              //machine code
- 
-  Command(std::string, int);                          //constructor
-  bool IsLabel();                                     //return true iff label
-  std::string GetRIJType();                           //determine R, I or J type instructions
-  int GetOp();                                        //returns op code value
-  int GetReg(std::string);                            //returns register value
-  int GetFunct();                                     //returns funct code value
-  void ResolveMachine();                              //assembly instruction -> machine code
+//source text mapped read-only into memory, tokens are views into it
+struct SourceFile
+{
+  const char*               data = NULL;              //first byte of source
+  size_t                    size = 0;                 //bytes of source
+  void*                     mapping = NULL;           //mmap'd region, NULL if read into text
+  std::string               text;                     //fallback for unmappable input
+
+  SourceFile() = default;
+  SourceFile(const SourceFile&) = delete;
+  SourceFile& operator=(const SourceFile&) = delete;
+  ~SourceFile();                                      //unmaps source
+  bool Open(const char*);                             //map or read file, false on error
+  void Close();                                       //unmap or free source
+  std::string_view View() const;                      //whole source
 };
 
+
+
+
 /******************************************
- *               Label Class              *
+ *          AssemblyCache Class           *
  ******************************************/
 
-struct Label
+//chunks read on earlier runs, keyed by a hash of their text; after an
+//edit only chunks whose text changed are read again, the rest are copied
+//out of the cache and renumbered by the merge like any other chunk
+struct AssemblyCache
 {
-  int                       lineNum;                  //asmFile line number
-  std::vector<std::string>  tokens_vec;               //vector to store tokens
-  std::string               type = "empty";           //instruction type
-  int                       machine = 0;              //machine code
- 
-  Label(std::string, int);                            //constructor
+  std::string               path;                     //cache file, empty to keep in memory
+  SourceFile                file;                     //mapped cache file
+  std::vector<char>         memory;                   //records when there is no file
+  std::string_view          bytes;                    //all records; cached label names view into it
+  std::unordered_map<unsigned long long, std::string_view> records;  //chunk hash -> record
+  std::vector<char>         added;                    //records of chunks read on the last run
+  std::vector<unsigned long long> kept;               //hashes of records used on the last run
+  int                       reused = 0;               //chunks copied on the last run
+  int                       read = 0;                 //chunks read on the last run
+
+  bool Load();                                        //map cache file, false if unusable
+  void Index();                                       //find records in bytes
+  bool Find(Chunk&) const;                            //fill chunk from its record, false if absent
+  void Store(const std::vector<Chunk>&);              //records for chunks read, into added
+  bool Save();                                        //append added, or rewrite kept records
 };
 
 
 
 
-/***********************************************
- *               Command Methods               *
- ***********************************************/
+/******************************************
+ *            ObjectFile Class            *
+ ******************************************/
 
-Command::Command(std::string command, int lineNum) : lineNum(lineNum)
+//an ELF32 MIPS relocatable, read back for linking
+struct ObjectFile
 {
-  //creates tokens from assembly instruction, stores in vector
-  boost::char_separator<char> delimeter(", ()");
-  boost::tokenizer< boost::char_separator< char > > tokens(command,delimeter);
-  for(boost::tokenizer< boost::char_separator<char> >::iterator it = tokens.begin();
-      it != tokens.end(); it++)
+  std::string               path;                     //file name for messages
+  std::vector<char>         bytes;                    //whole file
+  bool                      little = false;           //byte order
+  int                       textIndex = 0;            //section numbers, 0 if absent
+  int                       dataIndex = 0;
+  size_t                    textOffset = 0;           //section contents
+  size_t                    textSize = 0;
+  size_t                    dataOffset = 0;
+  size_t                    dataSize = 0;
+  size_t                    relOffset = 0;
+  size_t                    relCount = 0;
+  size_t                    symOffset = 0;
+  size_t                    symCount = 0;
+  size_t                    strOffset = 0;
+  size_t                    strSize = 0;
+
+  bool Load(const char*);                             //read file, false on error
+  bool Parse();                                       //find sections, false if malformed
+  unsigned int Read16(size_t) const;                  //halfword in file byte order
+  unsigned int Read32(size_t) const;                  //word in file byte order
+  std::string_view String(unsigned int) const;        //name from .strtab
+};
+
+
+
+/*********************************************
+ *            Function Prototypes            *
+ ********************************************/
+
+//assemble source reusing unchanged chunks, records of the rest are
+//stored in the cache for its next Save
+void AssembleIncremental(std::string_view, int, AssemblyCache&, Chunk&, PhaseStats*);
+
+//assemble one source file into an ELF relocatable, false on error
+bool AssembleObject(const char*, int, ObjectBuffer&);
+
+//assemble sources and read objects, one file per worker thread
+bool AssembleFiles(const std::vector<const char*>&, int, bool, std::vector<ObjectFile>&);
+
+//lay out every .text then every .data and resolve relocations
+bool Link(std::vector<ObjectFile>&, std::vector<unsigned int>&);
+
+//write buffer to file, stdout if NULL; false on error
+bool WriteOutput(const char*, const ObjectBuffer&);
+
+//write all of bytes to file descriptor, false on error
+bool WriteBytes(int, const std::vector<char>&);
+
+//print diagnostics to stderr in one write
+void ShowMessages(const std::vector<std::string>&);
+
+//rewrite only the pages of file that differ from buffer; false on error
+bool UpdateOutput(const char*, const ObjectBuffer&, size_t&);
+
+//run assembled program with stdin and stdout as its console, interpreted
+//or with hot blocks translated to native code; returns exit status
+int RunProgram(const Chunk&, const std::vector<unsigned int>&, bool);
+
+//run assembled program once per line of an inputs file on up to threads
+//threads, one result line each on stdout; returns exit status
+int RunBatchFile(const Chunk&, const std::vector<unsigned int>&, const char*, int);
+
+//assemble one source file to outPath, returns exit status; with stats,
+//a JSON line of phase times and heap use goes to stderr; with run set to
+//"interp" or "jit", or with a batch inputs file, the program is executed
+//and only written if outPath is set; with optimize, the -O pass runs
+//before encoding
+int AssembleProgram(const char*, int, std::string_view, const char*, bool, AssemblyCache*, bool,
+                    std::string_view, bool, const char*);
+
+
+
+
+/*********************************************
+ *             SourceFile Methods            *
+ *********************************************/
+
+SourceFile::~SourceFile()
+{
+  Close();
+}
+
+
+
+void SourceFile::Close()
+{
+  if (mapping != NULL)
+    munmap(mapping, size);
+  mapping = NULL;
+  data = NULL;
+  size = 0;
+  std::string().swap(text);
+  return;
+}
+
+
+
+bool SourceFile::Open(const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
   {
-    tokens_vec.push_back(*it);
+    void* region = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (region != MAP_FAILED)
+    {
+      //lines are read front to back exactly once
+      madvise(region, info.st_size, MADV_SEQUENTIAL);
+      mapping = region;
+      data = (const char*)region;
+      size = info.st_size;
+      close(fd);
+      return true;
+    }
   }
+
+  //empty files, pipes and other unmappable input are read whole
+  char buffer[1 << 16];
+  ssize_t got;
+  while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+    text.append(buffer, got);
+  close(fd);
+  if (got < 0)
+    return false;
+  data = text.data();
+  size = text.size();
+  return true;
+}
+
+
+
+std::string_view SourceFile::View() const
+{
+  return std::string_view(data, size);
 }
 
 
 
-bool Command::IsLabel()
+/*********************************************
+ *             ObjectFile Methods            *
+ *********************************************/
+
+bool ObjectFile::Load(const char* name)
 {
-  //only labels contain ':'
-  size_t result = tokens_vec[0].find(':');
-  if (result == std::string::npos)
+  path = name;
+  SourceFile file;
+  if (!file.Open(name))
     return false;
+  bytes.assign(file.data, file.data + file.size);
   return true;
 }
 
 
 
-std::string Command::GetRIJType()
+bool ObjectFile::Parse()
 {
-  std::string result = "0";
+  static const char ident[] = { 0x7f, 'E', 'L', 'F', 1 };
+  if (bytes.size() < 52 || std::memcmp(&bytes[0], ident, sizeof(ident)) != 0)
+    return false;
+  little = bytes[5] == 1;
+  if (Read16(16) != 1 || Read16(18) != 8 || Read16(46) != 40)
+    return false;
 
-  //search for R type instruction
-  if(tokens_vec[0] == "addu")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "and")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "div")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "mfhi")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "mflo")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "mult")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "or")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "slt")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "subu")
-  {
-    result = "r";
-  }
-  else if(tokens_vec[0] == "syscall")
-  {
-    result = "r";
-  } 
-  //search for I type instruction
-  else if(tokens_vec[0] == "addiu")
-  {
-    result = "i";
-  }
-  else if(tokens_vec[0] == "beq")
-  {
-    result = "i";
-  }
-  else if(tokens_vec[0] == "bne")
-  {
-    result = "i";
-  }
-  else if(tokens_vec[0] == "lw")
-  {
-    result = "i";
-  }
-  else if(tokens_vec[0] == "sw")
-  {
-    result = "i";
-  }
-  //search for J type instruction
-  else if(tokens_vec[0] == "j")
+  size_t shoff = Read32(32);
+  size_t shnum = Read16(48);
+  size_t shstrndx = Read16(50);
+  if (shoff + 40 * shnum > bytes.size() || shstrndx >= shnum)
+    return false;
+  size_t names = Read32(shoff + 40 * shstrndx + 16);
+
+  for (size_t i = 1; i < shnum; ++i)
   {
-    result = "j";
+    size_t header = shoff + 40 * i;
+    size_t offset = Read32(header + 16);
+    size_t size = Read32(header + 20);
+    if (offset + size > bytes.size() || names + Read32(header) >= bytes.size())
+      return false;
+    std::string_view name(&bytes[names + Read32(header)]);
+    unsigned int type = Read32(header + 4);
+    if (name == ".text")
+    {
+      textIndex = i;
+      textOffset = offset;
+      textSize = size;
+    }
+    else if (name == ".data")
+    {
+      dataIndex = i;
+      dataOffset = offset;
+      dataSize = size;
+    }
+    else if (type == 9)
+    {
+      relOffset = offset;
+      relCount = size / 8;
+    }
+    else if (type == 2)
+    {
+      symOffset = offset;
+      symCount = size / 16;
+      size_t strHeader = shoff + 40 * Read32(header + 24);
+      if (strHeader + 40 > bytes.size())
+        return false;
+      strOffset = Read32(strHeader + 16);
+      strSize = Read32(strHeader + 20);
+    }
   }
-  
-  return result;
+  return textSize % 4 == 0 && dataSize % 4 == 0 && strOffset + strSize <= bytes.size();
 }
 
 
 
-int Command::GetOp()
+unsigned int ObjectFile::Read16(size_t offset) const
 {
-  if(tokens_vec[0] == "addiu")
-    return 9;
-  else if(tokens_vec[0] == "beq")
-    return 4;
-  else if(tokens_vec[0] == "bne")
-    return 5;
-  else if(tokens_vec[0] == "j")
-    return 2;
-  else if(tokens_vec[0] == "lw")
-    return 35;
-  else if(tokens_vec[0] == "sw")
-    return 43;
-  else
-    return 0;
+  unsigned int first = (unsigned char)bytes[offset];
+  unsigned int second = (unsigned char)bytes[offset + 1];
+  return little ? first | second << 8 : first << 8 | second;
 }
 
 
 
-int Command::GetReg(std::string reg)
+unsigned int ObjectFile::Read32(size_t offset) const
 {
-  if(reg == "$zero" || reg == "$0")
-    return 0;
-  else if (reg == "$at")
-    return 1;
-  else if (reg == "$v0")
-    return 2;
-  else if (reg == "$v1")
-    return 3;
-  else if (reg == "$a0")
-    return 4;
-  else if (reg == "$a1")
-    return 5;
-  else if (reg == "$a2")
-    return 6;
-  else if (reg == "$a3")
-    return 7;
-  else if (reg == "$t0")
-    return 8;
-  else if (reg == "$t1")
-    return 9;
-  else if (reg == "$t2")
-    return 10;
-  else if (reg == "$t3")
-    return 11;
-  else if (reg == "$t4")
-    return 12;
-  else if (reg == "$t5")
-    return 13;
-  else if (reg == "$t6")
-    return 14;
-  else if (reg == "$t7")
-    return 15;
-  else if (reg == "$s0")
-    return 16;
-  else if (reg == "$s1")
-    return 17;
-  else if (reg == "$s2")
-    return 18;
-  else if (reg == "$s3")
-    return 19;
-  else if (reg == "$s4")
-    return 20;
-  else if (reg == "$s5")
-    return 21;
-  else if (reg == "$s6")
-    return 22;
-  else if (reg == "$s7")
-    return 23;
-  else if (reg == "$t8")
-    return 24;
-  else if (reg == "$t9")
-    return 25;
-  else if (reg == "$k0")
-    return 26;
-  else if (reg == "$k1")
-    return 27;
-  else if (reg == "$gp")
-    return 28;
-  else if (reg == "$sp")
-    return 29;
-  else if (reg == "$fp")
-    return 30;
-  else if (reg == "$ra")
-    return 31;
-  
-  //argument not a register
-  else
-    return 99;
-}
-
-
-
-int Command::GetFunct()
-{ 
-  if(tokens_vec[0] == "addu")
-    return 33;
-  else if(tokens_vec[0] == "and")
-    return 36;
-  else if(tokens_vec[0] == "div")
-    return 26;
-  else if(tokens_vec[0] == "mfhi")
-    return 16;
-  else if(tokens_vec[0] == "mflo")
-    return 18;
-  else if(tokens_vec[0] == "mult")
-    return 24;
-  else if(tokens_vec[0] == "or")
-    return 37;
-  else if(tokens_vec[0] == "slt")
-    return 42;
-  else if(tokens_vec[0] == "subu")
-    return 35;
-  else if(tokens_vec[0] == "syscall")
-    return 12;
-  else
-    return 0;
+  unsigned int first = Read16(offset);
+  unsigned int second = Read16(offset + 2);
+  return little ? first | second << 16 : first << 16 | second;
 }
 
-void Command::ResolveMachine()
+
+
+std::string_view ObjectFile::String(unsigned int offset) const
 {
-  //J type instructions, label and address
-  if (tokens_vec[0] == "j")
-  {
-    int op = GetOp();
-    op = op << 26;
-    int targetLocation = stoi(tokens_vec[1]);
-    machine = op + targetLocation;
-    return;
-    }
+  if (offset >= strSize)
+    return std::string_view();
+  const char* name = &bytes[strOffset + offset];
+  return std::string_view(name, strnlen(name, strSize - offset));
+}
 
-  //I type arithmetic instruction, two registers and immediate
-  if (tokens_vec[0] == "addiu")
-  {
-    int op = GetOp();
-    op = op << 26;
-    int rs = GetReg(tokens_vec[2]);
-    rs = rs << 21;
-    int rt = GetReg(tokens_vec[1]);
-    rt = rt << 16;
-    int immediate;
-    immediate = stoi(tokens_vec[3]);
-    machine = op + rs + rt + immediate;
-    return;
-  }
 
-  
-  //I type branch instruction, two registers and loocation
-  //16 bit unsigned int for immediate used to get unsigned value of 2's
-  //compliment offset
-  if (tokens_vec[0] == "beq" || tokens_vec[0] == "bne")
-  {
-    int op = GetOp();
-    op = op << 26;
-    int rs = GetReg(tokens_vec[1]);
-    rs = rs << 21;
-    int rt = GetReg(tokens_vec[2]);
-    rt = rt << 16;
-    int targetLocation = stoi(tokens_vec[3]);
-    int programCounter = lineNum + 1;
-    short unsigned int immediate = targetLocation - programCounter;
-    machine = op + rs + rt + immediate;
-    return;
-    }
 
-  //I type memory instruction, two registers and offset
-  if (tokens_vec[0] == "lw" || tokens_vec[0] == "sw")
-  {
-    int op = GetOp();
-    op = op << 26;
-    int rs = GetReg(tokens_vec[3]);
-    rs = rs << 21;
-    int rt = GetReg(tokens_vec[1]);
-    rt = rt << 16;
-    int immediate;
-    immediate = stoi(tokens_vec[2]);
-    machine = op + rs + rt + immediate;
-    return;
-  }
-  
-  //R type instruction w/3 operands
-  else if (tokens_vec[0] == "addu" || tokens_vec[0] == "and" || tokens_vec[0] == "or" ||
-           tokens_vec[0] == "slt" || tokens_vec[0] == "subu")
-  {   
-    int op = GetOp();
-    op = op << 26;
-    int rs = GetReg(tokens_vec[2]);
-    rs = rs << 21;
-    int rt = GetReg(tokens_vec[3]);
-    rt = rt << 16;
-    int rd = GetReg(tokens_vec[1]);
-    rd = rd << 11;
-    int funct = GetFunct();
-    machine = op + rs + rt + rd + funct;
-    return;
-  }
+/*********************************************
+ *           AssemblyCache Methods           *
+ *********************************************/
+
+//cache layout, native byte order; a different version or record layout
+//makes the whole cache unusable and it is rebuilt
+static const char cacheMagic[8] = { 'M', 'I', 'P', 'S', 'A', 'S', 'M', 'C' };
+static const unsigned int cacheLayout[4] = { 3, sizeof(Command), sizeof(Label), sizeof(DataRange) };
+static const size_t cacheHeader = sizeof(cacheMagic) + sizeof(cacheLayout);
+
+bool AssemblyCache::Load()
+{
+  file.Close();
+  bytes = std::string_view();
+  if (!path.empty() && file.Open(path.c_str()))
+    bytes = file.View();
+  else if (path.empty())
+    bytes = std::string_view(memory.data(), memory.size());
+  Index();
+  return !records.empty();
+}
 
-  //R type instruction w/2 operands
-  else if (tokens_vec[0] == "div" || tokens_vec[0] == "mult")
+
+
+void AssemblyCache::Index()
+{
+  records.clear();
+  if (bytes.size() < cacheHeader || std::memcmp(bytes.data(), cacheMagic, sizeof(cacheMagic)) != 0
+      || std::memcmp(bytes.data() + sizeof(cacheMagic), cacheLayout, sizeof(cacheLayout)) != 0)
   {
-    int op = GetOp();
-    op = op << 26;
-    int rs = GetReg(tokens_vec[1]);
-    rs = rs << 21;
-    int rt = GetReg(tokens_vec[2]);
-    rt = rt << 16;
-    int funct = GetFunct();
-    machine = op + rs + rt + funct;
+    bytes = std::string_view();
     return;
   }
 
-  //R type instruction w/1 operand
-  else if (tokens_vec[0] == "mfhi" || tokens_vec[0] == "mflo")
+  //each record is its length then its chunk's hash; a record cut short by
+  //a killed run ends the cache
+  size_t at = cacheHeader;
+  while (bytes.size() - at >= sizeof(unsigned int) + sizeof(unsigned long long))
   {
-    int op = GetOp();
-    op = op << 26;
-    int rd = GetReg(tokens_vec[1]);
-    rd = rd << 11;
-    int funct = GetFunct();
-    machine = op + rd + funct;
-    return;
+    unsigned int length;
+    unsigned long long hash;
+    std::memcpy(&length, bytes.data() + at, sizeof(length));
+    std::memcpy(&hash, bytes.data() + at + sizeof(length), sizeof(hash));
+    if (length < sizeof(hash) || length > bytes.size() - at - sizeof(length))
+      break;
+    records.emplace(hash, bytes.substr(at, sizeof(length) + length));
+    at += sizeof(length) + length;
   }
+  return;
+}
+
 
-  //R type instruction w/0 operands
-  else if (tokens_vec[0] == "syscall")
+
+bool AssemblyCache::Find(Chunk& chunk) const
+{
+  std::unordered_map<unsigned long long, std::string_view>::const_iterator found =
+    records.find(chunk.hash);
+  if (found == records.end())
+    return false;
+
+  //records are read with bounds checks, a damaged one is only a miss
+  std::string_view record = found->second;
+  size_t at = sizeof(unsigned int) + sizeof(chunk.hash) + 1;
+  bool valid = at <= record.size();
+  auto take = [&](void* value, size_t count)
   {
-    int op = GetOp();
-    op = op << 26;
-    int funct = GetFunct();
-    machine = op + funct;
-    return;
+    valid = valid && count <= record.size() - at;
+    if (valid && count > 0)
+      std::memcpy(value, record.data() + at, count);
+    at += valid ? count : 0;
+  };
+  auto takeCount = [&](size_t size) -> unsigned int
+  {
+    unsigned int count = 0;
+    take(&count, sizeof(count));
+    valid = valid && (unsigned long long)count * size <= record.size() - at;
+    return valid ? count : 0;
+  };
+
+  take(&chunk.index, sizeof(chunk.index));
+  take(&chunk.srcLine, sizeof(chunk.srcLine));
+  unsigned int count = takeCount(sizeof(Command));
+  chunk.cmdList.assign(count, Command(0, 0));
+  take(chunk.cmdList.data(), count * sizeof(Command));
+  count = takeCount(sizeof(Label));
+  chunk.lblList.assign(count, Label(0, -1, 't'));
+  take(chunk.lblList.data(), count * sizeof(Label));
+  count = takeCount(sizeof(DataRange));
+  chunk.data.ranges.resize(count);
+  take(chunk.data.ranges.data(), count * sizeof(DataRange));
+  count = takeCount(sizeof(int));
+  chunk.data.words.resize(count);
+  take(chunk.data.words.data(), count * sizeof(int));
+
+  count = takeCount(1);
+  chunk.symbols.symbols.resize(count);
+  for (unsigned int i = 0; valid && i < count; ++i)
+  {
+    Symbol& symbol = chunk.symbols.symbols[i];
+    unsigned int length = takeCount(1);
+    symbol.name = record.substr(valid ? at : 0, length);
+    at += length;
+    unsigned char flags = 0;
+    take(&flags, 1);
+    take(&symbol.lineNum, sizeof(symbol.lineNum));
+    take(&symbol.srcLine, sizeof(symbol.srcLine));
+    take(&symbol.value, sizeof(symbol.value));
+    symbol.defined = flags & 1;
+    symbol.hasValue = flags & 2;
+    symbol.global = flags & 4;
   }
-  
-  else
+
+  if (!valid)
   {
-    return;
+    Chunk empty;
+    empty.text = chunk.text;
+    empty.hash = chunk.hash;
+    empty.inData = chunk.inData;
+    chunk = std::move(empty);
+    return false;
   }
+  chunk.symbols.deferred = true;
+  chunk.cached = true;
+  return true;
 }
 
 
 
-/*********************************************
- *               Label Methods               *
- *********************************************/
+void AssemblyCache::Store(const std::vector<Chunk>& chunks)
+{
+  auto put = [&](const void* value, size_t count)
+  {
+    const char* first = (const char*)value;
+    added.insert(added.end(), first, first + count);
+  };
+  auto putCount = [&](size_t count)
+  {
+    unsigned int value = count;
+    put(&value, sizeof(value));
+  };
+
+  //chunks that printed warnings or errors are read again next time so
+  //they repeat
+  added.clear();
+  kept.clear();
+  std::unordered_map<unsigned long long, bool> stored;
+  for (size_t c = 0; c < chunks.size(); ++c)
+  {
+    const Chunk& chunk = chunks[c];
+    if (chunk.symbols.duplicates > 0 || chunk.symbols.errors > 0 ||
+        !stored.emplace(chunk.hash, true).second)
+      continue;
+    if (chunk.cached)
+    {
+      kept.push_back(chunk.hash);
+      continue;
+    }
+
+    size_t start = added.size();
+    unsigned char inData = chunk.inData;
+    putCount(0);
+    put(&chunk.hash, sizeof(chunk.hash));
+    put(&inData, 1);
+    put(&chunk.index, sizeof(chunk.index));
+    put(&chunk.srcLine, sizeof(chunk.srcLine));
+    putCount(chunk.cmdList.size());
+    put(chunk.cmdList.data(), chunk.cmdList.size() * sizeof(Command));
+    putCount(chunk.lblList.size());
+    put(chunk.lblList.data(), chunk.lblList.size() * sizeof(Label));
+    putCount(chunk.data.ranges.size());
+    put(chunk.data.ranges.data(), chunk.data.ranges.size() * sizeof(DataRange));
+    putCount(chunk.data.words.size());
+    put(chunk.data.words.data(), chunk.data.words.size() * sizeof(int));
+
+    const std::vector<Symbol>& symbols = chunk.symbols.symbols;
+    putCount(symbols.size());
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+      unsigned char flags = symbols[i].defined | symbols[i].hasValue << 1 | symbols[i].global << 2;
+      putCount(symbols[i].name.size());
+      put(symbols[i].name.data(), symbols[i].name.size());
+      put(&flags, 1);
+      put(&symbols[i].lineNum, sizeof(symbols[i].lineNum));
+      put(&symbols[i].srcLine, sizeof(symbols[i].srcLine));
+      put(&symbols[i].value, sizeof(symbols[i].value));
+    }
+
+    unsigned int length = added.size() - start - sizeof(length);
+    std::memcpy(&added[start], &length, sizeof(length));
+  }
+  return;
+}
 
-Label::Label(std::string command, int lineNum) : lineNum(lineNum)
+
+
+bool AssemblyCache::Save()
 {
-  //creates tokens from assembly instruction, stores in vector
-  boost::char_separator<char> delimeter(", ():");
-  boost::tokenizer< boost::char_separator< char > > tokens(command,delimeter);
-  for(boost::tokenizer< boost::char_separator<char> >::iterator it = tokens.begin();
-      it != tokens.end(); it++)
+  //bytes of records still in use
+  size_t live = 0;
+  for (size_t i = 0; i < kept.size(); ++i)
+    live += records[kept[i]].size();
+
+  //new records are appended until stale ones outweigh live ones, then
+  //the live records are copied into a fresh cache
+  bool ok = true;
+  if (!bytes.empty() && bytes.size() - cacheHeader <= 2 * (live + added.size()))
+  {
+    if (path.empty())
+      memory.insert(memory.end(), added.begin(), added.end());
+    else
+    {
+      int cacheFile = open(path.c_str(), O_WRONLY | O_APPEND);
+      ObjectBuffer out;
+      out.bytes.swap(added);
+      ok = cacheFile >= 0 && WriteBytes(cacheFile, out.bytes);
+      if (cacheFile >= 0)
+        close(cacheFile);
+      out.bytes.swap(added);
+    }
+  }
+  else
   {
-    tokens_vec.push_back(*it);
+    ObjectBuffer out;
+    out.bytes.reserve(cacheHeader + live + added.size());
+    out.Put(cacheMagic, sizeof(cacheMagic));
+    out.Put((const char*)cacheLayout, sizeof(cacheLayout));
+    for (size_t i = 0; i < kept.size(); ++i)
+      out.Put(records[kept[i]].data(), records[kept[i]].size());
+    out.Put(added.data(), added.size());
+
+    //replace the old cache in one step so a killed run cannot corrupt it
+    if (path.empty())
+      memory.swap(out.bytes);
+    else
+    {
+      std::string temporary = path + ".tmp";
+      ok = WriteOutput(temporary.c_str(), out) && rename(temporary.c_str(), path.c_str()) == 0;
+    }
   }
+  added.clear();
+  return ok;
 }
 
 
@@ -428,273 +587,867 @@ Label::Label(std::string command, int lineNum) : lineNum(lineNum)
  *               Non-member Methods               *
  *************************************************/
 
-std::ostream& operator << (std::ostream& os, Command command)
+void AssembleIncremental(std::string_view source, int threads, AssemblyCache& cache,
+                         Chunk& program, PhaseStats* stats)
 {
-  //for debugging
-  //output Command data mambers
-  std::cout << "Tokens: ";
-  for (int i = 0; i < command.tokens_vec.size(); ++i)
-    std::cout << command.tokens_vec[i] << " ";
-  std::cout << std::endl;
-
-  std::cout << "Line Number:      " << command.lineNum << std::endl;
-
-  std::cout << "Instruciton Type: " << command.type << std::endl;
+  std::vector<Chunk> chunks;
+  SplitBlocks(source, chunks);
 
-  std::cout << "Machine: " << std::setw(8) << std::hex << std::setfill('0') << command.machine << std::endl;
-
-  std::cout << std::dec;
+  //records of the last run, cached label names are views into them
+  cache.Load();
+  RunWorkers(chunks.size(), threads, [&](size_t c)
+  {
+    cache.Find(chunks[c]);
+  });
+  cache.reused = 0;
+  for (size_t c = 0; c < chunks.size(); ++c)
+    cache.reused += chunks[c].cached;
+  cache.read = chunks.size() - cache.reused;
+
+  ReadChunks(chunks, threads);
+  cache.Store(chunks);
+  if (stats != NULL)
+    stats->End("parse");
+  MergeChunks(chunks, threads, program, stats);
+  return;
 }
 
 
 
-std::ostream& operator << (std::ostream& os, Label command)
+bool AssembleObject(const char* path, int threads, ObjectBuffer& object)
 {
-  //for debugging
-  //output label data mambers
-  std::cout << "Tokens: ";
-  for (int i = 0; i < command.tokens_vec.size(); ++i)
-    std::cout << command.tokens_vec[i] << " ";
-  std::cout << std::endl;
-
-  std::cout << "Line Number:      " << command.lineNum << std::endl;
-
-  std::cout << "Instruciton Type: " << command.type << std::endl;
+  SourceFile asmFile;
+  if (!asmFile.Open(path))
+  {
+    std::cerr << "Error opening file " << path << "." << std::endl;
+    return false;
+  }
 
-  std::cout << "Machine: " << std::setw(8) << std::hex << std::setfill('0') << command.machine << std::endl;
+  //labels left undefined become external symbols
+  Chunk program;
+  if (threads > 1 && asmFile.size > (1 << 16))
+    AssembleParallel(asmFile.View(), threads, program, NULL);
+  else
+    AssembleSerial(asmFile.View(), program, NULL);
+  program.symbols.SortMessages();
+  ShowMessages(program.symbols.messages);
+  if (program.symbols.errors > 0)
+    return false;
 
-  std::cout << std::dec;
+  std::vector<unsigned int> words = ImageWords(program);
+  EmitElf(program, words, object);
+  return true;
 }
 
 
 
-void ResolveLabels(std::list<Command>& cmdList, std::list<Label> lblList)
+bool AssembleFiles(const std::vector<const char*>& paths, int threads, bool little,
+                   std::vector<ObjectFile>& objects)
 {
-  std::list<Command>::iterator cmdIter = cmdList.begin();
-
-  for (size_t i = 0; i < cmdList.size(); ++i)
+  objects.resize(paths.size());
+  std::vector<char> failed(paths.size(), 0);
+  //a lone source may still be split across threads; several files are
+  //assembled one per thread, each serially
+  int fileThreads = paths.size() == 1 ? threads : 1;
+  RunWorkers(paths.size(), threads, [&](size_t k)
   {
-    //for lw and sw instructions
-    if (cmdIter->tokens_vec[0] == "lw" || cmdIter->tokens_vec[0] == "sw")
+    std::string_view path = paths[k];
+    ObjectFile& object = objects[k];
+    if (path.size() > 2 && path.substr(path.size() - 2) == ".o")
     {
-      std::string label = cmdIter->tokens_vec[2];
-      std::list<Label>::iterator lblIter = lblList.begin();
-      for (size_t j = 0; j < lblList.size(); ++j)
+      if (!object.Load(paths[k]))
       {
-        if (label == lblIter->tokens_vec[0])
-        {
-          cmdIter->tokens_vec[2] = lblIter->tokens_vec[2]; 
-          break;
-        }
-        ++lblIter;
+        std::cerr << "Error opening file " << path << "." << std::endl;
+        failed[k] = 1;
+        return;
       }
     }
-
-    //for beq and bne instructions
-    if(cmdIter->tokens_vec[0] == "beq" || cmdIter->tokens_vec[0] == "bne")
+    else
     {
-      std::string label = cmdIter->tokens_vec[3];
-      std::list<Label>::iterator lblIter = lblList.begin();
-      for (size_t j = 0; j < lblList.size(); ++j)
+      ObjectBuffer buffer;
+      buffer.little = little;
+      if (!AssembleObject(paths[k], fileThreads, buffer))
       {
-        if (label == lblIter->tokens_vec[0])
-        {
-          cmdIter->tokens_vec[3] = std::to_string(lblIter->lineNum); 
-          break;
-        }
-        ++lblIter;
+        failed[k] = 1;
+        return;
       }
+      object.bytes.swap(buffer.bytes);
     }
-
-    //for j instructions
-    if(cmdIter->tokens_vec[0] == "j")
+    object.path = path;
+    if (!object.Parse())
     {
-      std::string label = cmdIter->tokens_vec[1];
-      std::list<Label>::iterator lblIter = lblList.begin();
-      for (size_t j = 0; j < lblList.size(); ++j)
-      {
-        if (label == lblIter->tokens_vec[0])
-        {
-          cmdIter->tokens_vec[1] = std::to_string(lblIter->lineNum); 
-          break;
-        }
-        ++lblIter;
-      }
+      std::cerr << path << ": not an ELF32 MIPS relocatable." << std::endl;
+      failed[k] = 1;
     }
-    
-    ++cmdIter;
-  }  
+  });
+
+  for (size_t k = 0; k < failed.size(); ++k)
+    if (failed[k])
+      return false;
+  return true;
 }
 
 
 
-/***********************************
- *               Main              *
- ***********************************/
-
-int main(int argc, char* argv[])
+bool Link(std::vector<ObjectFile>& objects, std::vector<unsigned int>& words)
 {
-  //open assembly file from command line
-  //check for opening error
-  std::ifstream asmFile;
-  asmFile.open(argv[1]);
-  if (!asmFile.is_open())
+  //every .text, then every .data, in command line order
+  std::vector<unsigned int> textBase(objects.size());
+  std::vector<unsigned int> dataBase(objects.size());
+  unsigned int address = 0;
+  for (size_t k = 0; k < objects.size(); ++k)
   {
-    std::cerr << "Error opening file." << std::endl;
-    std::cerr << "Quitting assembler." << std::endl;
-    return 1;
+    textBase[k] = address;
+    address += objects[k].textSize;
+  }
+  for (size_t k = 0; k < objects.size(); ++k)
+  {
+    dataBase[k] = address;
+    address += objects[k].dataSize;
   }
 
-  //read/decipher/store source code
-  std::string lineIn;
-  std::list<Command> cmdList;
-  std::list<Label> lblList;
-  int index = 0;
-  bool inData = 0;
-  while (!asmFile.eof())
-  {
-    std::ws(asmFile);
-    std::getline(asmFile,lineIn);
-    if(!asmFile.good())
-      break;
+  words.reserve(address / 4);
+  for (size_t k = 0; k < objects.size(); ++k)
+    for (size_t at = 0; at < objects[k].textSize; at += 4)
+      words.push_back(objects[k].Read32(objects[k].textOffset + at));
+  for (size_t k = 0; k < objects.size(); ++k)
+    for (size_t at = 0; at < objects[k].dataSize; at += 4)
+      words.push_back(objects[k].Read32(objects[k].dataOffset + at));
 
-    //.text section - process .text instructions
-    if (!inData)
+  //address and lw/sw offset of a symbol
+  struct LinkSymbol
+  {
+    unsigned int            address;                  //byte address
+    unsigned int            value;                    //first data operand
+    bool                    hasValue;                 //data label with an operand
+    size_t                  object;                   //defining file
+  };
+
+  //global definitions, the first file to define one wins
+  int errors = 0;
+  std::unordered_map<std::string_view, LinkSymbol> globals;
+  std::vector< std::vector<LinkSymbol> > local(objects.size());
+  for (size_t k = 0; k < objects.size(); ++k)
+  {
+    ObjectFile& object = objects[k];
+    local[k].resize(object.symCount);
+    for (size_t i = 1; i < object.symCount; ++i)
     {
-      //if .data section is entered, break out of .text loop
-      if (lineIn == ".data")
-      {
-        inData = 1;
+      size_t entry = object.symOffset + 16 * i;
+      unsigned char info = object.bytes[entry + 12];
+      unsigned int shndx = object.Read16(entry + 14);
+      LinkSymbol& symbol = local[k][i];
+      symbol.object = k;
+      symbol.address = object.Read32(entry + 4)
+                       + (shndx == (unsigned int)object.dataIndex ? dataBase[k] : textBase[k]);
+      symbol.value = object.Read32(entry + 8);
+      symbol.hasValue = (info & 0xf) == 1;
+      if (shndx == 0 || info >> 4 == 0)
         continue;
-      }
-      //ignore .text instruction
-      if(lineIn == ".text")
+
+      std::string_view name = object.String(object.Read32(entry));
+      std::pair<std::unordered_map<std::string_view, LinkSymbol>::iterator, bool> added =
+        globals.emplace(name, symbol);
+      if (!added.second)
       {
-        continue;
+        std::cerr << object.path << ": duplicate symbol " << name << ", first defined in "
+                  << objects[added.first->second.object].path << "." << std::endl;
+        ++errors;
       }
+    }
+  }
 
-      //only labels contain ':'
-      //store labels in seperate list
-      size_t result = lineIn.find(':');
-      if (result != std::string::npos)
+  //patch every relocated field
+  for (size_t k = 0; k < objects.size(); ++k)
+  {
+    ObjectFile& object = objects[k];
+    for (size_t r = 0; r < object.relCount; ++r)
+    {
+      unsigned int offset = object.Read32(object.relOffset + 8 * r);
+      unsigned int info = object.Read32(object.relOffset + 8 * r + 4);
+      size_t index = info >> 8;
+      if (offset + 4 > object.textSize || index == 0 || index >= object.symCount)
       {
-        Label newLabel(lineIn,index);
-        newLabel.type = "tl";
-        lblList.push_back(newLabel);
-        //++index; not used, text labels should  have same lineNum as next command
+        std::cerr << object.path << ": bad relocation." << std::endl;
+        ++errors;
         continue;
       }
 
-      //if not a label...
-      //determine type of instruction, push onto command list
-      Command newCommand(lineIn,index);  
-      newCommand.type = newCommand.GetRIJType();
-      cmdList.push_back(newCommand);
-      
-    } //while(!inData)
-
-    
-    //.data section - process .data instructions
-    else
-    {
-     Label newLabel(lineIn,index);
-      
-      //process .word allocations
-      if (newLabel.tokens_vec[1] == ".word")
+      size_t entry = object.symOffset + 16 * index;
+      std::string_view name = object.String(object.Read32(entry));
+      LinkSymbol symbol = local[k][index];
+      if (object.Read16(entry + 14) == 0)
       {
-        for (int i = 2; i < newLabel.tokens_vec.size(); ++i)
+        std::unordered_map<std::string_view, LinkSymbol>::iterator found = globals.find(name);
+        if (found == globals.end())
         {
-          Label wordLabel(lineIn,index);
-          wordLabel.type = ".word";
-          wordLabel.machine = stoi(newLabel.tokens_vec[i]);
-          lblList.push_back(wordLabel);
-          ++index;
+          std::cerr << object.path << ": undefined symbol " << name << "." << std::endl;
+          ++errors;
+          continue;
         }
-        continue;
-
+        symbol = found->second;
       }
 
-      //process .space allocations
-      else
+      unsigned int place = textBase[k] + offset;
+      unsigned int& word = words[place / 4];
+      switch (info & 0xff)
       {
-        int numBytes = stoi(newLabel.tokens_vec[2]);
-        
-        for (int i = 0; i < numBytes; ++i)
+        case RELOC_26:
+          word = (word & ~0x3ffffffu) | (((symbol.address >> 2) + word) & 0x3ffffff);
+          break;
+        case RELOC_PC16:
+        {
+          int addend = (short)(word & 0xffff);
+          int field = ((int)symbol.address - (int)place) / 4 + addend;
+          word = (word & ~0xffffu) | (field & 0xffff);
+          break;
+        }
+        case RELOC_HI16:
         {
-          Label spaceLabel(lineIn,index);
-          spaceLabel.type = ".space";
-          spaceLabel.machine = 0;
-          lblList.push_back(spaceLabel);
-          ++index;
+          //the addend is this high half and the low half of the next %lo
+          //against the same symbol, whose field is not yet patched
+          int addend = (int)((word & 0xffff) << 16);
+          for (size_t pair = r + 1; pair < object.relCount; ++pair)
+          {
+            unsigned int pairInfo = object.Read32(object.relOffset + 8 * pair + 4);
+            unsigned int pairOffset = object.Read32(object.relOffset + 8 * pair);
+            if ((pairInfo & 0xff) == RELOC_LO16 && pairInfo >> 8 == index
+                && pairOffset + 4 <= object.textSize)
+            {
+              addend += (short)(words[(textBase[k] + pairOffset) / 4] & 0xffff);
+              break;
+            }
+          }
+          unsigned int address = symbol.address + addend;
+          word = (word & ~0xffffu) | (((address + 0x8000) >> 16) & 0xffff);
+          break;
         }
-      }      
-    } //else
+        case RELOC_LO16:
+          word = (word & ~0xffffu) | ((symbol.address + (short)(word & 0xffff)) & 0xffff);
+          break;
+        case RELOC_VALUE16:
+          if (!symbol.hasValue)
+          {
+            std::cerr << object.path << ": label " << name
+                      << " has no data to use as an offset." << std::endl;
+            ++errors;
+          }
+          word = (word & ~0xffffu) | (symbol.value & 0xffff);
+          break;
+        default:
+          std::cerr << object.path << ": unsupported relocation type " << (info & 0xff)
+                    << "." << std::endl;
+          ++errors;
+          break;
+      }
+    }
+  }
+  return errors == 0;
+}
 
-    //.data process increments index for itself
-    if (!inData)
-      ++index;
 
-  } //while(!asmFile.eof())
 
-  //resolve labels in cmdList
-  ResolveLabels(cmdList, lblList);
-  
-  //resolve machine codes in cmdList
-  std::list<Command>::iterator cmdIter = cmdList.begin();
-  for (int i = 0; i < cmdList.size(); ++i)
+void ShowMessages(const std::vector<std::string>& messages)
+{
+  std::string text;
+  for (size_t i = 0; i < messages.size(); ++i)
   {
-    cmdIter->ResolveMachine();
-    ++cmdIter;
+    text.append(messages[i]);
+    text.push_back('\n');
   }
+  std::cerr << text << std::flush;
+  return;
+}
 
-  //output cmdList machine code
-  std::cout << std::endl;
-  cmdIter = cmdList.begin();
-  for (int i = 0; i < cmdList.size(); ++i)
+
+
+bool WriteBytes(int fd, const std::vector<char>& bytes)
+{
+  size_t done = 0;
+  while (done < bytes.size())
+  {
+    ssize_t wrote = write(fd, &bytes[done], bytes.size() - done);
+    if (wrote < 0)
+      return false;
+    done += wrote;
+  }
+  return true;
+}
+
+
+
+bool WriteOutput(const char* outPath, const ObjectBuffer& out)
+{
+  int outFile = outPath == NULL ? 1 : open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (outFile < 0)
+    return false;
+  bool written = WriteBytes(outFile, out.bytes);
+  if (outFile != 1)
+    close(outFile);
+  return written;
+}
+
+
+
+bool UpdateOutput(const char* outPath, const ObjectBuffer& out, size_t& rewritten)
+{
+  int outFile = open(outPath, O_RDWR | O_CREAT, 0644);
+  if (outFile < 0)
+    return false;
+
+  //compare page by page, writing only pages that changed
+  rewritten = 0;
+  const size_t page = 4096;
+  char old[page];
+  bool ok = true;
+  for (size_t at = 0; ok && at < out.bytes.size(); at += page)
+  {
+    size_t count = std::min(page, out.bytes.size() - at);
+    ssize_t got = pread(outFile, old, count, at);
+    if (got == (ssize_t)count && std::memcmp(old, &out.bytes[at], count) == 0)
+      continue;
+    ok = pwrite(outFile, &out.bytes[at], count, at) == (ssize_t)count;
+    rewritten += count;
+  }
+  ok = ok && ftruncate(outFile, out.bytes.size()) == 0;
+  close(outFile);
+  return ok;
+}
+
+
+
+int RunProgram(const Chunk& program, const std::vector<unsigned int>& words, bool native)
+{
+  //a megabyte of stack above the data
+  const unsigned int stackWords = 1 << 18;
+  Machine machine;
+  machine.Load(words, program.cmdList.size(), stackWords);
+  NativeCache cache(machine);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  StopReason stop = native ? RunNative(cache, std::cin, std::cout) : machine.Run(std::cin, std::cout);
+  std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+  std::cout << std::flush;
+
+  if (stop == STOP_FAULT)
+  {
+    std::cerr << std::endl;
+    if (machine.pc < program.cmdList.size())
+      std::cerr << "Line " << program.cmdList[machine.pc].srcLine << ": ";
+    std::cerr << machine.fault << "." << std::endl;
+  }
+  else if (stop == STOP_END)
+    std::cerr << std::endl << "Program left the text segment." << std::endl;
+  std::cerr << "Executed " << machine.executed << " instructions in " << took.count() * 1000
+            << " ms, " << machine.executed / took.count() / 1e6 << " MIPS." << std::endl;
+  if (native && cache.code == NULL)
+    std::cerr << "No executable memory, interpreted instead." << std::endl;
+  else if (native)
+    std::cerr << cache.blocks << " blocks translated, cache emptied " << cache.flushes
+              << " times." << std::endl;
+  return stop == STOP_FAULT ? 1 : 0;
+}
+
+
+
+int RunBatchFile(const Chunk& program, const std::vector<unsigned int>& words,
+                 const char* inputPath, int threads)
+{
+  SourceFile inputFile;
+  if (!inputFile.Open(inputPath))
+  {
+    std::cerr << "Error opening inputs file." << std::endl;
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
+  }
+  std::vector<BatchRun> runs;
+  int badLine = 0;
+  if (!ReadInputs(inputFile.View(), runs, badLine))
   {
-    std::cout << std::setw(8) << std::hex << std::setfill('0') << cmdIter->machine << std::endl;
-    ++cmdIter;
+    std::cerr << inputPath << ": Line " << badLine << ": Invalid input." << std::endl;
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
   }
 
-  //output lblList machine code
-  std::list<Label>::iterator lblIter = lblList.begin();
-  for (int i = 0; i < lblList.size(); ++i)
+  //every run starts from this machine, decoded once
+  const unsigned int stackWords = 1 << 18;
+  Machine image;
+  image.Load(words, program.cmdList.size(), stackWords);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  RunBatch(image, runs, threads);
+  std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+  //one line per run, in input order
+  std::string text;
+  unsigned long long executed = 0;
+  int faults = 0;
+  for (size_t k = 0; k < runs.size(); ++k)
   {
-    //exclude text labels
-    if(lblIter->type != "tl")
+    const BatchRun& run = runs[k];
+    text += std::to_string(k) + ": ";
+    if (run.stop == STOP_FAULT)
     {
-      std::cout << std::setw(8) << std::hex << std::setfill('0') << lblIter->machine << std::endl;
+      if (run.pc < program.cmdList.size())
+        text += "Line " + std::to_string(program.cmdList[run.pc].srcLine) + ": ";
+      text += run.fault;
+      ++faults;
     }
-    ++lblIter;
+    else
+      text += run.stop == STOP_EXIT ? "exit" : "left the text segment";
+    text += ", " + std::to_string(run.executed) + " instructions: " + run.output + "\n";
+    executed += run.executed;
+  }
+  std::cout << text << std::flush;
+  std::cerr << "Ran " << runs.size() << " inputs on " << threads << " threads, " << faults
+            << " faulted; executed " << executed << " instructions in " << took.count() * 1000
+            << " ms, " << executed / took.count() / 1e6 << " MIPS." << std::endl;
+  return faults > 0 ? 1 : 0;
+}
+
+
+
+int AssembleProgram(const char* path, int threads, std::string_view format, const char* outPath,
+                    bool little, AssemblyCache* cache, bool stats, std::string_view run,
+                    bool optimize, const char* batchPath)
+{
+  //phases are timed only when asked for
+  PhaseStats phaseStats;
+  PhaseStats* phases = stats ? &phaseStats : NULL;
+
+  //map assembly file from command line
+  //check for opening error
+  SourceFile asmFile;
+  if (path == NULL || !asmFile.Open(path))
+  {
+    std::cerr << "Error opening file." << std::endl;
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
+  }
+  if (phases != NULL)
+    phases->End("read");
+
+  //read/decipher/store source code
+  //serially, labels are resolved as they are read and forward references
+  //are backpatched when their label is defined; in parallel, chunks are
+  //read concurrently and label fields fixed up after their tables merge;
+  //incrementally, chunks unchanged since the last run are not read at all
+  Chunk program;
+  if (cache != NULL)
+    AssembleIncremental(asmFile.View(), threads, *cache, program, phases);
+  else if (threads > 1 && asmFile.size > (1 << 16))
+    AssembleParallel(asmFile.View(), threads, program, phases);
+  else
+    AssembleSerial(asmFile.View(), program, phases);
+  std::vector<Command>& cmdList = program.cmdList;
+
+  //every label reference must have been backpatched
+  int unresolved = program.symbols.ReportUnresolved(cmdList);
+  program.symbols.SortMessages();
+  ShowMessages(program.symbols.messages);
+  if (unresolved > 0 || program.symbols.errors > 0)
+  {
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
+  }
+  if (phases != NULL)
+    phases->End("resolve");
+
+  //peephole and scheduling pass over the resolved commands, which it
+  //encodes again
+  if (optimize)
+  {
+    OptimizeReport report;
+    Optimize(program, report);
+    std::cerr << report.Summary() << std::endl;
+    if (phases != NULL)
+      phases->End("optimize");
+  }
+
+  //build whole output, then write it at once
+  ObjectBuffer out;
+  out.little = little;
+  std::vector<unsigned int> words = ImageWords(program);
+  if (phases != NULL)
+    phases->End("encode");
+  if (format == "hex")
+    EmitHex(words, out);
+  else if (format == "raw")
+    EmitRaw(words, out);
+  else
+    EmitElf(program, words, out);
+  if (phases != NULL)
+    phases->End("emit");
+
+  size_t rewritten = out.bytes.size();
+  bool written = ((!run.empty() || batchPath != NULL) && outPath == NULL)
+                 || (cache != NULL && outPath != NULL ? UpdateOutput(outPath, out, rewritten)
+                                                      : WriteOutput(outPath, out));
+  if (!written)
+  {
+    std::cerr << "Error writing output." << std::endl;
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
+  }
+  if (phases != NULL)
+    phases->End("write");
+
+  //the program's label names may be views into the cache, so it is
+  //only saved once they are no longer needed
+  if (cache != NULL && !cache->Save())
+    std::cerr << "Error writing " << cache->path << "." << std::endl;
+  if (cache != NULL && phases != NULL)
+    phases->End("save");
+  if (cache != NULL && outPath != NULL)
+    std::cerr << path << ": " << cache->reused << " of " << cache->reused + cache->read
+              << " blocks cached, " << rewritten << " bytes rewritten." << std::endl;
+
+  //ru_maxrss is in kilobytes on Linux
+  if (phases != NULL)
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cerr << phases->Json(path, program.srcLine, threads, usage.ru_maxrss) << std::endl;
   }
 
   
   #ifdef DEBUG
   
+  std::vector<Label>& lblList = program.lblList;
+  DataSegment& data = program.data;
+
   //read contents of cmdList for debug
   std::cout << std::endl;
   std::cout << "COMMAND LIST CONTENTS:" << std::endl;
   std::cout << "COMMAND LIST SIZE: " << cmdList.size() << std::endl;
-  cmdIter = cmdList.begin();
   for (size_t i = 0; i < cmdList.size(); ++i)
   {
-    std::cout << i << ": " << *cmdIter << std::endl;
-    ++cmdIter;
+    std::cout << i << ": " << cmdList[i] << std::endl;
   }
   
   //read contents of lblList for debug
   std::cout << "LABEL LIST CONTENTS:" << std::endl;
   std::cout << "LABEL LIST SIZE: " << lblList.size() << std::endl;
-  lblIter = lblList.begin();
   for (size_t i = 0; i < lblList.size(); ++i)
   {
-    std::cout << i << ": " << *lblIter << std::endl;
-    ++lblIter;
+    std::cout << i << ": " << lblList[i] << std::endl;
+  }
+
+  //read contents of data segment for debug
+  std::cout << "DATA RANGES:" << std::endl;
+  std::cout << "DATA SIZE: " << data.Size() << std::endl;
+  for (size_t i = 0; i < data.ranges.size(); ++i)
+  {
+    std::cout << i << ": " << data.ranges[i] << std::endl;
   }
 
   #endif
 
+  if (batchPath != NULL)
+    return RunBatchFile(program, words, batchPath, threads);
+  if (!run.empty())
+    return RunProgram(program, words, run == "jit");
   return 0;
 }
 
+
+
+/***********************************
+ *           Heap Counting         *
+ ***********************************/
+
+//set by --stats before any worker starts, so reads need no fence
+bool countHeap = false;
+
+
+
+//every replaced form allocates and frees through this pair, so --stats
+//counts array, nothrow and over-aligned allocations too. They are kept
+//out of line so the compiler never pairs an inlined delete's free with
+//a new it cannot see was malloc
+__attribute__((noinline)) static void* CountedAlloc(size_t size, size_t align)
+{
+  if (countHeap)
+  {
+    heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    heapBytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  if (size == 0)
+    size = 1;
+  if (align <= alignof(std::max_align_t))
+    return std::malloc(size);
+  return std::aligned_alloc(align, (size + align - 1) & ~(align - 1));
+}
+
+
+
+__attribute__((noinline)) static void CountedFree(void* block)
+{
+  std::free(block);
+  return;
+}
+
+
+
+void* operator new(size_t size)
+{
+  void* block = CountedAlloc(size, 0);
+  if (block == NULL)
+    throw std::bad_alloc();
+  return block;
+}
+
+
+
+void* operator new[](size_t size)
+{
+  void* block = CountedAlloc(size, 0);
+  if (block == NULL)
+    throw std::bad_alloc();
+  return block;
+}
+
+
+
+void* operator new(size_t size, std::align_val_t align)
+{
+  void* block = CountedAlloc(size, (size_t)align);
+  if (block == NULL)
+    throw std::bad_alloc();
+  return block;
+}
+
+
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+  void* block = CountedAlloc(size, (size_t)align);
+  if (block == NULL)
+    throw std::bad_alloc();
+  return block;
+}
+
+
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedAlloc(size, 0);
+}
+
+
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedAlloc(size, 0);
+}
+
+
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+  return CountedAlloc(size, (size_t)align);
+}
+
+
+
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+  return CountedAlloc(size, (size_t)align);
+}
+
+
+
+//plain, sized, aligned and nothrow deletes of both kinds all just free
+void operator delete(void* block) noexcept { CountedFree(block); }
+void operator delete[](void* block) noexcept { CountedFree(block); }
+void operator delete(void* block, size_t) noexcept { CountedFree(block); }
+void operator delete[](void* block, size_t) noexcept { CountedFree(block); }
+void operator delete(void* block, std::align_val_t) noexcept { CountedFree(block); }
+void operator delete[](void* block, std::align_val_t) noexcept { CountedFree(block); }
+void operator delete(void* block, size_t, std::align_val_t) noexcept { CountedFree(block); }
+void operator delete[](void* block, size_t, std::align_val_t) noexcept { CountedFree(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { CountedFree(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { CountedFree(block); }
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  CountedFree(block);
+}
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  CountedFree(block);
+}
+
+
+
+/***********************************
+ *               Main              *
+ ***********************************/
+
+int main(int argc, char* argv[])
+{
+  //options, then assembly files and objects
+  int threads = 1;
+  bool badThreads = false;                            //-j value not a positive integer
+  bool object = false;
+  std::vector<const char*> paths;
+  const char* outPath = NULL;
+  const char* cachePath = NULL;
+  bool watch = false;
+  bool stats = false;
+  bool optimize = false;
+  std::string_view run;
+  const char* batchPath = NULL;
+  std::string_view format = "hex";
+  ObjectBuffer out;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 9) == "--format=")
+      format = arg.substr(9);
+    else if (arg == "--endian=little")
+      out.little = true;
+    else if (arg == "--endian=big")
+      out.little = false;
+    else if (arg.substr(0, 6) == "--out=")
+      outPath = argv[i] + 6;
+    else if (arg == "-c")
+      object = true;
+    else if (arg.substr(0, 8) == "--cache=")
+      cachePath = argv[i] + 8;
+    else if (arg == "--watch")
+      watch = true;
+    else if (arg == "--stats")
+      stats = true;
+    else if (arg == "-O")
+      optimize = true;
+    else if (arg == "--run")
+      run = "interp";
+    else if (arg.substr(0, 6) == "--run=")
+      run = arg.substr(6);
+    else if (arg.substr(0, 8) == "--batch=")
+      batchPath = argv[i] + 8;
+    //-j alone, last or before another option, uses every hardware thread
+    else if (arg == "-j" && (i + 1 == argc || (argv[i + 1][0] == '-' &&
+                                               !std::isdigit((unsigned char)argv[i + 1][1]))))
+      threads = std::thread::hardware_concurrency();
+    else if (arg == "-j")
+      badThreads = !ParseInt(argv[++i], threads) || threads < 1;
+    else if (arg.substr(0, 2) == "-j")
+      badThreads = !ParseInt(arg.substr(2), threads) || threads < 1;
+    else
+      paths.push_back(argv[i]);
+  }
+  if (badThreads)
+    std::cerr << "-j needs a positive number of threads." << std::endl;
+  if (threads < 1)
+    threads = 1;
+  std::string_view first = paths.empty() ? "" : paths[0];
+  bool linking = paths.size() > 1 || (first.size() > 2 && first.substr(first.size() - 2) == ".o");
+  if (badThreads || (format != "hex" && format != "raw" && format != "elf")
+      || (linking && format == "elf")
+      || (object && outPath != NULL && paths.size() > 1)
+      || ((cachePath != NULL || watch || stats || optimize || !run.empty() || batchPath != NULL)
+          && (object || linking))
+      || (!run.empty() && (watch || (run != "interp" && run != "jit")))
+      || (batchPath != NULL && (watch || !run.empty()))
+      || (watch && (outPath == NULL || paths.empty())))
+  {
+    std::cerr << "Usage: " << argv[0] << " [-j N] [--format=hex|raw|elf]"
+              << " [--endian=big|little] [--out=file] [--stats]" << std::endl;
+    std::cerr << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [-O] [--run[=interp|jit] | --batch=inputs] file.s" << std::endl;
+    std::cerr << "       " << argv[0] << " [-j N] [--format=hex|raw|elf] [--endian=big|little]"
+              << " --cache=file [--watch] [--stats] [-O] --out=file file.s" << std::endl;
+    std::cerr << "       " << argv[0] << " -c [-j N] [--endian=big|little] [--out=file.o]"
+              << " file.s ..." << std::endl;
+    std::cerr << "       " << argv[0] << " [-j N] [--format=hex|raw] [--endian=big|little]"
+              << " [--out=file] file.s|file.o ..." << std::endl;
+    std::cerr << "Quitting assembler." << std::endl;
+    return 1;
+  }
+
+  //separate assembly: each source becomes an ELF relocatable whose
+  //undefined labels are left to the linker; several sources or any
+  //object on the command line are assembled separately and linked
+  if (object || linking)
+  {
+    std::vector<ObjectFile> objects;
+    if (!AssembleFiles(paths, threads, out.little, objects))
+    {
+      std::cerr << "Quitting assembler." << std::endl;
+      return 1;
+    }
+
+    if (object)
+    {
+      for (size_t k = 0; k < objects.size(); ++k)
+      {
+        std::string_view path = paths[k];
+        if (path.size() > 2 && path.substr(path.size() - 2) == ".o")
+          continue;
+        std::string objectPath = outPath != NULL ? outPath
+                                 : std::string(path.substr(0, path.rfind(".s"))) + ".o";
+        ObjectBuffer buffer;
+        buffer.bytes.swap(objects[k].bytes);
+        if (!WriteOutput(objectPath.c_str(), buffer))
+        {
+          std::cerr << "Error writing " << objectPath << "." << std::endl;
+          std::cerr << "Quitting assembler." << std::endl;
+          return 1;
+        }
+      }
+      return 0;
+    }
+
+    std::vector<unsigned int> words;
+    if (!Link(objects, words))
+    {
+      std::cerr << "Quitting assembler." << std::endl;
+      return 1;
+    }
+    if (format == "hex")
+      EmitHex(words, out);
+    else
+      EmitRaw(words, out);
+    if (!WriteOutput(outPath, out))
+    {
+      std::cerr << "Error writing output." << std::endl;
+      std::cerr << "Quitting assembler." << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  //count heap calls from here on, per phase
+  countHeap = stats;
+
+  //assemble on every change to the source, the first time in full
+  if (watch)
+  {
+    AssemblyCache watchCache;
+    watchCache.path = cachePath == NULL ? "" : cachePath;
+    struct stat seen = {};
+    for (;;)
+    {
+      struct stat now;
+      if (stat(paths[0], &now) == 0 && (now.st_mtim.tv_sec != seen.st_mtim.tv_sec
+          || now.st_mtim.tv_nsec != seen.st_mtim.tv_nsec || now.st_size != seen.st_size))
+      {
+        seen = now;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        AssembleProgram(paths[0], threads, format, outPath, out.little, &watchCache, stats, "",
+                        optimize, NULL);
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+        std::cerr << "Assembled in " << took.count() << " ms." << std::endl;
+      }
+      usleep(100000);
+    }
+  }
+
+  AssemblyCache cache;
+  cache.path = cachePath == NULL ? "" : cachePath;
+  return AssembleProgram(paths.empty() ? NULL : paths[0], threads, format, outPath, out.little,
+                         cachePath != NULL ? &cache : NULL, stats, run, optimize, batchPath);
+}
+
 #endif
@@ -0,0 +1,794 @@
+/**
+ * @file   native.cpp
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  x86-64 translation of MIPS basic blocks
+ *
+ * @description
+ * Code generator and dispatch loop behind native.h.
+ * A translated block is called as
+ *   unsigned int block(int* regs, unsigned int* memory)
+ * and returns the index of the next micro-op; bit 31 set
+ * means a bad address at that index, bit 30 a store into
+ * the text just before it, bit 29 an overflow the
+ * interpreter reports by running that micro-op. MIPS
+ * registers stay in the Machine; eax, ecx, edx, r8 and r9
+ * are scratch.
+ *****************************************************/
+
+#ifndef native_CPP
+#define native_CPP
+
+#include "native.h"
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define NATIVE_X86_64 1
+#include <sys/mman.h>
+#endif
+
+
+/*********************************************
+ *              Helper Functions             *
+ *********************************************/
+
+//micro-ops Translate emits code for; console i/o, traps and the end of
+//the text are left to the interpreter, and a block stops before them
+static bool Translatable(unsigned char code)
+{
+  switch (code)
+  {
+    case OP_SYSCALL: case OP_TRAP: case OP_BREAK: case OP_END: case OP_ILLEGAL:
+      return false;
+    default:
+      return true;
+  }
+}
+
+
+
+//micro-ops that may leave the straight line; a block ends after them
+static bool Transfers(unsigned char code)
+{
+  switch (code)
+  {
+    case OP_BEQ: case OP_BNE: case OP_BLEZ: case OP_BGTZ: case OP_BLTZ: case OP_BGEZ:
+    case OP_BLTZAL: case OP_BGEZAL: case OP_J: case OP_JAL: case OP_JR: case OP_JALR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+
+
+/*********************************************
+ *            NativeCache Methods            *
+ *********************************************/
+
+NativeCache::NativeCache(Machine& machine) : machine(machine),
+                                             entry(machine.textWords + 1, NULL),
+                                             pending(machine.textWords + 1),
+                                             runs(machine.textWords + 1, 0)
+{
+}
+
+
+
+NativeCache::~NativeCache()
+{
+  #ifdef NATIVE_X86_64
+  if (code != NULL)
+    munmap(code, capacity);
+  #endif
+}
+
+
+
+bool NativeCache::Open(size_t bytes)
+{
+  #ifdef NATIVE_X86_64
+  void* region = mmap(NULL, bytes, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+  code = (unsigned char*)region;
+  capacity = bytes;
+  used = 0;
+  return true;
+  #else
+  (void)bytes;
+  return false;
+  #endif
+}
+
+
+
+void NativeCache::Flush()
+{
+  //chained jumps only lead to blocks in the cache, so all go together
+  for (size_t i = 0; i < entry.size(); ++i)
+  {
+    entry[i] = NULL;
+    pending[i].clear();
+  }
+  used = 0;
+  ++flushes;
+  return;
+}
+
+
+
+void NativeCache::Emit8(unsigned int byte)
+{
+  code[used++] = (unsigned char)byte;
+  return;
+}
+
+
+
+void NativeCache::Emit32(unsigned int word)
+{
+  for (int i = 0; i < 4; ++i)
+    Emit8(word >> (8 * i));
+  return;
+}
+
+
+
+void NativeCache::EmitModRM(unsigned int opcode, unsigned int reg, int disp)
+{
+  //[rdi + disp8] when it fits, else [rdi + disp32]
+  Emit8(opcode);
+  if (disp >= -128 && disp <= 127)
+  {
+    Emit8(0x40 | (reg << 3) | 7);
+    Emit8(disp);
+  }
+  else
+  {
+    Emit8(0x80 | (reg << 3) | 7);
+    Emit32(disp);
+  }
+  return;
+}
+
+
+
+void NativeCache::EmitExit(unsigned int target)
+{
+  //jmp rel32 if target is translated, else mov eax, target; ret, which
+  //is long enough to be patched into the jmp later
+  if (entry[target] != NULL)
+  {
+    Emit8(0xE9);
+    Emit32(entry[target] - (code + used + 4));
+    return;
+  }
+  pending[target].push_back(used);
+  Emit8(0xB8);
+  Emit32(target);
+  Emit8(0xC3);
+  return;
+}
+
+
+
+int NativeCache::Offset(const void* member) const
+{
+  return (const char*)member - (const char*)machine.regs;
+}
+
+
+
+unsigned char* NativeCache::Translate(unsigned int start)
+{
+  //a block ends after a branch or jump, or before anything only the
+  //interpreter runs
+  const unsigned int maxOps = 64;
+  std::vector<MicroOp>& program = machine.program;
+  unsigned int end = start;
+  while (end < machine.textWords && end - start < maxOps)
+  {
+    unsigned char kind = program[end].code;
+    if (!Translatable(kind))
+      break;
+    ++end;
+    if (Transfers(kind))
+      break;
+  }
+  unsigned int length = end - start;
+  if (length == 0 || code == NULL)
+    return NULL;
+
+  //room for the longest block, else start over
+  if (capacity - used < maxOps * 256 + 64)
+    Flush();
+
+  int executed = Offset(&machine.executed);
+  int hi = Offset(&machine.hi);
+  int lo = Offset(&machine.lo);
+  int faultAddress = Offset(&machine.faultAddress);
+  unsigned int memoryBytes = 4 * machine.memory.size();
+  std::vector<size_t> faults;                         //rel32 of jumps to a fault exit
+  std::vector<unsigned int> faultAt;                  //index of their micro-op
+  std::vector<size_t> writes;                         //rel32 of jumps to a text store exit
+  std::vector<unsigned int> writeAt;                  //index of their micro-op
+  std::vector<size_t> steps;                          //rel32 of jumps to an interpreter exit
+  std::vector<unsigned int> stepAt;                   //index of their micro-op
+  unsigned char* block = code + used;
+
+  //the whole block is counted on entry, early exits give back the rest
+  Emit8(0x48);
+  EmitModRM(0x81, 0, executed);
+  Emit32(length);
+
+  for (unsigned int i = start; i < end; ++i)
+  {
+    const MicroOp& op = program[i];
+    int rs = 4 * op.rs;
+    int rt = 4 * op.rt;
+    int rd = 4 * op.rd;
+    switch (op.code)
+    {
+      //eax = rs op rt
+      case OP_ADDU:
+      case OP_SUBU:
+      case OP_AND:
+      case OP_OR:
+      case OP_XOR:
+      case OP_NOR:
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(op.code == OP_ADDU ? 0x03 : op.code == OP_SUBU ? 0x2B
+                  : op.code == OP_AND ? 0x23 : op.code == OP_XOR ? 0x33 : 0x0B, 0, rt);
+        if (op.code == OP_NOR)
+        {
+          Emit8(0xF7); Emit8(0xD0);                   //not eax
+        }
+        EmitModRM(0x89, 0, rd);
+        break;
+
+      //overflow leaves the block for the interpreter to report; $zero is
+      //only a destination when nothing is stored
+      case OP_ADD:
+      case OP_SUB:
+      case OP_ADDI:
+        EmitModRM(0x8B, 0, rs);
+        if (op.code == OP_ADDI)
+        {
+          Emit8(0x05);
+          Emit32(op.imm);
+        }
+        else
+          EmitModRM(op.code == OP_ADD ? 0x03 : 0x2B, 0, rt);
+        Emit8(0x0F); Emit8(0x80);                     //jo
+        steps.push_back(used);
+        stepAt.push_back(i);
+        Emit32(0);
+        if ((op.code == OP_ADDI ? op.rt : op.rd) != 0)
+          EmitModRM(0x89, 0, op.code == OP_ADDI ? rt : rd);
+        break;
+      case OP_MOVZ:
+      case OP_MOVN:
+        EmitModRM(0x8B, 1, rt);
+        EmitModRM(0x8B, 0, rd);
+        Emit8(0x85); Emit8(0xC9);                     //test ecx, ecx
+        Emit8(0x0F);
+        EmitModRM(op.code == OP_MOVZ ? 0x44 : 0x45, 0, rs);  //cmovz or cmovnz eax, [rs]
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_SLT:
+      case OP_SLTU:
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0x3B, 0, rt);
+        Emit8(0x0F); Emit8(op.code == OP_SLT ? 0x9C : 0x92); Emit8(0xC1);  //setl or setb cl
+        Emit8(0x0F); Emit8(0xB6); Emit8(0xC1);        //movzx eax, cl
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_ADDIU:
+      case OP_ANDI:
+      case OP_ORI:
+      case OP_XORI:
+        EmitModRM(0x8B, 0, rs);
+        Emit8(op.code == OP_ADDIU ? 0x05 : op.code == OP_ANDI ? 0x25
+              : op.code == OP_ORI ? 0x0D : 0x35);     //op eax, imm32
+        Emit32(op.imm);
+        EmitModRM(0x89, 0, rt);
+        break;
+      case OP_SLTI:
+      case OP_SLTIU:
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0x3D);                                  //cmp eax, imm32
+        Emit32(op.imm);
+        Emit8(0x0F); Emit8(op.code == OP_SLTI ? 0x9C : 0x92); Emit8(0xC1);
+        Emit8(0x0F); Emit8(0xB6); Emit8(0xC1);
+        EmitModRM(0x89, 0, rt);
+        break;
+
+      //eax = rt shifted by sa, or by rs in cl; x86 masks counts to 5 bits
+      //as MIPS does
+      case OP_SLL:
+      case OP_SRL:
+      case OP_SRA:
+        EmitModRM(0x8B, 0, rt);
+        Emit8(0xC1);
+        Emit8(op.code == OP_SLL ? 0xE0 : op.code == OP_SRL ? 0xE8 : 0xF8);
+        Emit8(op.imm);
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_SLLV:
+      case OP_SRLV:
+      case OP_SRAV:
+        EmitModRM(0x8B, 1, rs);
+        EmitModRM(0x8B, 0, rt);
+        Emit8(0xD3);
+        Emit8(op.code == OP_SLLV ? 0xE0 : op.code == OP_SRLV ? 0xE8 : 0xF8);
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_MFHI:
+      case OP_MFLO:
+        EmitModRM(0x8B, 0, op.code == OP_MFHI ? hi : lo);
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_MTHI:
+      case OP_MTLO:
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0x89, 0, op.code == OP_MTHI ? hi : lo);
+        break;
+      case OP_MULT:
+      case OP_MULTU:
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0xF7, op.code == OP_MULT ? 5 : 4, rt);  //imul or mul, edx:eax
+        EmitModRM(0x89, 0, lo);
+        EmitModRM(0x89, 2, hi);
+        break;
+      case OP_MUL:
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0x0F);
+        EmitModRM(0xAF, 0, rt);                       //imul eax, [rt]
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_MADD:
+      case OP_MADDU:
+      case OP_MSUB:
+      case OP_MSUBU:
+      {
+        //64 bit product added to or taken from hi:lo with the carry
+        bool isSigned = op.code == OP_MADD || op.code == OP_MSUB;
+        bool add = op.code == OP_MADD || op.code == OP_MADDU;
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0xF7, isSigned ? 5 : 4, rt);
+        EmitModRM(add ? 0x01 : 0x29, 0, lo);          //add or sub [lo], eax
+        EmitModRM(add ? 0x11 : 0x19, 2, hi);          //adc or sbb [hi], edx
+        break;
+      }
+      case OP_CLZ:
+      case OP_CLO:
+        //32 for a zero source, else 31 - bsr
+        EmitModRM(0x8B, 1, rs);
+        if (op.code == OP_CLO)
+        {
+          Emit8(0xF7); Emit8(0xD1);                   //not ecx
+        }
+        Emit8(0xB8); Emit32(32);                      //mov eax, 32
+        Emit8(0x85); Emit8(0xC9);                     //test ecx, ecx
+        Emit8(0x74); Emit8(10);                       //jz over the next three
+        Emit8(0x0F); Emit8(0xBD); Emit8(0xC9);        //bsr ecx, ecx
+        Emit8(0xB8); Emit32(31);                      //mov eax, 31
+        Emit8(0x29); Emit8(0xC8);                     //sub eax, ecx
+        EmitModRM(0x89, 0, rd);
+        break;
+      case OP_DIVU:
+      {
+        //rt 0 leaves hi and lo
+        EmitModRM(0x8B, 1, rt);
+        Emit8(0x85); Emit8(0xC9);                     //test ecx, ecx
+        Emit8(0x74);
+        size_t skipZero = used;
+        Emit8(0);
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0x31); Emit8(0xD2);                     //xor edx, edx
+        Emit8(0xF7); Emit8(0xF1);                     //div ecx
+        EmitModRM(0x89, 0, lo);
+        EmitModRM(0x89, 2, hi);
+        code[skipZero] = used - (skipZero + 1);
+        break;
+      }
+      case OP_DIV:
+      {
+        //rt 0 leaves hi and lo, rt -1 negates without idiv's overflow trap
+        EmitModRM(0x8B, 1, rt);
+        Emit8(0x85); Emit8(0xC9);                     //test ecx, ecx
+        Emit8(0x74);
+        size_t skipZero = used;
+        Emit8(0);
+        Emit8(0x83); Emit8(0xF9); Emit8(0xFF);        //cmp ecx, -1
+        Emit8(0x74);
+        size_t toNegate = used;
+        Emit8(0);
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0x99);                                  //cdq
+        Emit8(0xF7); Emit8(0xF9);                     //idiv ecx
+        EmitModRM(0x89, 0, lo);
+        EmitModRM(0x89, 2, hi);
+        Emit8(0xEB);
+        size_t skipNegate = used;
+        Emit8(0);
+        code[toNegate] = used - (toNegate + 1);
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0xF7); Emit8(0xD8);                     //neg eax
+        EmitModRM(0x89, 0, lo);
+        EmitModRM(0xC7, 0, hi);
+        Emit32(0);
+        code[skipZero] = used - (skipZero + 1);
+        code[skipNegate] = used - (skipNegate + 1);
+        break;
+      }
+      //memory holds big endian MIPS words in host order, so byte address
+      //a is host byte a ^ 3 and the halfword at a is host halfword a ^ 2
+      case OP_LW:
+      case OP_SW:
+      case OP_SC:
+      case OP_LB:
+      case OP_LBU:
+      case OP_LH:
+      case OP_LHU:
+      case OP_SB:
+      case OP_SH:
+      case OP_LWL:
+      case OP_LWR:
+      case OP_SWL:
+      case OP_SWR:
+      {
+        //eax = address, checked for alignment and range
+        unsigned int align = op.code == OP_LW || op.code == OP_SW || op.code == OP_SC ? 3
+                             : op.code == OP_LH || op.code == OP_LHU || op.code == OP_SH ? 1 : 0;
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0x05);
+        Emit32(op.imm);
+        if (align != 0)
+        {
+          Emit8(0xA8); Emit8(align);                  //test al, align
+          Emit8(0x0F); Emit8(0x85);
+          faults.push_back(used);
+          faultAt.push_back(i);
+          Emit32(0);
+        }
+        Emit8(0x3D);                                  //cmp eax, memoryBytes
+        Emit32(memoryBytes);
+        Emit8(0x0F); Emit8(0x83);
+        faults.push_back(used);
+        faultAt.push_back(i);
+        Emit32(0);
+
+        //lwl, lwr, swl and swr: cl = bits to shift by, eax = word address
+        if (op.code == OP_LWL || op.code == OP_LWR || op.code == OP_SWL || op.code == OP_SWR)
+        {
+          bool left = op.code == OP_LWL || op.code == OP_SWL;
+          if (op.code == OP_SWL || op.code == OP_SWR)
+          {
+            Emit8(0x41); Emit8(0x89); Emit8(0xC0);    //mov r8d, eax
+          }
+          Emit8(0x89); Emit8(0xC1);                   //mov ecx, eax
+          Emit8(0x83); Emit8(0xE1); Emit8(3);         //and ecx, 3
+          Emit8(0xC1); Emit8(0xE1); Emit8(3);         //shl ecx, 3
+          if (!left)
+          {
+            Emit8(0xF7); Emit8(0xD9);                 //neg ecx
+            Emit8(0x83); Emit8(0xC1); Emit8(24);      //add ecx, 24
+          }
+          Emit8(0x83); Emit8(0xE0); Emit8(0xFC);      //and eax, -4
+        }
+        switch (op.code)
+        {
+          case OP_LW:
+            Emit8(0x8B); Emit8(0x04); Emit8(0x06);    //mov eax, [rsi + rax]
+            break;
+          case OP_LB:
+          case OP_LBU:
+          case OP_LH:
+          case OP_LHU:
+          {
+            bool isByte = op.code == OP_LB || op.code == OP_LBU;
+            bool isSigned = op.code == OP_LB || op.code == OP_LH;
+            Emit8(0x83); Emit8(0xF0); Emit8(isByte ? 3 : 2);  //xor eax, lane
+            Emit8(0x0F);
+            Emit8(isByte ? (isSigned ? 0xBE : 0xB6) : (isSigned ? 0xBF : 0xB7));
+            Emit8(0x04); Emit8(0x06);                 //movsx or movzx eax, [rsi + rax]
+            break;
+          }
+
+          //lwl: word << cl | rt & (1 << cl) - 1, lwr: word >> cl | rt & ~(-1 >> cl)
+          case OP_LWL:
+          case OP_LWR:
+            Emit8(0x8B); Emit8(0x14); Emit8(0x06);    //mov edx, [rsi + rax]
+            Emit8(0xD3); Emit8(op.code == OP_LWL ? 0xE2 : 0xEA);  //shl or shr edx, cl
+            if (op.code == OP_LWL)
+            {
+              Emit8(0xB8); Emit32(1);                 //mov eax, 1
+              Emit8(0xD3); Emit8(0xE0);               //shl eax, cl
+              Emit8(0xFF); Emit8(0xC8);               //dec eax
+            }
+            else
+            {
+              Emit8(0xB8); Emit32(0xffffffffu);       //mov eax, -1
+              Emit8(0xD3); Emit8(0xE8);               //shr eax, cl
+              Emit8(0xF7); Emit8(0xD0);               //not eax
+            }
+            EmitModRM(0x23, 0, rt);                   //and eax, [rt]
+            Emit8(0x09); Emit8(0xD0);                 //or eax, edx
+            break;
+          case OP_SW:
+          case OP_SC:
+            EmitModRM(0x8B, 1, rt);
+            Emit8(0x89); Emit8(0x0C); Emit8(0x06);    //mov [rsi + rax], ecx
+            if (op.code == OP_SC && op.rt != 0)
+            {
+              EmitModRM(0xC7, 0, rt);                 //every sc succeeds
+              Emit32(1);
+            }
+            break;
+          case OP_SB:
+          case OP_SH:
+          {
+            unsigned int lane = op.code == OP_SB ? 3 : 2;
+            EmitModRM(0x8B, 1, rt);
+            Emit8(0x83); Emit8(0xF0); Emit8(lane);    //xor eax, lane
+            if (op.code == OP_SH)
+              Emit8(0x66);
+            Emit8(op.code == OP_SB ? 0x88 : 0x89);
+            Emit8(0x0C); Emit8(0x06);                 //mov [rsi + rax], cl or cx
+            Emit8(0x83); Emit8(0xF0); Emit8(lane);    //xor eax, lane
+            break;
+          }
+
+          //swl: word & ~(-1 >> cl) | rt >> cl, swr: word & ~(-1 << cl) | rt << cl;
+          //r8d keeps the address for the text check
+          default:
+            EmitModRM(0x8B, 2, rt);
+            Emit8(0xD3); Emit8(op.code == OP_SWL ? 0xEA : 0xE2);  //shr or shl edx, cl
+            Emit8(0x41); Emit8(0xB9); Emit32(0xffffffffu);      //mov r9d, -1
+            Emit8(0x41); Emit8(0xD3); Emit8(op.code == OP_SWL ? 0xE9 : 0xE1);
+            Emit8(0x41); Emit8(0xF7); Emit8(0xD1);    //not r9d
+            Emit8(0x44); Emit8(0x23); Emit8(0x0C); Emit8(0x06);  //and r9d, [rsi + rax]
+            Emit8(0x44); Emit8(0x09); Emit8(0xCA);    //or edx, r9d
+            Emit8(0x89); Emit8(0x14); Emit8(0x06);    //mov [rsi + rax], edx
+            Emit8(0x44); Emit8(0x89); Emit8(0xC0);    //mov eax, r8d
+            break;
+        }
+        if (op.code == OP_LW || (op.code >= OP_LB && op.code <= OP_LWR))
+        {
+          EmitModRM(0x89, 0, rt);
+          break;
+        }
+        if (machine.textWords > 0)
+        {
+          Emit8(0x3D);                                //cmp eax, text bytes
+          Emit32(4 * machine.textWords);
+          Emit8(0x0F); Emit8(0x82);
+          writes.push_back(used);
+          writeAt.push_back(i);
+          Emit32(0);
+        }
+        break;
+      }
+      case OP_BEQ:
+      case OP_BNE:
+      {
+        //not taken jumps over the taken exit
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0x3B, 0, rt);
+        Emit8(0x0F);
+        Emit8(op.code == OP_BEQ ? 0x85 : 0x84);
+        size_t over = used;
+        Emit32(0);
+        EmitExit(op.imm);
+        unsigned int rel = used - (over + 4);
+        for (int b = 0; b < 4; ++b)
+          code[over + b] = rel >> (8 * b);
+        break;
+      }
+      case OP_BLEZ:
+      case OP_BGTZ:
+      case OP_BLTZ:
+      case OP_BGEZ:
+      {
+        //cmp rs, 0, then jump over the taken exit on the opposite test
+        static const unsigned char notTaken[] = { 0x8F, 0x8E, 0x8D, 0x8C };  //jg jle jge jl
+        EmitModRM(0x83, 7, rs);
+        Emit8(0);
+        Emit8(0x0F);
+        Emit8(notTaken[op.code - OP_BLEZ]);
+        size_t over = used;
+        Emit32(0);
+        EmitExit(op.imm);
+        unsigned int rel = used - (over + 4);
+        for (int b = 0; b < 4; ++b)
+          code[over + b] = rel >> (8 * b);
+        break;
+      }
+      case OP_BLTZAL:
+      case OP_BGEZAL:
+      {
+        //rs is read before $ra is written, it may be $ra
+        EmitModRM(0x8B, 0, rs);
+        EmitModRM(0xC7, 0, 4 * 31);
+        Emit32(4 * (i + 1));
+        Emit8(0x85); Emit8(0xC0);                     //test eax, eax
+        Emit8(0x0F);
+        Emit8(op.code == OP_BLTZAL ? 0x8D : 0x8C);    //jge or jl over the taken exit
+        size_t over = used;
+        Emit32(0);
+        EmitExit(op.imm);
+        unsigned int rel = used - (over + 4);
+        for (int b = 0; b < 4; ++b)
+          code[over + b] = rel >> (8 * b);
+        break;
+      }
+      case OP_JR:
+      case OP_JALR:
+      {
+        //the target's block is looked up in entry and jumped to; an
+        //untranslated target returns its index
+        EmitModRM(0x8B, 0, rs);
+        Emit8(0xA8); Emit8(3);                        //test al, 3
+        Emit8(0x0F); Emit8(0x85);
+        faults.push_back(used);
+        faultAt.push_back(i);
+        Emit32(0);
+        if (op.code == OP_JALR && op.rd != 0)
+        {
+          EmitModRM(0xC7, 0, rd);
+          Emit32(4 * (i + 1));
+        }
+        Emit8(0xC1); Emit8(0xE8); Emit8(2);           //shr eax, 2
+        Emit8(0x3D); Emit32(machine.textWords);       //cmp eax, textWords
+        Emit8(0x76); Emit8(5);                        //jbe over the mov
+        Emit8(0xB8); Emit32(machine.textWords);       //mov eax, textWords
+        unsigned long long table = (unsigned long long)entry.data();
+        Emit8(0x48); Emit8(0xBA);                     //mov rdx, entry
+        Emit32(table);
+        Emit32(table >> 32);
+        Emit8(0x48); Emit8(0x8B); Emit8(0x14); Emit8(0xC2);  //mov rdx, [rdx + rax * 8]
+        Emit8(0x48); Emit8(0x85); Emit8(0xD2);        //test rdx, rdx
+        Emit8(0x74); Emit8(2);                        //jz over the jmp
+        Emit8(0xFF); Emit8(0xE2);                     //jmp rdx
+        Emit8(0xC3);                                  //ret
+        break;
+      }
+      case OP_JAL:
+        EmitModRM(0xC7, 0, 4 * 31);
+        Emit32(4 * (i + 1));
+        EmitExit(op.imm);
+        break;
+      case OP_J:
+        EmitExit(op.imm);
+        break;
+      default:
+        break;
+    }
+  }
+  unsigned char last = program[end - 1].code;
+  if (last != OP_J && last != OP_JAL && last != OP_JR && last != OP_JALR)
+    EmitExit(end);
+
+  //out of line exits: store the address, give back the micro-ops not run
+  //and return the flagged index
+  static const unsigned int flags[] = { 0x80000000u, 0x40000000u, 0x20000000u };
+  for (int kind = 0; kind < 3; ++kind)
+  {
+    std::vector<size_t>& jumps = kind == 0 ? faults : kind == 1 ? writes : steps;
+    std::vector<unsigned int>& at = kind == 0 ? faultAt : kind == 1 ? writeAt : stepAt;
+    for (size_t k = 0; k < jumps.size(); ++k)
+    {
+      unsigned int rel = used - (jumps[k] + 4);
+      for (int b = 0; b < 4; ++b)
+        code[jumps[k] + b] = rel >> (8 * b);
+      unsigned int notRun = kind == 1 ? end - at[k] - 1 : end - at[k];
+      if (kind != 2)
+        EmitModRM(0x89, 0, faultAddress);
+      if (notRun > 0)
+      {
+        Emit8(0x48);
+        EmitModRM(0x81, 5, executed);
+        Emit32(notRun);
+      }
+      Emit8(0xB8);
+      Emit32(flags[kind] | (kind == 1 ? at[k] + 1 : at[k]));
+      Emit8(0xC3);
+    }
+  }
+
+  //chain every exit that was waiting for this block
+  entry[start] = block;
+  ++blocks;
+  for (size_t k = 0; k < pending[start].size(); ++k)
+  {
+    size_t site = pending[start][k];
+    unsigned int rel = block - (code + site + 5);
+    code[site] = 0xE9;
+    for (int b = 0; b < 4; ++b)
+      code[site + 1 + b] = rel >> (8 * b);
+  }
+  pending[start].clear();
+  return block;
+}
+
+
+
+/*********************************************
+ *             Non-member Methods            *
+ *********************************************/
+
+StopReason RunNative(NativeCache& cache, std::istream& in, std::ostream& out)
+{
+  Machine& machine = cache.machine;
+  if (cache.code == NULL && !cache.Open(nativeCacheBytes))
+    return machine.Run(in, out);
+
+  typedef unsigned int (*NativeBlock)(int*, unsigned int*);
+  StopReason stop = STOP_END;
+  for (;;)
+  {
+    //blocks are interpreted until they are hot; hotRuns + 1 marks a
+    //block that cannot be translated
+    unsigned int pc = machine.pc > machine.textWords ? machine.textWords : machine.pc;
+    unsigned char* native = cache.entry[pc];
+    if (native == NULL && cache.runs[pc] < hotRuns)
+      ++cache.runs[pc];
+    else if (native == NULL && cache.runs[pc] == hotRuns)
+    {
+      native = cache.Translate(pc);
+      if (native == NULL)
+        cache.runs[pc] = hotRuns + 1;
+    }
+
+    if (native == NULL)
+    {
+      //interpret to the end of this block, or into translated code
+      for (;;)
+      {
+        unsigned char kind = machine.program[machine.pc > machine.textWords
+                                             ? machine.textWords : machine.pc].code;
+        if (!machine.Step(in, out, stop))
+          return stop;
+        if (machine.textWritten)
+        {
+          machine.textWritten = false;
+          cache.Flush();
+        }
+        if (Transfers(kind) || kind == OP_SYSCALL || cache.entry[machine.pc] != NULL)
+          break;
+      }
+      continue;
+    }
+
+    unsigned int next = ((NativeBlock)native)(machine.regs, machine.memory.data());
+    if (next & 0x80000000u)
+    {
+      machine.pc = next & 0x7fffffff;
+      machine.BadAddress(machine.faultAddress);
+      return STOP_FAULT;
+    }
+    if (next & 0x20000000u)
+    {
+      //the interpreter runs the micro-op again and reports its fault
+      machine.pc = next & 0x1fffffff;
+      if (!machine.Step(in, out, stop))
+        return stop;
+      continue;
+    }
+    if (next & 0x40000000u)
+    {
+      //the stored word is decoded again and every block retranslated
+      unsigned int index = machine.faultAddress / 4;
+      machine.program[index] = machine.Decode(machine.memory[index], index);
+      cache.Flush();
+      next &= 0x3fffffff;
+    }
+    machine.pc = next;
+  }
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file   native.h
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  x86-64 translation of MIPS basic blocks
+ *
+ * @description
+ * Blocks of a Machine's text that run often are translated
+ * to x86-64 code in an executable cache and chained to each
+ * other; the rest, and any host without the cache, runs on
+ * the Machine's interpreter.
+ *****************************************************/
+
+#ifndef native_H
+#define native_H
+
+#include "simulator.h"
+#include <istream>
+#include <ostream>
+#include <vector>
+
+
+/******************************************
+ *           NativeCache Class            *
+ ******************************************/
+
+//translated blocks of one Machine, keyed by the index of their first
+//micro-op; block exits that are not yet chained hold "mov eax, next; ret"
+//and are patched into a jmp once next is translated
+struct NativeCache
+{
+  Machine&                  machine;                  //program being run
+  unsigned char*            code = NULL;              //executable region, NULL if none
+  size_t                    capacity = 0;             //bytes of region
+  size_t                    used = 0;                 //bytes emitted
+  std::vector<unsigned char*> entry;                  //code of block at index, NULL if none
+  std::vector< std::vector<size_t> > pending;         //unchained exits to index
+  std::vector<unsigned short> runs;                   //interpreted entries of index
+  unsigned long long        blocks = 0;               //blocks translated
+  unsigned long long        flushes = 0;              //times cache was emptied
+
+  NativeCache(Machine&);                              //empty cache for machine
+  NativeCache(const NativeCache&) = delete;
+  NativeCache& operator=(const NativeCache&) = delete;
+  ~NativeCache();                                     //unmaps region
+  bool Open(size_t);                                  //map region, false if not allowed
+  void Flush();                                       //drop every block
+  unsigned char* Translate(unsigned int);             //translate block at index
+
+  void Emit8(unsigned int);                           //append one byte
+  void Emit32(unsigned int);                          //append little endian word
+  void EmitModRM(unsigned int, unsigned int, int);    //opcode, reg field, [rdi + disp]
+  void EmitExit(unsigned int);                        //leave block for index
+  int Offset(const void*) const;                      //displacement of member from regs
+};
+
+//blocks entered this often by the interpreter are translated
+const unsigned int hotRuns = 8;
+
+//bytes of executable memory; a full cache is emptied and refilled
+const size_t nativeCacheBytes = 16 << 20;
+
+//run cache's machine with hot blocks translated to x86-64; on other
+//hosts, or where no executable memory can be mapped, Machine::Run is
+//used instead
+StopReason RunNative(NativeCache&, std::istream&, std::ostream&);
+
+#endif
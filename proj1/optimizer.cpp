@@ -0,0 +1,1058 @@
+/**
+ * @file   optimizer.cpp
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Peephole and scheduling pass for the assembler
+ *
+ * @description
+ * Passes behind optimizer.h. Every rewrite keeps the
+ * register and memory state at each surviving command
+ * what it was, so facts found on the input stay true
+ * while later passes run.
+ *****************************************************/
+
+#ifndef optimizer_CPP
+#define optimizer_CPP
+
+#include "optimizer.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+
+/********************************************
+ *            Instruction Indices           *
+ ********************************************/
+
+//instrTable rows of the instructions the pass models
+static const int opAddu    = Command::FindInstr("addu");
+static const int opAnd     = Command::FindInstr("and");
+static const int opDiv     = Command::FindInstr("div");
+static const int opMfhi    = Command::FindInstr("mfhi");
+static const int opMflo    = Command::FindInstr("mflo");
+static const int opMult    = Command::FindInstr("mult");
+static const int opOr      = Command::FindInstr("or");
+static const int opSlt     = Command::FindInstr("slt");
+static const int opSubu    = Command::FindInstr("subu");
+static const int opSyscall = Command::FindInstr("syscall");
+static const int opAddiu   = Command::FindInstr("addiu");
+static const int opBeq     = Command::FindInstr("beq");
+static const int opBne     = Command::FindInstr("bne");
+static const int opLw      = Command::FindInstr("lw");
+static const int opSw      = Command::FindInstr("sw");
+static const int opJ       = Command::FindInstr("j");
+static const int opXor     = Command::FindInstr("xor");
+static const int opNor     = Command::FindInstr("nor");
+static const int opSltu    = Command::FindInstr("sltu");
+static const int opSllv    = Command::FindInstr("sllv");
+static const int opSrlv    = Command::FindInstr("srlv");
+static const int opSrav    = Command::FindInstr("srav");
+static const int opSll     = Command::FindInstr("sll");
+static const int opSrl     = Command::FindInstr("srl");
+static const int opSra     = Command::FindInstr("sra");
+static const int opLui     = Command::FindInstr("lui");
+static const int opAndi    = Command::FindInstr("andi");
+static const int opOri     = Command::FindInstr("ori");
+static const int opXori    = Command::FindInstr("xori");
+static const int opSlti    = Command::FindInstr("slti");
+static const int opSltiu   = Command::FindInstr("sltiu");
+static const int opMultu   = Command::FindInstr("multu");
+static const int opDivu    = Command::FindInstr("divu");
+static const int opBlez    = Command::FindInstr("blez");
+static const int opBgtz    = Command::FindInstr("bgtz");
+static const int opBltz    = Command::FindInstr("bltz");
+static const int opBgez    = Command::FindInstr("bgez");
+static const int opBltzal  = Command::FindInstr("bltzal");
+static const int opBgezal  = Command::FindInstr("bgezal");
+static const int opJal     = Command::FindInstr("jal");
+static const int opJr      = Command::FindInstr("jr");
+static const int opJalr    = Command::FindInstr("jalr");
+
+//resources beyond the 32 registers in Uses and Defs masks
+const unsigned long long useHi      = 1ULL << 32;
+const unsigned long long useLo      = 1ULL << 33;
+const unsigned long long useMemory  = 1ULL << 34;
+const unsigned long long useConsole = 1ULL << 35;
+
+//facts kept per state; straight-line code touching many words forgets the oldest
+const size_t maxLoadFacts = 64;
+
+//commands one scheduling window may hold
+const int scheduleWindow = 32;
+
+//value of a 16 bit field as the machine sign extends it
+static int Imm16(int imm)
+{
+  return (short)(imm & 0xffff);
+}
+
+//true if value survives a trip through a 16 bit immediate
+static bool Fits16(unsigned int value)
+{
+  return (int)value >= -32768 && (int)value <= 32767;
+}
+
+//result of an OPT_ALU command from its rs and rt values
+static unsigned int Evaluate(int instr, unsigned int a, unsigned int b)
+{
+  if (instr == opAddu)
+    return a + b;
+  if (instr == opSubu)
+    return a - b;
+  if (instr == opAnd)
+    return a & b;
+  if (instr == opOr)
+    return a | b;
+  if (instr == opXor)
+    return a ^ b;
+  if (instr == opNor)
+    return ~(a | b);
+  if (instr == opSltu)
+    return a < b;
+  if (instr == opSllv)
+    return b << (a & 31);
+  if (instr == opSrlv)
+    return b >> (a & 31);
+  if (instr == opSrav)
+    return (unsigned int)((int)b >> (a & 31));
+  return (int)a < (int)b;
+}
+
+//true for a command whose label operand is a word index that moves when
+//the text is compacted; %hi and %lo take data labels too
+static bool HasTarget(const Command& command)
+{
+  char role = command.GetLabelRole();
+  return role == 'b' || role == 'j' || role == 'u' || role == 'l';
+}
+
+
+
+/*********************************************
+ *           PipelineEstimate Methods        *
+ *********************************************/
+
+long long PipelineEstimate::Cycles() const
+{
+  return instructions + loadUseStalls + jumpBubbles;
+}
+
+
+
+/*********************************************
+ *            OptimizeReport Methods         *
+ *********************************************/
+
+std::string OptimizeReport::Summary() const
+{
+  long long was = before.Cycles();
+  long long now = after.Cycles();
+  char percent[32];
+  std::snprintf(percent, sizeof(percent), "%.1f", was > 0 ? 100.0 * (was - now) / was : 0.0);
+  return "Optimized: " + std::to_string(loadsRemoved) + " loads removed, "
+         + std::to_string(loadsBypassed) + " bypassed, "
+         + std::to_string(constantsFolded) + " constants folded, "
+         + std::to_string(chainsMerged) + " addiu chains merged, "
+         + std::to_string(branchesThreaded) + " branches threaded, "
+         + std::to_string(blocksScheduled) + " blocks scheduled, "
+         + std::to_string(removed) + " instructions removed; estimated cycles "
+         + std::to_string(was) + " -> " + std::to_string(now) + ", "
+         + std::to_string(was - now) + " saved (" + percent + "%).";
+}
+
+
+
+/*********************************************
+ *             ValueState Methods            *
+ *********************************************/
+
+bool ValueState::Meet(const ValueState& other)
+{
+  if (other.top)
+    return false;
+  if (top)
+  {
+    *this = other;
+    return true;
+  }
+
+  bool changed = false;
+  for (int r = 1; r < 32; ++r)
+  {
+    bool same = ((other.known >> r) & 1) && other.value[r] == value[r];
+    if (((known >> r) & 1) && !same)
+    {
+      known &= ~(1u << r);
+      changed = true;
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < loads.size(); ++i)
+  {
+    bool shared = false;
+    for (size_t j = 0; j < other.loads.size() && !shared; ++j)
+      shared = other.loads[j].reg == loads[i].reg && other.loads[j].base == loads[i].base
+               && other.loads[j].offset == loads[i].offset;
+    if (shared)
+      loads[kept++] = loads[i];
+  }
+  changed |= kept != loads.size();
+  loads.resize(kept);
+  return changed;
+}
+
+
+
+void ValueState::Define(int reg, bool isKnown, unsigned int newValue)
+{
+  //writes to $zero are dropped by the machine
+  if (reg == 0)
+    return;
+  if (isKnown)
+  {
+    known |= 1u << reg;
+    value[reg] = newValue;
+  }
+  else
+    known &= ~(1u << reg);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < loads.size(); ++i)
+  {
+    if (loads[i].reg != reg && loads[i].base != reg)
+      loads[kept++] = loads[i];
+  }
+  loads.resize(kept);
+  return;
+}
+
+
+
+int ValueState::Holder(int base, int offset) const
+{
+  for (size_t i = 0; i < loads.size(); ++i)
+  {
+    if (loads[i].base == base && loads[i].offset == offset)
+      return loads[i].reg;
+  }
+  return -1;
+}
+
+
+
+/*********************************************
+ *             Optimizer Methods             *
+ *********************************************/
+
+Optimizer::Optimizer(Chunk& program, OptimizeReport& report) : program(program), report(report),
+                                                               cmdList(program.cmdList),
+                                                               textWords(program.cmdList.size()),
+                                                               kind(textWords), deleted(textWords, 0)
+{
+  for (int i = 0; i < textWords; ++i)
+    kind[i] = Classify(cmdList[i]);
+}
+
+
+
+void Optimizer::FindBlocks()
+{
+  //blocks start at the entry, at labels, at targets and after transfers
+  leader.assign(textWords + 1, 0);
+  leader[0] = 1;
+  for (size_t i = 0; i < program.lblList.size(); ++i)
+  {
+    const Label& label = program.lblList[i];
+    if (label.type == 't' && label.lineNum >= 0 && label.lineNum <= textWords)
+      leader[label.lineNum] = 1;
+  }
+  for (int i = 0; i < textWords; ++i)
+  {
+    if (deleted[i])
+      continue;
+    bool transfer = kind[i] == OPT_BRANCH || kind[i] == OPT_JUMP || kind[i] == OPT_TRANSFER;
+    int target = cmdList[i].imm;
+    if ((transfer || cmdList[i].half != 0) && HasTarget(cmdList[i]) && target >= 0
+        && target <= textWords)
+      leader[target] = 1;
+    if (transfer)
+      leader[i + 1] = 1;
+  }
+
+  blockStart.clear();
+  for (int i = 0; i < textWords; ++i)
+  {
+    if (leader[i])
+      blockStart.push_back(i);
+  }
+  return;
+}
+
+
+
+int Optimizer::NextLive(int index) const
+{
+  while (index < textWords && deleted[index])
+    ++index;
+  return index;
+}
+
+
+
+void Optimizer::ThreadBranches()
+{
+  for (int i = 0; i < textWords; ++i)
+  {
+    if (deleted[i] || (kind[i] != OPT_BRANCH && kind[i] != OPT_JUMP))
+      continue;
+    Command& command = cmdList[i];
+    if (command.imm < 0 || command.imm > textWords)
+      continue;
+
+    //a target that is itself a j goes straight to that j's target;
+    //the step limit stops on jump cycles
+    int target = command.imm;
+    int symbol = command.symbol;
+    for (int steps = 0; steps < 64; ++steps)
+    {
+      int next = NextLive(target);
+      if (next >= textWords || next == i || kind[next] != OPT_JUMP)
+        break;
+      int through = cmdList[next].imm;
+      if (through < 0 || through > textWords || through == target)
+        break;
+      target = through;
+      symbol = cmdList[next].symbol;
+    }
+    if (target != command.imm)
+    {
+      command.imm = target;
+      command.symbol = symbol;
+      ++report.branchesThreaded;
+    }
+
+    //going to the next word either way, the transfer does nothing
+    if (NextLive(target) == NextLive(i + 1))
+    {
+      deleted[i] = 1;
+      ++report.branchesThreaded;
+    }
+  }
+  return;
+}
+
+
+
+void Optimizer::Analyze()
+{
+  FindBlocks();
+  int blocks = blockStart.size();
+  std::vector<int> blockAt(textWords + 1, -1);
+  for (int b = 0; b < blocks; ++b)
+    blockAt[blockStart[b]] = b;
+
+  //execution starts at word 0 knowing only $zero, as do words a register
+  //jump may reach; blocks no path reaches stay top and are rewritten
+  //knowing nothing
+  entry.assign(blocks, ValueState());
+  if (blocks > 0)
+    entry[0].top = false;
+  for (int i = 0; i < textWords; ++i)
+  {
+    int target = cmdList[i].imm;
+    if (!deleted[i] && cmdList[i].half != 0 && target >= 0 && target < textWords)
+      entry[blockAt[target]].top = false;
+  }
+
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int b = 0; b < blocks; ++b)
+    {
+      if (entry[b].top)
+        continue;
+      ValueState state = entry[b];
+      int end = b + 1 < blocks ? blockStart[b + 1] : textWords;
+      int last = -1;
+      for (int i = blockStart[b]; i < end; ++i)
+      {
+        if (deleted[i])
+          continue;
+        Transfer(i, state, false);
+        last = i;
+      }
+
+      if (last >= 0 && (kind[last] == OPT_BRANCH || kind[last] == OPT_JUMP
+                        || kind[last] == OPT_TRANSFER) && HasTarget(cmdList[last]))
+      {
+        int target = cmdList[last].imm;
+        if (target >= 0 && target < textWords)
+          changed |= entry[blockAt[target]].Meet(state);
+      }
+      if ((last < 0 || kind[last] != OPT_JUMP) && b + 1 < blocks)
+        changed |= entry[b + 1].Meet(state);
+    }
+  }
+  return;
+}
+
+
+
+void Optimizer::Transfer(int index, ValueState& state, bool rewrite)
+{
+  Command& command = cmdList[index];
+  unsigned int* value = state.value;
+  switch (kind[index])
+  {
+    case OPT_ADDIU:
+    {
+      unsigned int imm = (unsigned int)Imm16(command.imm);
+      bool isKnown = (state.known >> command.rs) & 1;
+      unsigned int result = value[command.rs] + imm;
+      if (rewrite && command.rt != 0 && command.rt == command.rs && imm == 0)
+      {
+        deleted[index] = 1;
+        return;
+      }
+      if (rewrite && command.rt != 0 && command.rs != 0 && isKnown && Fits16(result))
+      {
+        command.rs = 0;
+        command.imm = (int)result;
+        ++report.constantsFolded;
+      }
+      state.Define(command.rt, isKnown, result);
+      return;
+    }
+
+    case OPT_ALU:
+    {
+      int instr = command.instr;
+      unsigned int a = value[command.rs];
+      unsigned int b = value[command.rt];
+      bool isKnown = ((state.known >> command.rs) & 1) && ((state.known >> command.rt) & 1);
+      unsigned int result = Evaluate(instr, a, b);
+
+      //a copy of a register onto itself does nothing
+      bool self = (command.rd == command.rs && command.rt == 0
+                   && (instr == opAddu || instr == opSubu || instr == opOr || instr == opXor))
+                  || (command.rd == command.rt && command.rs == 0
+                      && (instr == opAddu || instr == opOr || instr == opXor || instr == opSllv
+                          || instr == opSrlv || instr == opSrav));
+      if (rewrite && command.rd != 0 && self)
+      {
+        deleted[index] = 1;
+        return;
+      }
+      if (rewrite && command.rd != 0 && isKnown && (command.rs != 0 || command.rt != 0)
+          && Fits16(result))
+      {
+        command.instr = opAddiu;
+        command.rt = command.rd;
+        command.rs = 0;
+        command.rd = 0;
+        command.imm = (int)result;
+        kind[index] = OPT_ADDIU;
+        ++report.constantsFolded;
+        state.Define(command.rt, true, result);
+        return;
+      }
+      state.Define(command.rd, isKnown, result);
+      return;
+    }
+
+    case OPT_ALUI:
+    {
+      //%hi and %lo halves move with the text, so they stay unknown
+      int instr = command.instr;
+      unsigned int a = value[command.rs];
+      unsigned int imm = instr == opSlti || instr == opSltiu || instr == opAddiu
+                         ? (unsigned int)Imm16(command.imm) : command.imm & 0xffff;
+      bool isKnown = command.half == 0 && ((state.known >> command.rs) & 1);
+      unsigned int result = 0;
+      if (instr == opLui)
+        result = imm << 16;
+      else if (instr == opAndi)
+        result = a & imm;
+      else if (instr == opOri)
+        result = a | imm;
+      else if (instr == opXori)
+        result = a ^ imm;
+      else if (instr == opSlti)
+        result = (int)a < (int)imm;
+      else if (instr == opSltiu)
+        result = a < imm;
+      if (rewrite && command.rt != 0 && command.rs != 0 && isKnown && Fits16(result))
+      {
+        command.instr = opAddiu;
+        command.rs = 0;
+        command.imm = (int)result;
+        kind[index] = OPT_ADDIU;
+        ++report.constantsFolded;
+      }
+      state.Define(command.rt, isKnown, result);
+      return;
+    }
+
+    case OPT_SHIFT:
+    {
+      int instr = command.instr;
+      unsigned int b = value[command.rt];
+      bool isKnown = (state.known >> command.rt) & 1;
+      int amount = command.imm & 31;
+      unsigned int result = instr == opSll ? b << amount
+                            : instr == opSrl ? b >> amount : (unsigned int)((int)b >> amount);
+      if (rewrite && command.rd != 0 && command.rd == command.rt && amount == 0)
+      {
+        deleted[index] = 1;
+        return;
+      }
+      if (rewrite && command.rd != 0 && command.rt != 0 && isKnown && Fits16(result))
+      {
+        command.instr = opAddiu;
+        command.rt = command.rd;
+        command.rs = 0;
+        command.rd = 0;
+        command.imm = (int)result;
+        kind[index] = OPT_ADDIU;
+        ++report.constantsFolded;
+        state.Define(command.rt, true, result);
+        return;
+      }
+      state.Define(command.rd, isKnown, result);
+      return;
+    }
+
+    case OPT_MOVEHL:
+      state.Define(command.rd, false, 0);
+      return;
+
+    case OPT_LW:
+    {
+      //lw into $zero decodes as a no-op
+      int reg = command.rt;
+      int base = command.rs;
+      int offset = Imm16(command.imm);
+      if (reg == 0)
+        return;
+
+      //the word is already in a register: drop the load or copy it
+      int holder = state.Holder(base, offset);
+      bool isKnown = holder >= 0 && ((state.known >> holder) & 1);
+      unsigned int loaded = holder >= 0 ? value[holder] : 0;
+      if (rewrite && holder >= 0)
+      {
+        if (holder == reg)
+          deleted[index] = 1;
+        else
+        {
+          command.instr = opAddu;
+          command.rd = reg;
+          command.rs = holder;
+          command.rt = 0;
+          command.imm = 0;
+          command.symbol = -1;
+          kind[index] = OPT_ALU;
+        }
+        ++report.loadsRemoved;
+      }
+      state.Define(reg, isKnown, loaded);
+      if (reg != base)
+      {
+        if (state.loads.size() >= maxLoadFacts)
+          state.loads.erase(state.loads.begin());
+        state.loads.push_back(LoadFact{ (unsigned char)reg, (unsigned char)base, offset });
+      }
+      return;
+    }
+
+    case OPT_SW:
+    {
+      //words at other offsets from the same base cannot be the one stored,
+      //words through any other base might be
+      int offset = Imm16(command.imm);
+      size_t kept = 0;
+      for (size_t i = 0; i < state.loads.size(); ++i)
+      {
+        if (state.loads[i].base == command.rs && state.loads[i].offset != offset)
+          state.loads[kept++] = state.loads[i];
+      }
+      state.loads.resize(kept);
+      if (state.loads.size() >= maxLoadFacts)
+        state.loads.erase(state.loads.begin());
+      state.loads.push_back(LoadFact{ command.rt, command.rs, offset });
+      return;
+    }
+
+    case OPT_BRANCH:
+    case OPT_JUMP:
+    {
+      //a target that loads a word its register already holds on this
+      //edge is skipped, the load is only run by the other ways in
+      if (!rewrite || command.imm < 0 || command.imm >= textWords)
+        return;
+      int target = command.imm;
+      for (;;)
+      {
+        int next = NextLive(target);
+        if (next >= textWords || next == index || kind[next] != OPT_LW)
+          break;
+        const Command& load = cmdList[next];
+        if (load.rt == 0 || state.Holder(load.rs, Imm16(load.imm)) != load.rt)
+          break;
+        target = next + 1;
+      }
+      if (target != command.imm)
+      {
+        command.imm = target;
+        command.symbol = -1;
+        ++report.loadsBypassed;
+      }
+      return;
+    }
+
+    case OPT_SYSCALL:
+      //read int returns in $v0
+      state.Define(2, false, 0);
+      return;
+
+    case OPT_MULDIV:
+      return;
+
+    default:
+      state.known = 1;
+      state.loads.clear();
+      return;
+  }
+}
+
+
+
+void Optimizer::Rewrite()
+{
+  for (size_t b = 0; b < blockStart.size(); ++b)
+  {
+    ValueState state = entry[b];
+    if (state.top)
+      state = ValueState();
+    state.top = false;
+
+    int end = b + 1 < blockStart.size() ? blockStart[b + 1] : textWords;
+    for (int i = blockStart[b]; i < end; ++i)
+    {
+      if (!deleted[i])
+        Transfer(i, state, true);
+    }
+  }
+  return;
+}
+
+
+
+void Optimizer::MergeChains()
+{
+  FindBlocks();
+  for (int i = 0; i < textWords; ++i)
+  {
+    if (deleted[i] || kind[i] != OPT_ADDIU || cmdList[i].rt == 0)
+      continue;
+
+    //the next command in the block touching the result must add to it
+    //in place, and the first source may not change before then
+    Command& first = cmdList[i];
+    bool merged = true;
+    while (merged)
+    {
+      merged = false;
+      unsigned long long result = 1ULL << first.rt;
+      unsigned long long source = first.rs == first.rt ? 0 : 1ULL << first.rs;
+      for (int j = i + 1; j < textWords && !leader[j]; ++j)
+      {
+        if (deleted[j])
+          continue;
+        const Command& next = cmdList[j];
+        if (kind[j] == OPT_ADDIU && next.rs == first.rt && next.rt == first.rt)
+        {
+          unsigned int sum = (unsigned int)Imm16(first.imm) + (unsigned int)Imm16(next.imm);
+          if (Fits16(sum))
+          {
+            first.imm = (int)sum;
+            deleted[j] = 1;
+            ++report.chainsMerged;
+            merged = true;
+          }
+          break;
+        }
+        OptKind nextKind = (OptKind)kind[j];
+        if (((Uses(next, nextKind) | Defs(next, nextKind)) & result)
+            || (Defs(next, nextKind) & source))
+          break;
+      }
+    }
+  }
+  return;
+}
+
+
+
+void Optimizer::Schedule()
+{
+  FindBlocks();
+  std::vector<int> live;
+  std::vector<int> region;
+  for (size_t b = 0; b < blockStart.size(); ++b)
+  {
+    int end = b + 1 < blockStart.size() ? blockStart[b + 1] : textWords;
+    live.clear();
+    for (int i = blockStart[b]; i < end; ++i)
+    {
+      if (!deleted[i])
+        live.push_back(i);
+    }
+
+    //windows of movable commands; transfers, syscalls and unknown
+    //commands stay where they are and bound the windows
+    bool improved = false;
+    size_t at = 0;
+    while (at < live.size())
+    {
+      region.clear();
+      while (at < live.size() && region.size() < (size_t)scheduleWindow)
+      {
+        char k = kind[live[at]];
+        if (k == OPT_OTHER || k == OPT_SYSCALL || k == OPT_BRANCH || k == OPT_JUMP
+            || k == OPT_TRANSFER)
+          break;
+        region.push_back(live[at++]);
+      }
+      int follower = at < live.size() ? live[at] : -1;
+      if (region.empty())
+      {
+        ++at;
+        continue;
+      }
+      if (region.size() < 2)
+        continue;
+
+      int m = region.size();
+      std::vector<unsigned long long> uses(m);
+      std::vector<unsigned long long> defs(m);
+      for (int q = 0; q < m; ++q)
+      {
+        uses[q] = Uses(cmdList[region[q]], (OptKind)kind[region[q]]);
+        defs[q] = Defs(cmdList[region[q]], (OptKind)kind[region[q]]);
+      }
+      unsigned long long followerUses = follower < 0 ? 0
+                                        : Uses(cmdList[follower], (OptKind)kind[follower]);
+
+      //q must follow p if either writes what the other touches; memory
+      //operations keep their order
+      std::vector< std::vector<char> > after(m, std::vector<char>(m, 0));
+      for (int p = 0; p < m; ++p)
+      {
+        for (int q = p + 1; q < m; ++q)
+          after[q][p] = ((defs[p] & (uses[q] | defs[q])) | (uses[p] & defs[q])) != 0;
+      }
+
+      //longest latency path to the end of the window, loads take two
+      std::vector<int> height(m, 0);
+      for (int p = m - 1; p >= 0; --p)
+      {
+        int latency = kind[region[p]] == OPT_LW ? 2 : 1;
+        height[p] = latency;
+        for (int q = p + 1; q < m; ++q)
+        {
+          if (after[q][p])
+            height[p] = std::max(height[p], latency + height[q]);
+        }
+      }
+
+      //stalls of an order, counting the command after the window
+      auto stalls = [&](const std::vector<int>& order)
+      {
+        int count = 0;
+        for (int k = 0; k < m; ++k)
+        {
+          if (kind[region[order[k]]] != OPT_LW)
+            continue;
+          unsigned long long loaded = defs[order[k]] & 0xffffffffULL;
+          unsigned long long reader = k + 1 < m ? uses[order[k + 1]] : followerUses;
+          count += (loaded & reader) != 0;
+        }
+        return count;
+      };
+
+      //list scheduling: among ready commands, prefer one that does not
+      //wait on the load just placed, then the longest path, then source order
+      std::vector<int> order;
+      std::vector<char> placed(m, 0);
+      unsigned long long loaded = 0;
+      for (int step = 0; step < m; ++step)
+      {
+        int best = -1;
+        bool bestStalls = true;
+        for (int q = 0; q < m; ++q)
+        {
+          if (placed[q])
+            continue;
+          bool ready = true;
+          for (int p = 0; p < q && ready; ++p)
+            ready = placed[p] || !after[q][p];
+          if (!ready)
+            continue;
+          bool waits = (uses[q] & loaded) != 0;
+          if (best < 0 || (bestStalls && !waits) || (bestStalls == waits && height[q] > height[best]))
+          {
+            best = q;
+            bestStalls = waits;
+          }
+        }
+        order.push_back(best);
+        placed[best] = 1;
+        loaded = kind[region[best]] == OPT_LW ? defs[best] & 0xffffffffULL : 0;
+      }
+
+      std::vector<int> original(m);
+      for (int q = 0; q < m; ++q)
+        original[q] = q;
+      if (stalls(order) >= stalls(original))
+        continue;
+
+      std::vector<Command> moved(m, Command(0, 0));
+      std::vector<char> movedKind(m);
+      for (int k = 0; k < m; ++k)
+      {
+        moved[k] = cmdList[region[order[k]]];
+        movedKind[k] = kind[region[order[k]]];
+      }
+      for (int k = 0; k < m; ++k)
+      {
+        cmdList[region[k]] = moved[k];
+        kind[region[k]] = movedKind[k];
+      }
+      improved = true;
+    }
+    report.blocksScheduled += improved;
+  }
+  return;
+}
+
+
+
+void Optimizer::Compact()
+{
+  //a deleted word's index goes to the next surviving one
+  std::vector<int> newIndex(textWords + 1);
+  int kept = 0;
+  for (int i = 0; i <= textWords; ++i)
+  {
+    newIndex[i] = kept;
+    if (i < textWords && !deleted[i])
+      ++kept;
+  }
+  int removed = textWords - kept;
+  if (removed == 0)
+    return;
+
+  std::vector<Command> compacted;
+  compacted.reserve(kept);
+  for (int i = 0; i < textWords; ++i)
+  {
+    if (deleted[i])
+      continue;
+    Command command = cmdList[i];
+    command.lineNum = newIndex[i];
+    char role = command.GetLabelRole();
+    if ((role == 'b' || role == 'j') && command.imm >= 0 && command.imm <= textWords)
+      command.imm = newIndex[command.imm];
+    else if ((role == 'u' || role == 'l') && command.imm >= 0)
+      command.imm = command.imm <= textWords ? newIndex[command.imm] : command.imm - removed;
+    compacted.push_back(command);
+  }
+  cmdList.swap(compacted);
+
+  //text indices are renumbered, data just moves down
+  for (size_t i = 0; i < program.lblList.size(); ++i)
+  {
+    Label& label = program.lblList[i];
+    label.lineNum = label.type == 't' ? newIndex[label.lineNum] : label.lineNum - removed;
+  }
+  std::vector<Symbol>& symbols = program.symbols.symbols;
+  for (size_t i = 0; i < symbols.size(); ++i)
+  {
+    if (!symbols[i].defined)
+      continue;
+    int& lineNum = symbols[i].lineNum;
+    lineNum = lineNum <= textWords ? newIndex[lineNum] : lineNum - removed;
+  }
+  for (size_t i = 0; i < program.data.ranges.size(); ++i)
+    program.data.ranges[i].lineNum -= removed;
+  program.index -= removed;
+  report.removed += removed;
+  return;
+}
+
+
+
+/*********************************************
+ *             Function Definitions          *
+ *********************************************/
+
+OptKind Classify(const Command& command)
+{
+  //register operands that did not parse are left alone
+  int instr = command.instr;
+  if (instr < 0 || command.rs > 31 || command.rt > 31 || command.rd > 31)
+    return OPT_OTHER;
+
+  //only an address's own lui, addiu or ori is followed, as an unknown value
+  if (command.half != 0)
+    return instr == opLui || instr == opAddiu || instr == opOri ? OPT_ALUI : OPT_OTHER;
+  if (instr == opAddu || instr == opAnd || instr == opOr || instr == opSlt || instr == opSubu
+      || instr == opXor || instr == opNor || instr == opSltu || instr == opSllv
+      || instr == opSrlv || instr == opSrav)
+    return OPT_ALU;
+  if (instr == opAddiu)
+    return OPT_ADDIU;
+  if (instr == opLui || instr == opAndi || instr == opOri || instr == opXori || instr == opSlti
+      || instr == opSltiu)
+    return OPT_ALUI;
+  if (instr == opSll || instr == opSrl || instr == opSra)
+    return OPT_SHIFT;
+  if (instr == opMult || instr == opDiv || instr == opMultu || instr == opDivu)
+    return OPT_MULDIV;
+  if (instr == opMfhi || instr == opMflo)
+    return OPT_MOVEHL;
+  if (instr == opLw)
+    return OPT_LW;
+  if (instr == opSw)
+    return OPT_SW;
+  if (instr == opBeq || instr == opBne || instr == opBlez || instr == opBgtz || instr == opBltz
+      || instr == opBgez)
+    return OPT_BRANCH;
+  if (instr == opJ)
+    return OPT_JUMP;
+  if (instr == opJal || instr == opJr || instr == opJalr || instr == opBltzal
+      || instr == opBgezal)
+    return OPT_TRANSFER;
+  if (instr == opSyscall)
+    return OPT_SYSCALL;
+  return OPT_OTHER;
+}
+
+
+
+unsigned long long Uses(const Command& command, OptKind kind)
+{
+  unsigned long long rs = 1ULL << command.rs;
+  unsigned long long rt = 1ULL << command.rt;
+  switch (kind)
+  {
+    case OPT_ALU:     return rs | rt;
+    case OPT_ADDIU:   return rs;
+    case OPT_ALUI:    return rs;
+    case OPT_SHIFT:   return rt;
+    case OPT_MULDIV:  return rs | rt;
+    case OPT_MOVEHL:  return command.instr == opMfhi ? useHi : useLo;
+    case OPT_LW:      return rs | useMemory;
+    case OPT_SW:      return rs | rt | useMemory;
+    case OPT_BRANCH:  return rs | rt;
+    case OPT_JUMP:    return 0;
+    case OPT_TRANSFER: return command.instr == opJal ? 0 : rs;
+    case OPT_SYSCALL: return (1ULL << 2) | (1ULL << 4) | useConsole;
+    default:          return ~0ULL;
+  }
+}
+
+
+
+unsigned long long Defs(const Command& command, OptKind kind)
+{
+  //$zero is never written
+  unsigned long long written = 0;
+  switch (kind)
+  {
+    case OPT_ALU:     written = 1ULL << command.rd; break;
+    case OPT_ADDIU:   written = 1ULL << command.rt; break;
+    case OPT_ALUI:    written = 1ULL << command.rt; break;
+    case OPT_SHIFT:   written = 1ULL << command.rd; break;
+    case OPT_MULDIV:  written = useHi | useLo; break;
+    case OPT_MOVEHL:  written = 1ULL << command.rd; break;
+    case OPT_LW:      written = (1ULL << command.rt) | useMemory; break;
+    case OPT_SW:      written = useMemory; break;
+    case OPT_BRANCH:  written = 0; break;
+    case OPT_JUMP:    written = 0; break;
+    case OPT_TRANSFER:
+      written = command.instr == opJr ? 0 : 1ULL << (command.instr == opJalr ? command.rd : 31);
+      break;
+    case OPT_SYSCALL: written = (1ULL << 2) | useConsole; break;
+    default:          written = ~0ULL; break;
+  }
+  return written & ~1ULL;
+}
+
+
+
+PipelineEstimate EstimatePipeline(const std::vector<Command>& cmdList)
+{
+  int textWords = cmdList.size();
+  std::vector<char> kind(textWords);
+  for (int i = 0; i < textWords; ++i)
+    kind[i] = Classify(cmdList[i]);
+
+  //loop depth of every word from the spans of backward transfers
+  std::vector<int> depth(textWords + 1, 0);
+  for (int i = 0; i < textWords; ++i)
+  {
+    int target = cmdList[i].imm;
+    if ((kind[i] == OPT_BRANCH || kind[i] == OPT_JUMP) && target >= 0 && target <= i)
+    {
+      ++depth[target];
+      --depth[i + 1];
+    }
+  }
+
+  PipelineEstimate estimate;
+  int nesting = 0;
+  for (int i = 0; i < textWords; ++i)
+  {
+    nesting += depth[i];
+    long long weight = 1;
+    for (int d = 0; d < nesting && d < 4; ++d)
+      weight *= 10;
+
+    estimate.instructions += weight;
+    if (kind[i] == OPT_JUMP || (kind[i] == OPT_TRANSFER && cmdList[i].GetLabelRole() != 'b'))
+      estimate.jumpBubbles += weight;
+    if (i > 0 && kind[i - 1] == OPT_LW && cmdList[i - 1].rt != 0
+        && (Uses(cmdList[i], (OptKind)kind[i]) & (1ULL << cmdList[i - 1].rt)))
+      estimate.loadUseStalls += weight;
+  }
+  return estimate;
+}
+
+
+
+void Optimize(Chunk& program, OptimizeReport& report)
+{
+  report.before = EstimatePipeline(program.cmdList);
+  if (!program.cmdList.empty())
+  {
+    Optimizer pass(program, report);
+    pass.ThreadBranches();
+    pass.Analyze();
+    pass.Rewrite();
+    pass.MergeChains();
+    pass.Schedule();
+    pass.Compact();
+  }
+
+  for (size_t i = 0; i < program.cmdList.size(); ++i)
+    program.cmdList[i].ResolveMachine();
+  report.after = EstimatePipeline(program.cmdList);
+  return;
+}
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @file   optimizer.h
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  Peephole and scheduling pass for the assembler
+ *
+ * @description
+ * Optional pass over the resolved instruction IR, run
+ * before it is encoded: redundant loads, addiu chains,
+ * branch threading and load-use scheduling, with a static
+ * estimate of the pipeline cycles it saves. It assumes a
+ * whole program that never stores into its own text and
+ * whose register jumps only reach return points and labels
+ * whose address it takes.
+ *****************************************************/
+
+#ifndef optimizer_H
+#define optimizer_H
+
+#include "assembler.h"
+#include <string>
+#include <vector>
+
+
+/******************************************
+ *        PipelineEstimate Class          *
+ ******************************************/
+
+//cycles of a five stage pipeline with full forwarding: one per instruction,
+//one more for an instruction that uses the load just before it and one
+//more per j, jal, jr or jalr, which are only decoded in ID; an instruction
+//inside n loops
+//(spans closed by a backward branch or jump) counts 10^n times, n <= 4
+struct PipelineEstimate
+{
+  long long                 instructions = 0;         //weighted instructions
+  long long                 loadUseStalls = 0;        //weighted load-use stalls
+  long long                 jumpBubbles = 0;          //weighted jump bubbles
+
+  long long Cycles() const;                           //sum of the above
+};
+
+
+
+
+/******************************************
+ *          OptimizeReport Class          *
+ ******************************************/
+
+//what Optimize changed
+struct OptimizeReport
+{
+  int                       loadsRemoved = 0;         //loads deleted or turned into moves
+  int                       loadsBypassed = 0;        //targets moved past a redundant load
+  int                       constantsFolded = 0;      //results replaced by a constant
+  int                       chainsMerged = 0;         //addiu pairs merged into one
+  int                       branchesThreaded = 0;     //targets moved through a j, or
+                                                      //branches to the next word dropped
+  int                       blocksScheduled = 0;      //blocks reordered to hide load-use stalls
+  int                       removed = 0;              //instructions deleted
+  PipelineEstimate          before;                   //estimate of the input
+  PipelineEstimate          after;                    //estimate of the output
+
+  std::string Summary() const;                        //one line for stderr
+};
+
+
+
+
+/******************************************
+ *            Optimizer Class             *
+ ******************************************/
+
+//role of a command in the pass; anything it does not model is OPT_OTHER
+//and nothing moves across it. OPT_TRANSFER is a call, return or linking
+//branch, whose targets are entered knowing nothing
+enum OptKind
+{
+  OPT_OTHER, OPT_ALU, OPT_ADDIU, OPT_ALUI, OPT_SHIFT, OPT_MULDIV, OPT_MOVEHL, OPT_LW,
+  OPT_SW, OPT_BRANCH, OPT_JUMP, OPT_TRANSFER, OPT_SYSCALL
+};
+
+//register rt holds the memory word at base + offset
+struct LoadFact
+{
+  unsigned char             reg;                      //register holding the word
+  unsigned char             base;                     //address register
+  int                       offset;                   //sign extended offset
+};
+
+//what is known before a command; facts hold on every path reaching it
+struct ValueState
+{
+  bool                      top = true;               //no path seen yet, everything holds
+  unsigned int              known = 1;                //bit r set if value[r] is known
+  unsigned int              value[32] = {};           //register values, $zero always known
+  std::vector<LoadFact>     loads;                    //registers holding memory words
+
+  bool Meet(const ValueState&);                       //keep common facts, true if changed
+  void Define(int, bool, unsigned int);               //register written, value if known
+  int Holder(int, int) const;                         //register holding word, -1 if none
+};
+
+//one run of the pass; commands are deleted by flag and the text is
+//renumbered once at the end
+struct Optimizer
+{
+  Chunk&                    program;                  //resolved program, rewritten in place
+  OptimizeReport&           report;                   //counts of what changed
+  std::vector<Command>&     cmdList;                  //program's commands
+  int                       textWords;                //commands before compaction
+  std::vector<char>         kind;                     //OptKind of each command
+  std::vector<char>         deleted;                  //command removed
+  std::vector<char>         leader;                   //command starts a basic block
+  std::vector<int>          blockStart;               //first index of each block
+  std::vector<ValueState>   entry;                    //state on entering each block
+
+  Optimizer(Chunk&, OptimizeReport&);                 //classify commands
+  void FindBlocks();                                  //leaders from targets and labels
+  int NextLive(int) const;                            //first command at or after index
+  void ThreadBranches();                              //jump through jumps, drop no-op branches
+  void Analyze();                                     //block entry states to a fixed point
+  void Transfer(int, ValueState&, bool);              //state after command, rewriting if set
+  void Rewrite();                                     //fold, remove loads, bypass them
+  void MergeChains();                                 //addiu r,s,a .. addiu r,r,b -> addiu r,s,a+b
+  void Schedule();                                    //reorder blocks to hide load-use stalls
+  void Compact();                                     //drop deleted commands, renumber
+};
+
+//kind of a command and the registers it reads and writes; bits 0-31 are
+//registers, then hi, lo, memory and the console
+OptKind Classify(const Command&);
+unsigned long long Uses(const Command&, OptKind);
+unsigned long long Defs(const Command&, OptKind);
+
+//static pipeline estimate of a text
+PipelineEstimate EstimatePipeline(const std::vector<Command>&);
+
+//optimize a resolved program with no unresolved labels, then encode it
+void Optimize(Chunk&, OptimizeReport&);
+
+#endif
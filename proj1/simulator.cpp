@@ -0,0 +1,962 @@
+/**
+ * @file   simulator.cpp
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  MIPS instruction set simulator
+ *
+ * @description
+ * Decoder and computed goto interpreter behind
+ * simulator.h.
+ *****************************************************/
+
+#ifndef simulator_CPP
+#define simulator_CPP
+
+#include "simulator.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+
+/*********************************************
+ *              Helper Functions             *
+ *********************************************/
+
+//targets are word indices; ones outside the text go to the end marker
+static int Target(long long target, unsigned int textWords)
+{
+  return target < 0 || target > textWords ? textWords : (int)target;
+}
+
+
+
+//address bits a load or store needs clear; lwl, lwr, swl and swr take
+//any byte of a word
+static unsigned int AlignMask(unsigned char code)
+{
+  switch (code)
+  {
+    case OP_LW: case OP_SW: case OP_SC:  return 3;
+    case OP_LH: case OP_LHU: case OP_SH: return 1;
+    default:                             return 0;
+  }
+}
+
+
+
+//register after a load of less than a word from the word holding address;
+//lwl and lwr keep the bytes of old they do not replace
+static int LoadPart(unsigned char code, unsigned int word, unsigned int address, int old)
+{
+  unsigned int lane = address & 3;
+  switch (code)
+  {
+    case OP_LB:  return (signed char)(word >> (24 - 8 * lane));
+    case OP_LBU: return (unsigned char)(word >> (24 - 8 * lane));
+    case OP_LH:  return (short)(word >> (16 - 8 * lane));
+    case OP_LHU: return (unsigned short)(word >> (16 - 8 * lane));
+    case OP_LWL: return (int)(word << (8 * lane) | ((unsigned int)old & ((1u << (8 * lane)) - 1)));
+    default:
+      return (int)(word >> (24 - 8 * lane)
+                   | ((unsigned int)old & ~(0xffffffffu >> (24 - 8 * lane))));
+  }
+}
+
+
+
+//word after a store of less than a word of value at address
+static unsigned int StorePart(unsigned char code, unsigned int word, unsigned int address,
+                              unsigned int value)
+{
+  unsigned int lane = address & 3;
+  switch (code)
+  {
+    case OP_SB:
+      return (word & ~(0xffu << (24 - 8 * lane))) | (value & 0xff) << (24 - 8 * lane);
+    case OP_SH:
+      return (word & ~(0xffffu << (16 - 8 * lane))) | (value & 0xffff) << (16 - 8 * lane);
+    case OP_SWL:
+      return (word & ~(0xffffffffu >> (8 * lane))) | value >> (8 * lane);
+    default:
+      return (word & ~(0xffffffffu << (24 - 8 * lane))) | value << (24 - 8 * lane);
+  }
+}
+
+
+
+//true if add, addi or sub wraps; sum is the 32 bit result either way
+static bool Overflows(long long exact, int& sum)
+{
+  sum = (int)exact;
+  return exact != sum;
+}
+
+
+
+//true if a trap with condition in rd fires
+static bool Trapped(unsigned char condition, int a, int b)
+{
+  switch (condition & 7)
+  {
+    case TRAP_GE:  return a >= b;
+    case TRAP_GEU: return (unsigned int)a >= (unsigned int)b;
+    case TRAP_LT:  return a < b;
+    case TRAP_LTU: return (unsigned int)a < (unsigned int)b;
+    case TRAP_EQ:  return a == b;
+    default:       return a != b;
+  }
+}
+
+
+
+//madd, maddu, msub and msubu on the hi:lo pair
+static void Accumulate(unsigned char code, int a, int b, int& hi, int& lo)
+{
+  unsigned long long pair = (unsigned long long)(unsigned int)hi << 32 | (unsigned int)lo;
+  unsigned long long product = code == OP_MADDU || code == OP_MSUBU
+                               ? (unsigned long long)(unsigned int)a * (unsigned int)b
+                               : (unsigned long long)((long long)a * b);
+  pair = code == OP_MADD || code == OP_MADDU ? pair + product : pair - product;
+  hi = (int)(pair >> 32);
+  lo = (int)pair;
+  return;
+}
+
+
+
+//clz, or clo of the complement
+static int LeadingZeros(unsigned int value)
+{
+  int count = 0;
+  while (count < 32 && (value & (0x80000000u >> count)) == 0)
+    ++count;
+  return count;
+}
+
+
+
+
+/*********************************************
+ *              Machine Methods              *
+ *********************************************/
+
+void Machine::Load(const std::vector<unsigned int>& image, unsigned int text,
+                   unsigned int stackWords)
+{
+  memory = image;
+  memory.resize(image.size() + stackWords, 0);
+  textWords = text;
+
+  //decode every text word once, the end marker catches falling off
+  program.clear();
+  program.reserve(textWords + 1);
+  for (unsigned int i = 0; i < textWords; ++i)
+    program.push_back(Decode(memory[i], i));
+  program.push_back(MicroOp{ OP_END, 0, 0, 0, 0 });
+
+  for (int i = 0; i < 32; ++i)
+    regs[i] = 0;
+  regs[28] = 4 * textWords;
+  regs[29] = 4 * memory.size();
+  regs[31] = 4 * textWords;
+  hi = 0;
+  lo = 0;
+  pc = 0;
+  executed = 0;
+  faultAddress = 0;
+  textWritten = false;
+  dataAddress = 0;
+  dataAccess = 0;
+  fault.clear();
+  written.assign((4 * memory.size() + pageBytes - 1) / pageBytes, 0);
+  return;
+}
+
+
+
+MicroOp Machine::Decode(unsigned int word, unsigned int index) const
+{
+  MicroOp op = { OP_ILLEGAL, 0, 0, 0, 0 };
+  op.rs = (word >> 21) & 31;
+  op.rt = (word >> 16) & 31;
+  op.rd = (word >> 11) & 31;
+  op.imm = (short)(word & 0xffff);
+
+  //the assembler writes 0 for lines it could not encode, sll $0,$0,0
+  if (word == 0)
+  {
+    op.code = OP_NOP;
+    return op;
+  }
+
+  long long branch = (long long)index + 1 + op.imm;
+  unsigned int dest = op.rt;
+  switch (word >> 26)
+  {
+    case 0:
+      dest = op.rd;
+      switch (word & 63)
+      {
+        case  0: op.code = OP_SLL;     break;
+        case  2: op.code = OP_SRL;     break;
+        case  3: op.code = OP_SRA;     break;
+        case  4: op.code = OP_SLLV;    break;
+        case  6: op.code = OP_SRLV;    break;
+        case  7: op.code = OP_SRAV;    break;
+        case  8: op.code = OP_JR;      break;
+        case  9: op.code = OP_JALR;    break;
+        case 10: op.code = OP_MOVZ;    break;
+        case 11: op.code = OP_MOVN;    break;
+        case 12: op.code = OP_SYSCALL; break;
+        case 13: op.code = OP_BREAK;   break;
+        case 16: op.code = OP_MFHI;    break;
+        case 17: op.code = OP_MTHI;    break;
+        case 18: op.code = OP_MFLO;    break;
+        case 19: op.code = OP_MTLO;    break;
+        case 24: op.code = OP_MULT;    break;
+        case 25: op.code = OP_MULTU;   break;
+        case 26: op.code = OP_DIV;     break;
+        case 27: op.code = OP_DIVU;    break;
+        case 32: op.code = OP_ADD;     break;
+        case 33: op.code = OP_ADDU;    break;
+        case 34: op.code = OP_SUB;     break;
+        case 35: op.code = OP_SUBU;    break;
+        case 36: op.code = OP_AND;     break;
+        case 37: op.code = OP_OR;      break;
+        case 38: op.code = OP_XOR;     break;
+        case 39: op.code = OP_NOR;     break;
+        case 42: op.code = OP_SLT;     break;
+        case 43: op.code = OP_SLTU;    break;
+        case 48: case 49: case 50: case 51: case 52: case 54:
+          op.code = OP_TRAP;
+          op.rd = (word & 63) - 48;
+          dest = 1;
+          break;
+      }
+      op.imm = (word >> 6) & 31;
+      break;
+
+    case 28:
+      dest = op.rd;
+      switch (word & 63)
+      {
+        case  0: op.code = OP_MADD;  break;
+        case  1: op.code = OP_MADDU; break;
+        case  2: op.code = OP_MUL;   break;
+        case  4: op.code = OP_MSUB;  break;
+        case  5: op.code = OP_MSUBU; break;
+        case 32: op.code = OP_CLZ;   break;
+        case 33: op.code = OP_CLO;   break;
+      }
+      break;
+
+    //REGIMM: rt picks the branch or trap
+    case 1:
+      switch (op.rt)
+      {
+        case  0: op.code = OP_BLTZ;   op.imm = Target(branch, textWords); break;
+        case  1: op.code = OP_BGEZ;   op.imm = Target(branch, textWords); break;
+        case 16: op.code = OP_BLTZAL; op.imm = Target(branch, textWords); break;
+        case 17: op.code = OP_BGEZAL; op.imm = Target(branch, textWords); break;
+        case 8: case 9: case 10: case 11: case 12: case 14:
+          op.code = OP_TRAP;
+          op.rd = (op.rt - 8) | TRAP_IMM;
+          break;
+      }
+      op.rt = 0;
+      dest = 1;
+      break;
+
+    case  8: op.code = OP_ADDI;  dest = 1; break;
+    case  9: op.code = OP_ADDIU; break;
+    case 10: op.code = OP_SLTI;  break;
+    case 11: op.code = OP_SLTIU; break;
+    case 12: op.code = OP_ANDI;  op.imm = word & 0xffff; break;
+    case 13: op.code = OP_ORI;   op.imm = word & 0xffff; break;
+    case 14: op.code = OP_XORI;  op.imm = word & 0xffff; break;
+    case 15:
+      op.code = OP_ADDIU;
+      op.rs = 0;
+      op.imm = (int)(word << 16);
+      break;
+
+    //loads into $zero decode as no-ops, as lw always has
+    case 32: op.code = OP_LB;  break;
+    case 33: op.code = OP_LH;  break;
+    case 34: op.code = OP_LWL; break;
+    case 35: op.code = OP_LW;  break;
+    case 36: op.code = OP_LBU; break;
+    case 37: op.code = OP_LHU; break;
+    case 38: op.code = OP_LWR; break;
+    case 48: op.code = OP_LW;  break;
+    case 40: op.code = OP_SB;  dest = 1; break;
+    case 41: op.code = OP_SH;  dest = 1; break;
+    case 42: op.code = OP_SWL; dest = 1; break;
+    case 43: op.code = OP_SW;  dest = 1; break;
+    case 46: op.code = OP_SWR; dest = 1; break;
+    case 56: op.code = OP_SC;  dest = 1; break;
+
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+    {
+      static const unsigned char codes[] = { OP_BEQ, OP_BNE, OP_BLEZ, OP_BGTZ };
+      op.code = codes[(word >> 26) - 4];
+      op.imm = Target(branch, textWords);
+      dest = 1;
+      break;
+    }
+    case 2:
+    case 3:
+      op.code = (word >> 26) == 2 ? OP_J : OP_JAL;
+      op.imm = Target(word & 0x3ffffff, textWords);
+      dest = 1;
+      break;
+  }
+
+  //micro-ops that only write their destination do nothing writing $zero
+  switch (op.code)
+  {
+    case OP_ADD: case OP_SUB: case OP_DIV: case OP_DIVU: case OP_MULT: case OP_MULTU:
+    case OP_MTHI: case OP_MTLO: case OP_MADD: case OP_MADDU: case OP_MSUB: case OP_MSUBU:
+    case OP_JR: case OP_JALR: case OP_SYSCALL: case OP_BREAK: case OP_ILLEGAL:
+      break;
+    default:
+      if (dest == 0)
+        op.code = OP_NOP;
+      break;
+  }
+  return op;
+}
+
+
+
+StopReason Machine::Run(std::istream& in, std::ostream& out)
+{
+  //one label per OpCode, in enum order
+  static void* const handlers[] =
+  {
+    &&addu, &&and_, &&div, &&mfhi, &&mflo, &&mult, &&or_, &&slt, &&subu,
+    &&syscall, &&addiu, &&beq, &&bne, &&lw, &&sw, &&j,
+    &&add, &&sub, &&addi, &&xor_, &&nor, &&sltu, &&movz, &&movn, &&slti, &&sltiu,
+    &&andi, &&ori, &&xori, &&sll, &&srl, &&sra, &&sllv, &&srlv, &&srav,
+    &&multu, &&divu, &&mthi, &&mtlo, &&accumulate, &&accumulate, &&mul, &&accumulate,
+    &&accumulate, &&clz, &&clo, &&loadPart, &&loadPart, &&loadPart, &&loadPart, &&loadPart,
+    &&loadPart, &&storePart, &&storePart, &&storePart, &&storePart, &&sc, &&blez, &&bgtz,
+    &&bltz, &&bgez, &&bltzal, &&bgezal, &&jal, &&jr, &&jalr, &&trap, &&break_,
+    &&nop, &&end, &&illegal
+  };
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) == OP_ILLEGAL + 1,
+                "handlers must list every OpCode");
+
+  int* r = regs;
+  unsigned int* words = memory.data();
+  size_t memoryWords = memory.size();
+  unsigned char* pages = written.data();
+  const MicroOp* base = program.data();
+  const MicroOp* ip = base + (pc > textWords ? textWords : pc);
+  unsigned long long count = 0;
+  unsigned int address = 0;
+  int value = 0;
+  StopReason stop = STOP_END;
+
+  //each handler ends by jumping straight to the next one
+  #define DISPATCH() do { ++count; goto *handlers[ip->code]; } while (0)
+  #define NEXT() do { ++ip; DISPATCH(); } while (0)
+  #define BRANCH(taken) do { if (taken) { ip = base + ip->imm; DISPATCH(); } NEXT(); } while (0)
+  #define ADDRESS() (address = (unsigned int)r[ip->rs] + (unsigned int)ip->imm)
+  #define BAD_ADDRESS() ((address & 3) != 0 || address / 4 >= memoryWords)
+  #define LINK() (4 * (unsigned int)(ip - base + 1))
+
+  //stores mark their page, and stores into the text are decoded again
+  //before they can run
+  #define STORED() do { pages[address / pageBytes] = 1; \
+                        if (address / 4 < textWords) \
+                          program[address / 4] = Decode(words[address / 4], address / 4); \
+                      } while (0)
+
+  //register jumps leave through the end marker past the text
+  #define JUMP_TO(target) do { ip = base + ((target) / 4 > textWords ? textWords : (target) / 4); \
+                             } while (0)
+
+  DISPATCH();
+
+addu:
+  r[ip->rd] = (int)((unsigned int)r[ip->rs] + (unsigned int)r[ip->rt]);
+  NEXT();
+and_:
+  r[ip->rd] = r[ip->rs] & r[ip->rt];
+  NEXT();
+div:
+  //division by zero leaves hi and lo unchanged
+  if (r[ip->rt] == -1)
+  {
+    lo = (int)(0u - (unsigned int)r[ip->rs]);
+    hi = 0;
+  }
+  else if (r[ip->rt] != 0)
+  {
+    lo = r[ip->rs] / r[ip->rt];
+    hi = r[ip->rs] % r[ip->rt];
+  }
+  NEXT();
+mfhi:
+  r[ip->rd] = hi;
+  NEXT();
+mflo:
+  r[ip->rd] = lo;
+  NEXT();
+mult:
+  {
+    long long product = (long long)r[ip->rs] * r[ip->rt];
+    lo = (int)product;
+    hi = (int)(product >> 32);
+  }
+  NEXT();
+or_:
+  r[ip->rd] = r[ip->rs] | r[ip->rt];
+  NEXT();
+slt:
+  r[ip->rd] = r[ip->rs] < r[ip->rt];
+  NEXT();
+subu:
+  r[ip->rd] = (int)((unsigned int)r[ip->rs] - (unsigned int)r[ip->rt]);
+  NEXT();
+
+syscall:
+  //1 print int, 5 read int, 10 exit
+  switch (r[2])
+  {
+    case 1:
+      out << r[4];
+      break;
+    case 5:
+      if (!(in >> r[2]))
+        r[2] = 0;
+      break;
+    case 10:
+      stop = STOP_EXIT;
+      ++ip;
+      goto done;
+    default:
+      fault = "unknown syscall " + std::to_string(r[2]);
+      --count;
+      stop = STOP_FAULT;
+      goto done;
+  }
+  NEXT();
+
+addiu:
+  r[ip->rt] = (int)((unsigned int)r[ip->rs] + (unsigned int)ip->imm);
+  NEXT();
+beq:
+  BRANCH(r[ip->rs] == r[ip->rt]);
+bne:
+  BRANCH(r[ip->rs] != r[ip->rt]);
+lw:
+  ADDRESS();
+  if (BAD_ADDRESS())
+    goto badAddress;
+  r[ip->rt] = (int)words[address / 4];
+  NEXT();
+sw:
+  ADDRESS();
+  if (BAD_ADDRESS())
+    goto badAddress;
+  words[address / 4] = (unsigned int)r[ip->rt];
+  STORED();
+  NEXT();
+j:
+  ip = base + ip->imm;
+  DISPATCH();
+
+//add, addi and sub fault rather than wrap, so they may name $zero
+add:
+  if (Overflows((long long)r[ip->rs] + r[ip->rt], value))
+    goto overflow;
+  r[ip->rd] = value;
+  r[0] = 0;
+  NEXT();
+sub:
+  if (Overflows((long long)r[ip->rs] - r[ip->rt], value))
+    goto overflow;
+  r[ip->rd] = value;
+  r[0] = 0;
+  NEXT();
+addi:
+  if (Overflows((long long)r[ip->rs] + ip->imm, value))
+    goto overflow;
+  r[ip->rt] = value;
+  r[0] = 0;
+  NEXT();
+xor_:
+  r[ip->rd] = r[ip->rs] ^ r[ip->rt];
+  NEXT();
+nor:
+  r[ip->rd] = ~(r[ip->rs] | r[ip->rt]);
+  NEXT();
+sltu:
+  r[ip->rd] = (unsigned int)r[ip->rs] < (unsigned int)r[ip->rt];
+  NEXT();
+movz:
+  if (r[ip->rt] == 0)
+    r[ip->rd] = r[ip->rs];
+  NEXT();
+movn:
+  if (r[ip->rt] != 0)
+    r[ip->rd] = r[ip->rs];
+  NEXT();
+slti:
+  r[ip->rt] = r[ip->rs] < ip->imm;
+  NEXT();
+sltiu:
+  r[ip->rt] = (unsigned int)r[ip->rs] < (unsigned int)ip->imm;
+  NEXT();
+andi:
+  r[ip->rt] = r[ip->rs] & ip->imm;
+  NEXT();
+ori:
+  r[ip->rt] = r[ip->rs] | ip->imm;
+  NEXT();
+xori:
+  r[ip->rt] = r[ip->rs] ^ ip->imm;
+  NEXT();
+sll:
+  r[ip->rd] = (int)((unsigned int)r[ip->rt] << ip->imm);
+  NEXT();
+srl:
+  r[ip->rd] = (int)((unsigned int)r[ip->rt] >> ip->imm);
+  NEXT();
+sra:
+  r[ip->rd] = r[ip->rt] >> ip->imm;
+  NEXT();
+sllv:
+  r[ip->rd] = (int)((unsigned int)r[ip->rt] << (r[ip->rs] & 31));
+  NEXT();
+srlv:
+  r[ip->rd] = (int)((unsigned int)r[ip->rt] >> (r[ip->rs] & 31));
+  NEXT();
+srav:
+  r[ip->rd] = r[ip->rt] >> (r[ip->rs] & 31);
+  NEXT();
+
+multu:
+  {
+    unsigned long long product = (unsigned long long)(unsigned int)r[ip->rs]
+                                 * (unsigned int)r[ip->rt];
+    lo = (int)product;
+    hi = (int)(product >> 32);
+  }
+  NEXT();
+divu:
+  if (r[ip->rt] != 0)
+  {
+    lo = (int)((unsigned int)r[ip->rs] / (unsigned int)r[ip->rt]);
+    hi = (int)((unsigned int)r[ip->rs] % (unsigned int)r[ip->rt]);
+  }
+  NEXT();
+mthi:
+  hi = r[ip->rs];
+  NEXT();
+mtlo:
+  lo = r[ip->rs];
+  NEXT();
+accumulate:
+  Accumulate(ip->code, r[ip->rs], r[ip->rt], hi, lo);
+  NEXT();
+mul:
+  r[ip->rd] = (int)((long long)r[ip->rs] * r[ip->rt]);
+  NEXT();
+clz:
+  r[ip->rd] = LeadingZeros(r[ip->rs]);
+  NEXT();
+clo:
+  r[ip->rd] = LeadingZeros(~r[ip->rs]);
+  NEXT();
+
+loadPart:
+  ADDRESS();
+  if ((address & AlignMask(ip->code)) != 0 || address / 4 >= memoryWords)
+    goto badAddress;
+  r[ip->rt] = LoadPart(ip->code, words[address / 4], address, r[ip->rt]);
+  NEXT();
+storePart:
+  ADDRESS();
+  if ((address & AlignMask(ip->code)) != 0 || address / 4 >= memoryWords)
+    goto badAddress;
+  words[address / 4] = StorePart(ip->code, words[address / 4], address, r[ip->rt]);
+  STORED();
+  NEXT();
+sc:
+  //nothing else runs, so every store conditional succeeds
+  ADDRESS();
+  if (BAD_ADDRESS())
+    goto badAddress;
+  words[address / 4] = (unsigned int)r[ip->rt];
+  if (ip->rt != 0)
+    r[ip->rt] = 1;
+  STORED();
+  NEXT();
+
+blez:
+  BRANCH(r[ip->rs] <= 0);
+bgtz:
+  BRANCH(r[ip->rs] > 0);
+bltz:
+  BRANCH(r[ip->rs] < 0);
+bgez:
+  BRANCH(r[ip->rs] >= 0);
+bltzal:
+  value = r[ip->rs];
+  r[31] = LINK();
+  BRANCH(value < 0);
+bgezal:
+  value = r[ip->rs];
+  r[31] = LINK();
+  BRANCH(value >= 0);
+jal:
+  r[31] = LINK();
+  ip = base + ip->imm;
+  DISPATCH();
+jr:
+  address = r[ip->rs];
+  if ((address & 3) != 0)
+    goto badAddress;
+  JUMP_TO(address);
+  DISPATCH();
+jalr:
+  address = r[ip->rs];
+  if ((address & 3) != 0)
+    goto badAddress;
+  r[ip->rd] = LINK();
+  r[0] = 0;
+  JUMP_TO(address);
+  DISPATCH();
+
+trap:
+  if (!Trapped(ip->rd, r[ip->rs], ip->rd & TRAP_IMM ? ip->imm : r[ip->rt]))
+    NEXT();
+  fault = "trap";
+  --count;
+  stop = STOP_FAULT;
+  goto done;
+break_:
+  fault = "break";
+  --count;
+  stop = STOP_FAULT;
+  goto done;
+nop:
+  NEXT();
+
+end:
+  --count;
+  stop = STOP_END;
+  goto done;
+illegal:
+  {
+    char word[16];
+    std::snprintf(word, sizeof(word), "%08x", words[ip - base]);
+    fault = std::string("illegal instruction ") + word;
+  }
+  --count;
+  stop = STOP_FAULT;
+  goto done;
+overflow:
+  fault = "integer overflow";
+  --count;
+  stop = STOP_FAULT;
+  goto done;
+badAddress:
+  BadAddress(address);
+  --count;
+  stop = STOP_FAULT;
+  goto done;
+
+  #undef DISPATCH
+  #undef NEXT
+  #undef BRANCH
+  #undef ADDRESS
+  #undef BAD_ADDRESS
+  #undef LINK
+  #undef STORED
+  #undef JUMP_TO
+
+done:
+  pc = ip - base;
+  executed += count;
+  return stop;
+}
+
+
+
+bool Machine::Step(std::istream& in, std::ostream& out, StopReason& stop)
+{
+  //same results as Run, one micro-op at a time with a switch
+  const MicroOp& op = program[pc > textWords ? textWords : pc];
+  int* r = regs;
+  unsigned int address = (unsigned int)r[op.rs] + (unsigned int)op.imm;
+  unsigned int next = pc + 1;
+  unsigned int link = 4 * next;
+  int value = 0;
+  dataAccess = 0;
+  switch (op.code)
+  {
+    case OP_ADDU:  r[op.rd] = (int)((unsigned int)r[op.rs] + (unsigned int)r[op.rt]); break;
+    case OP_AND:   r[op.rd] = r[op.rs] & r[op.rt]; break;
+    case OP_MFHI:  r[op.rd] = hi; break;
+    case OP_MFLO:  r[op.rd] = lo; break;
+    case OP_OR:    r[op.rd] = r[op.rs] | r[op.rt]; break;
+    case OP_SLT:   r[op.rd] = r[op.rs] < r[op.rt]; break;
+    case OP_SUBU:  r[op.rd] = (int)((unsigned int)r[op.rs] - (unsigned int)r[op.rt]); break;
+    case OP_ADDIU: r[op.rt] = (int)((unsigned int)r[op.rs] + (unsigned int)op.imm); break;
+    case OP_BEQ:   next = r[op.rs] == r[op.rt] ? op.imm : next; break;
+    case OP_BNE:   next = r[op.rs] != r[op.rt] ? op.imm : next; break;
+    case OP_J:     next = op.imm; break;
+    case OP_NOP:   break;
+    case OP_XOR:   r[op.rd] = r[op.rs] ^ r[op.rt]; break;
+    case OP_NOR:   r[op.rd] = ~(r[op.rs] | r[op.rt]); break;
+    case OP_SLTU:  r[op.rd] = (unsigned int)r[op.rs] < (unsigned int)r[op.rt]; break;
+    case OP_MOVZ:  r[op.rd] = r[op.rt] == 0 ? r[op.rs] : r[op.rd]; break;
+    case OP_MOVN:  r[op.rd] = r[op.rt] != 0 ? r[op.rs] : r[op.rd]; break;
+    case OP_SLTI:  r[op.rt] = r[op.rs] < op.imm; break;
+    case OP_SLTIU: r[op.rt] = (unsigned int)r[op.rs] < (unsigned int)op.imm; break;
+    case OP_ANDI:  r[op.rt] = r[op.rs] & op.imm; break;
+    case OP_ORI:   r[op.rt] = r[op.rs] | op.imm; break;
+    case OP_XORI:  r[op.rt] = r[op.rs] ^ op.imm; break;
+    case OP_SLL:   r[op.rd] = (int)((unsigned int)r[op.rt] << op.imm); break;
+    case OP_SRL:   r[op.rd] = (int)((unsigned int)r[op.rt] >> op.imm); break;
+    case OP_SRA:   r[op.rd] = r[op.rt] >> op.imm; break;
+    case OP_SLLV:  r[op.rd] = (int)((unsigned int)r[op.rt] << (r[op.rs] & 31)); break;
+    case OP_SRLV:  r[op.rd] = (int)((unsigned int)r[op.rt] >> (r[op.rs] & 31)); break;
+    case OP_SRAV:  r[op.rd] = r[op.rt] >> (r[op.rs] & 31); break;
+    case OP_MTHI:  hi = r[op.rs]; break;
+    case OP_MTLO:  lo = r[op.rs]; break;
+    case OP_MUL:   r[op.rd] = (int)((long long)r[op.rs] * r[op.rt]); break;
+    case OP_CLZ:   r[op.rd] = LeadingZeros(r[op.rs]); break;
+    case OP_CLO:   r[op.rd] = LeadingZeros(~r[op.rs]); break;
+    case OP_BLEZ:  next = r[op.rs] <= 0 ? op.imm : next; break;
+    case OP_BGTZ:  next = r[op.rs] > 0 ? op.imm : next; break;
+    case OP_BLTZ:  next = r[op.rs] < 0 ? op.imm : next; break;
+    case OP_BGEZ:  next = r[op.rs] >= 0 ? op.imm : next; break;
+    case OP_JAL:   r[31] = link; next = op.imm; break;
+    case OP_BLTZAL:
+    case OP_BGEZAL:
+      value = r[op.rs];
+      r[31] = link;
+      if (op.code == OP_BLTZAL ? value < 0 : value >= 0)
+        next = op.imm;
+      break;
+    case OP_JR:
+    case OP_JALR:
+      address = r[op.rs];
+      if ((address & 3) != 0)
+      {
+        BadAddress(address);
+        stop = STOP_FAULT;
+        return false;
+      }
+      if (op.code == OP_JALR)
+      {
+        r[op.rd] = link;
+        r[0] = 0;
+      }
+      next = address / 4 > textWords ? textWords : address / 4;
+      break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_ADDI:
+    {
+      long long exact = op.code == OP_ADD ? (long long)r[op.rs] + r[op.rt]
+                        : op.code == OP_SUB ? (long long)r[op.rs] - r[op.rt]
+                        : (long long)r[op.rs] + op.imm;
+      if (Overflows(exact, value))
+      {
+        fault = "integer overflow";
+        stop = STOP_FAULT;
+        return false;
+      }
+      r[op.code == OP_ADDI ? op.rt : op.rd] = value;
+      r[0] = 0;
+      break;
+    }
+    case OP_DIV:
+      if (r[op.rt] == -1)
+      {
+        lo = (int)(0u - (unsigned int)r[op.rs]);
+        hi = 0;
+      }
+      else if (r[op.rt] != 0)
+      {
+        lo = r[op.rs] / r[op.rt];
+        hi = r[op.rs] % r[op.rt];
+      }
+      break;
+    case OP_DIVU:
+      if (r[op.rt] != 0)
+      {
+        lo = (int)((unsigned int)r[op.rs] / (unsigned int)r[op.rt]);
+        hi = (int)((unsigned int)r[op.rs] % (unsigned int)r[op.rt]);
+      }
+      break;
+    case OP_MULT:
+    {
+      long long product = (long long)r[op.rs] * r[op.rt];
+      lo = (int)product;
+      hi = (int)(product >> 32);
+      break;
+    }
+    case OP_MULTU:
+    {
+      unsigned long long product = (unsigned long long)(unsigned int)r[op.rs]
+                                   * (unsigned int)r[op.rt];
+      lo = (int)product;
+      hi = (int)(product >> 32);
+      break;
+    }
+    case OP_MADD:
+    case OP_MADDU:
+    case OP_MSUB:
+    case OP_MSUBU:
+      Accumulate(op.code, r[op.rs], r[op.rt], hi, lo);
+      break;
+    case OP_LW:
+    case OP_SW:
+    case OP_LB:
+    case OP_LH:
+    case OP_LWL:
+    case OP_LBU:
+    case OP_LHU:
+    case OP_LWR:
+    case OP_SB:
+    case OP_SH:
+    case OP_SWL:
+    case OP_SWR:
+    case OP_SC:
+    {
+      if ((address & AlignMask(op.code)) != 0 || address / 4 >= memory.size())
+      {
+        BadAddress(address);
+        stop = STOP_FAULT;
+        return false;
+      }
+      bool isLoad = op.code == OP_LW || (op.code >= OP_LB && op.code <= OP_LWR);
+      unsigned int& word = memory[address / 4];
+      dataAddress = address;
+      dataAccess = isLoad ? 'R' : 'W';
+      if (isLoad)
+      {
+        r[op.rt] = op.code == OP_LW ? (int)word : LoadPart(op.code, word, address, r[op.rt]);
+        break;
+      }
+      word = op.code == OP_SW || op.code == OP_SC ? (unsigned int)r[op.rt]
+             : StorePart(op.code, word, address, r[op.rt]);
+      if (op.code == OP_SC && op.rt != 0)
+        r[op.rt] = 1;
+      written[address / pageBytes] = 1;
+      if (address / 4 < textWords)
+      {
+        program[address / 4] = Decode(memory[address / 4], address / 4);
+        faultAddress = address;
+        textWritten = true;
+      }
+      break;
+    }
+    case OP_SYSCALL:
+      if (r[2] == 1)
+        out << r[4];
+      else if (r[2] == 5)
+      {
+        if (!(in >> r[2]))
+          r[2] = 0;
+      }
+      else if (r[2] == 10)
+      {
+        ++executed;
+        pc = next;
+        stop = STOP_EXIT;
+        return false;
+      }
+      else
+      {
+        fault = "unknown syscall " + std::to_string(r[2]);
+        stop = STOP_FAULT;
+        return false;
+      }
+      break;
+    case OP_TRAP:
+      if (Trapped(op.rd, r[op.rs], op.rd & TRAP_IMM ? op.imm : r[op.rt]))
+      {
+        fault = "trap";
+        stop = STOP_FAULT;
+        return false;
+      }
+      break;
+    case OP_BREAK:
+      fault = "break";
+      stop = STOP_FAULT;
+      return false;
+    case OP_END:
+      stop = STOP_END;
+      return false;
+    default:
+    {
+      char word[16];
+      std::snprintf(word, sizeof(word), "%08x", memory[pc]);
+      fault = std::string("illegal instruction ") + word;
+      stop = STOP_FAULT;
+      return false;
+    }
+  }
+  ++executed;
+  pc = next;
+  return true;
+}
+
+
+
+void Machine::BadAddress(unsigned int address)
+{
+  char text[16];
+  std::snprintf(text, sizeof(text), "0x%08x", address);
+  fault = std::string("bad address ") + text;
+  faultAddress = address;
+  return;
+}
+
+
+
+void Machine::Restore(const Machine& image)
+{
+  //this machine is a copy of image, so only pages it wrote differ; a
+  //written page of text was also decoded again
+  const size_t pageWords = pageBytes / 4;
+  for (size_t page = 0; page < written.size(); ++page)
+  {
+    if (written[page] == 0)
+      continue;
+    size_t first = page * pageWords;
+    size_t last = std::min(first + pageWords, memory.size());
+    std::copy(image.memory.begin() + first, image.memory.begin() + last, memory.begin() + first);
+    if (first < textWords)
+      std::copy(image.program.begin() + first,
+                image.program.begin() + std::min(last, (size_t)textWords),
+                program.begin() + first);
+    written[page] = 0;
+  }
+
+  std::copy(image.regs, image.regs + 32, regs);
+  hi = image.hi;
+  lo = image.lo;
+  pc = image.pc;
+  executed = image.executed;
+  faultAddress = image.faultAddress;
+  textWritten = image.textWritten;
+  dataAddress = image.dataAddress;
+  dataAccess = image.dataAccess;
+  fault = image.fault;
+  return;
+}
+
+#endif
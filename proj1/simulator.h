@@ -0,0 +1,161 @@
+/**
+ * @file   simulator.h
+ * @author Jarrod Brunson
+ * @date   05.19.16
+ * @brief  MIPS instruction set simulator
+ *
+ * @description
+ * Runs the words the assembler produces. Text words are
+ * decoded once into micro-ops, which are dispatched by
+ * computed goto; data and a stack follow the text in one
+ * word-addressed memory.
+ *****************************************************/
+
+#ifndef simulator_H
+#define simulator_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/******************************************
+ *             MicroOp Class              *
+ ******************************************/
+
+//handler of a micro-op; the order is that of Machine::Run's label table.
+//lui decodes as OP_ADDIU from $zero and ll as OP_LW
+enum OpCode
+{
+  OP_ADDU, OP_AND, OP_DIV, OP_MFHI, OP_MFLO, OP_MULT, OP_OR, OP_SLT, OP_SUBU,
+  OP_SYSCALL, OP_ADDIU, OP_BEQ, OP_BNE, OP_LW, OP_SW, OP_J,
+  OP_ADD, OP_SUB, OP_ADDI, OP_XOR, OP_NOR, OP_SLTU, OP_MOVZ, OP_MOVN, OP_SLTI, OP_SLTIU,
+  OP_ANDI, OP_ORI, OP_XORI, OP_SLL, OP_SRL, OP_SRA, OP_SLLV, OP_SRLV, OP_SRAV,
+  OP_MULTU, OP_DIVU, OP_MTHI, OP_MTLO, OP_MADD, OP_MADDU, OP_MUL, OP_MSUB, OP_MSUBU,
+  OP_CLZ, OP_CLO, OP_LB, OP_LH, OP_LWL, OP_LBU, OP_LHU, OP_LWR, OP_SB, OP_SH, OP_SWL,
+  OP_SWR, OP_SC, OP_BLEZ, OP_BGTZ, OP_BLTZ, OP_BGEZ, OP_BLTZAL, OP_BGEZAL, OP_JAL, OP_JR,
+  OP_JALR, OP_TRAP, OP_BREAK, OP_NOP, OP_END, OP_ILLEGAL
+};
+
+//one decoded text word; writes to $zero decode as OP_NOP, so handlers
+//never check for it, except those that can also fault or jump
+struct MicroOp
+{
+  unsigned char             code;                     //OpCode
+  unsigned char             rd;                       //destination register, trap condition
+  unsigned char             rs;                       //first source register
+  unsigned char             rt;                       //second source or target register
+  int                       imm;                      //sign extended immediate, zero extended
+                                                      //for andi, ori and xori, shift amount,
+                                                      //or index of branch and jump targets
+};
+
+//OP_TRAP conditions in MicroOp::rd, the low bits of the trap's funct or
+//REGIMM code; TRAP_IMM compares with imm instead of rt
+enum TrapCondition
+{
+  TRAP_GE = 0, TRAP_GEU = 1, TRAP_LT = 2, TRAP_LTU = 3, TRAP_EQ = 4, TRAP_NE = 6,
+  TRAP_IMM = 8
+};
+
+
+
+
+/******************************************
+ *             Machine Class              *
+ ******************************************/
+
+//why Run returned
+enum StopReason
+{
+  STOP_EXIT,                                          //syscall 10
+  STOP_END,                                           //left the text segment
+  STOP_FAULT                                          //see Machine::fault
+};
+
+//bytes of memory per entry of Machine::written
+const unsigned int pageBytes = 4096;
+
+//registers, memory and decoded text of one program; addresses are bytes,
+//text starts at 0, $gp points at data and $sp at the top of the stack.
+//Words hold their bytes big endian, and $ra starts at the end of the text
+//so returning from the entry ends the run
+struct Machine
+{
+  std::vector<unsigned int> memory;                   //text, data, then stack words
+  std::vector<MicroOp>      program;                  //decoded text, then OP_END
+  unsigned int              textWords = 0;            //words of text
+  int                       regs[32] = {};            //general registers
+  int                       hi = 0;                   //mult high word, div remainder
+  int                       lo = 0;                   //mult low word, div quotient
+  unsigned int              pc = 0;                   //word index of next instruction
+  unsigned long long        executed = 0;             //instructions run
+  unsigned int              faultAddress = 0;         //address of last bad access or text store
+  bool                      textWritten = false;      //Step stored into the text
+  unsigned int              dataAddress = 0;          //address of Step's load or store
+  char                      dataAccess = 0;           //'R' load, 'W' store, 0 if Step made none
+  std::string               fault;                    //reason of STOP_FAULT
+  std::vector<unsigned char> written;                 //page stored into by Run or Step, not
+                                                      //by translated code
+
+  void Load(const std::vector<unsigned int>&,
+            unsigned int, unsigned int);              //image, text words, stack words
+  MicroOp Decode(unsigned int, unsigned int) const;   //word at index -> micro-op
+  StopReason Run(std::istream&, std::ostream&);       //run until exit, end or fault
+  bool Step(std::istream&, std::ostream&,
+            StopReason&);                             //run one micro-op, false once stopped
+  void BadAddress(unsigned int);                      //fault for access at address
+  void Restore(const Machine&);                       //back to a loaded machine's state,
+                                                      //copying only pages written since
+
+  template <typename Flush>
+  StopReason Trace(std::istream&, std::ostream&, bool,
+                   size_t, Flush);                    //run, reporting memory references
+};
+
+
+
+/******************************************
+ *             MemRef Class               *
+ ******************************************/
+
+//one memory reference of a traced run
+struct MemRef
+{
+  unsigned int              address;                  //byte address
+  char                      kind;                     //'I' fetch, 'R' load, 'W' store
+  unsigned int              pc;                       //word index of instruction making it
+};
+
+//run until exit, end or fault one micro-op at a time, handing every load
+//and store, and with fetches every instruction fetch, to flush(batch) in batches of
+//about batchSize; the last, partial batch is flushed before returning
+template <typename Flush>
+StopReason Machine::Trace(std::istream& in, std::ostream& out, bool fetches, size_t batchSize,
+                          Flush flush)
+{
+  std::vector<MemRef> batch;
+  batch.reserve(batchSize + 2);
+  StopReason stop = STOP_END;
+  for (;;)
+  {
+    //falling off the text fetches nothing
+    unsigned int at = pc;
+    if (fetches && at < textWords)
+      batch.push_back(MemRef{ 4 * at, 'I', at });
+    bool running = Step(in, out, stop);
+    if (dataAccess != 0)
+      batch.push_back(MemRef{ dataAddress, dataAccess, at });
+
+    if (batch.size() >= batchSize || !running)
+    {
+      flush(batch);
+      batch.clear();
+    }
+    if (!running)
+      return stop;
+  }
+}
+
+#endif
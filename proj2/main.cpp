@@ -19,6 +19,17 @@
 #include <boost/tokenizer.hpp>
 #include <vector>
 #include <list>
+#include <unordered_map>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <sys/resource.h>
+#include "assembler.h"
+#include "simulator.h"
 
 
 /******************************************
@@ -28,6 +39,42 @@ struct Cache;
 struct Access;
 struct Set;
 struct Line;
+struct FlatCache;
+struct IndexFunction;
+struct TimingModel;
+struct OutputBuffer;
+struct PcProfile;
+struct Tlb;
+
+
+/********************************************
+ *          IndexFunction  Class            *
+ *******************************************/
+
+//maps a block address (address >> offsetBits) to a set index and tag
+//bits   - plain index bit field, power-of-two set counts
+//mod    - block % setNum, any set count; division is done with a
+//         precomputed multiplier so no hardware divide is issued per access
+//xor    - index bits xor-folded with every higher index-sized chunk
+//skew   - skewed-associative; every way hashes the tag with its own
+//         multiplier, so lines that conflict in one way rarely do in another
+struct IndexFunction
+{
+  enum Kind { BITS, MOD, XOR, SKEW };
+
+  Kind kind;                                                //selected index function
+  int setNum;                                               //number of sets indexed
+  int indexBits;                                            //ceil(log2(setNum))
+  unsigned int indexMask;                                   //setNum - 1 when power of two
+  unsigned long long divMagic;                              //ceil(2^64 / setNum), mod only
+
+  IndexFunction();                                          //default constructor, bits
+  IndexFunction(Kind kind, int setNum);                     //precomputes constants for setNum
+  static bool Parse(std::string name, Kind& kind);          //config name -> kind, false if unknown
+  std::string Name() const;                                 //kind -> config name
+  unsigned int Index(unsigned int block, int way) const;    //set index of block in way
+  unsigned int Tag(unsigned int block) const;               //tag stored for block
+};
 
 
 /************************************
@@ -46,11 +93,33 @@ struct Cache
   int offsetBits;                                           //number of offset bits
   int tagBits;                                              //number of tag bits
 
+  int sectorBytes;                                          //number of B in each sector
+  int sectorBits;                                           //log2(sectorBytes)
+  int sectorNum;                                            //number of sectors in each line
+
+  IndexFunction indexFunction;                              //block address -> set index
+
   int hits;                                                 //hit counter
-  int misses;                                               //miss counter
+  int misses;                                               //miss counter, tag + sector
+  int tagMisses;                                            //misses with no matching tag
+  int sectorMisses;                                         //tag present, sector not valid
+  long long bytesFetched;                                   //B read from next level
+  long long bytesWrittenBack;                               //B of dirty sectors evicted
+  unsigned int useClock;                                    //access counter, skewed LRU
+
+  int hitLatency;                                           //cycles to service a hit
+  int missLatency;                                          //extra cycles to fetch a miss
+  int mshrNum;                                              //miss status holding registers,
+                                                            //0 = timing model disabled
   
-  Cache(int maxLines, int maxBytes, int cacheSize);                   //default constructor
-  void EditCache(int index, int line, int offset, int newTagValue);   //edit cache at location
+  Cache(int maxLines, int maxBytes, int cacheSize,
+        IndexFunction::Kind indexKind = IndexFunction::BITS,
+        int sectorBytes = 0);                               //default constructor,
+                                                            //sectorBytes 0 = unsectored
+  std::string ConfigError();                                //empty if configuration is usable
+  void EditCache(int index, int line, int newTagValue);     //evict line, store new tag
+  bool AccessSectors(Line& line, Access& access);           //validate touched sectors,
+                                                            //true if all were present
   void ShowCache();                                         //display cache contents
   void ShowConfiguration();                                 //display cache configuration info
   bool HitOrMiss(Access access);                            //1 = hit, 0 = miss
@@ -71,7 +140,7 @@ struct Set
   Set(int maxLines, int maxBytes);                         //default constructor,
                                                            //creates max number of lines,
                                                            //each with max number of bytes
-  void EditSet(int line, int offset, int newTagValue);     //edit set at location
+  void EditSet(int line, int newTagValue);                 //edit set at location
   bool IsTagInSet(int tag);                                //return offset of tag
                                                            //if in set, -1 if not
   int GetLine(int tag);                                    //find line where tag
@@ -86,14 +155,173 @@ struct Set
 struct Line
 {
   int maxBytes;                                   //max bytes in line
-  std::vector <int> bytes;                        //bytes stored in line,
-                                                  //contain tags
+  int tag;                                        //tag of stored block, -1 if empty
+  unsigned long long validSectors;                //bit i set if sector i is present
+  unsigned long long dirtySectors;                //bit i set if sector i was written
+  unsigned int lastUse;                           //cache useClock at last access,
+                                                  //skewed caches only
                                                   
   Line(int maxBytes);                             //default constructor,
-                                                  //creates max number of bytes,
-                                                  //with default value -1
-  void EditByte(int offset, int newTagValue);     //edit tag at byte offset
-  int GetTag(int offset);                         //return tag at byte offset
+                                                  //creates empty line
+  void EditTag(int newTagValue);                  //store new tag, no sectors valid
+  int GetTag();                                   //return stored tag
+  bool HasTag(int tag);                           //true if line holds tag
+};
+
+
+/****************************************
+ *          FlatCache  Class            *
+ ***************************************/
+
+//fast engine holding a Cache's lines in flat arrays, way w of set s at
+//[s * maxLines + w], with no per-set LRU list and no allocation per access.
+//LRU order is a use stamp per line, the lowest replaced first; stamps
+//start at the way number, as the reference's lists start in way order.
+//Results and counters match ProcessAccesses, which --verify checks access
+//by access
+struct FlatCache
+{
+  int maxLines;                                             //number of lines in each set
+  int maxBytes;                                             //number of B in each line
+  int offsetBits;                                           //number of offset bits
+  int sectorBytes;                                          //number of B in each sector
+  int sectorBits;                                           //log2(sectorBytes)
+  IndexFunction indexFunction;                              //block address -> set index
+  std::vector<int> tags;                                    //tag of each line, -1 if empty
+  std::vector<unsigned long long> validSectors;             //bit i set if sector i is present
+  std::vector<unsigned long long> dirtySectors;             //bit i set if sector i was written
+  std::vector<unsigned long long> stamps;                   //clock at last use of each line;
+                                                            //skewed caches keep 32 bits of it,
+                                                            //as Line::lastUse does
+  unsigned long long clock;                                 //accesses made, plus maxLines
+                                                            //unless skewed
+  std::vector<unsigned int> wayIndex;                       //set of each way, skewed caches
+
+  int hits;                                                 //hit counter
+  int misses;                                               //miss counter, tag + sector
+  int tagMisses;                                            //misses with no matching tag
+  int sectorMisses;                                         //tag present, sector not valid
+  long long bytesFetched;                                   //B read from next level
+  long long bytesWrittenBack;                               //B of dirty sectors evicted
+
+  FlatCache(const Cache& cache);                            //empty copy of cache's geometry
+  bool Process(Access& access);                             //hit or miss of one resolved access
+  void ProcessAccesses(std::vector<Access>& accessVec);     //Process every access
+  bool AccessSectors(int line, Access& access);             //as Cache::AccessSectors
+  void CopyCounters(Cache& cache);                          //counters to cache for its summary
+  std::string Compare(Cache& cache, const Access& access);  //first difference from cache in
+                                                            //the lines access could use and
+                                                            //the counters, empty if none
+  void ShowLines(Cache& cache, const Access& access);       //both engines' lines access could
+                                                            //use
+};
+
+
+/******************************************
+ *          TimingModel  Class            *
+ *****************************************/
+
+//non-blocking cache timing layered on the hit/miss results of ProcessAccesses;
+//one access issues per cycle, a primary miss holds an MSHR for
+//hitLatency + missLatency cycles and later accesses to the same block merge
+//into it. When every MSHR is busy the next primary miss stalls issue until
+//the earliest one retires. Time only advances between MSHR events, so cost
+//is O(accesses * MSHRs) regardless of latencies.
+struct TimingModel
+{
+  struct Mshr
+  {
+    unsigned int block;                                     //block address being fetched
+    long long ready;                                        //cycle the fill completes
+  };
+
+  int hitLatency;                                           //cycles to service a hit
+  int missLatency;                                          //extra cycles to fetch a miss
+  int mshrNum;                                              //number of MSHRs
+  std::vector<Mshr> mshrs;                                  //outstanding misses
+
+  long long cycle;                                          //current cycle
+  long long accesses;                                       //accesses timed
+  long long totalLatency;                                   //sum of access latencies
+  long long stallCycles;                                    //cycles issue waited on MSHRs
+  long long primaryMisses;                                  //misses that allocated an MSHR
+  long long mergedMisses;                                   //accesses merged into an MSHR
+  std::vector<long long> occupancyCycles;                   //[k] = cycles with k MSHRs busy
+  std::vector<long long> latencyCount;                      //[l] = accesses with latency l,
+                                                            //last entry collects the rest
+
+  TimingModel(int hitLatency, int missLatency, int mshrNum);  //default constructor
+  void AdvanceTo(long long time);                           //retire MSHRs up to time
+  void Run(std::vector<Access>& accessVec, Cache& cache);   //time processed accesses, then drain
+  void Issue(std::vector<Access>& accessVec, Cache& cache); //time accesses, misses stay in flight
+  void Drain();                                             //run until every MSHR retires
+  long long LatencyPercentile(double fraction);             //latency at fraction of accesses
+  void ShowTiming();                                        //display timing summary
+};
+
+
+/*******************************************
+ *          OutputBuffer  Class            *
+ ******************************************/
+
+//fixed size write buffer with hand-rolled number formatting; rows are
+//appended without allocation and reach the file in large fwrite calls
+struct OutputBuffer
+{
+  std::FILE* file;                                          //destination
+  std::vector<char> buffer;                                 //pending bytes
+  size_t used;                                              //bytes of buffer in use
+
+  OutputBuffer(std::FILE* file, size_t capacity = 1 << 16); //default constructor
+  ~OutputBuffer();                                          //flushes remaining bytes
+  void Reserve(size_t bytes);                               //flush if bytes do not fit
+  void Put(char c);                                         //append one character
+  void Write(const char* data, size_t bytes);               //append raw bytes
+  void PutDec(unsigned int value);                          //append decimal value
+  void PutHex(unsigned int value, int width);               //append hex, zero padded to width
+  void Flush();                                             //write pending bytes to file
+};
+
+
+/****************************************
+ *          PcProfile  Class            *
+ ***************************************/
+
+//misses, evictions and reuse distances of one cache's accesses, grouped
+//by the instruction that made them in an open addressed table. The reuse
+//distance of an access is the number of distinct blocks touched since its
+//block was last touched: only the latest access of every block is marked
+//in a Fenwick tree over access times, so it is the marks in between.
+//Once half the times are stale the live ones are renumbered in order, so
+//the tree stays within a few times the number of distinct blocks.
+struct PcProfile
+{
+  struct Entry
+  {
+    unsigned int pc;                                        //instruction byte address or noPc
+    long long accesses;                                     //accesses made, 0 = free slot
+    long long misses;                                       //accesses that missed
+    long long evictions;                                    //misses that replaced a valid line
+    long long coldAccesses;                                 //first touches of their block
+    long long reuseSum;                                     //reuse distances of the others
+  };
+
+  std::vector<Entry> table;                                 //slots, power of two in number
+  int used;                                                 //slots in use
+  std::unordered_map<unsigned int, long long> lastTouch;    //block -> time of latest access
+  std::vector<char> latest;                                 //[t] set if t is a latest access
+  std::vector<long long> marks;                             //Fenwick tree over latest
+  long long time;                                           //time of the next access
+
+  PcProfile();                                              //default constructor, empty
+  Entry& Find(unsigned int pc);                             //entry of pc, added if missing
+  void Mark(long long t, int delta);                        //add delta to latest[t]
+  long long Prefix(long long t);                            //marks at times 0 .. t
+  void Rebuild(long long size);                             //resize latest, rebuild marks
+  void Compact();                                           //renumber latest accesses 0 .. n-1
+  void Add(const std::vector<Access>& accessVec, Cache& cache);  //profile processed accesses
+  void ShowHotMisses(int rows, const std::vector<int>& srcLines);  //ranked by misses; pc / 4
+                                                            //indexes srcLines when present
 };
 
 
@@ -101,6 +329,9 @@ struct Line
  *          Access  Class            *
  ************************************/
 
+//pc of accesses read from traces without a PC field
+const unsigned int noPc = 0xffffffff;
+
 struct Access
 {
   int referenceNum;                               //reference number
@@ -111,8 +342,78 @@ struct Access
   int index;                                      //cache index
   int offset;                                     //byte offset
   std::string hitOrMiss;                          //memory hit or miss status
+  unsigned int pc;                                //byte address of instruction, noPc if unknown
+  bool evicted;                                   //miss replaced a valid line
 
-  Access(int r, std::string aT, int s, int a);    //default constructor
+  Access(int r, std::string aT, int s, int a,
+         unsigned int pc = noPc);                 //default constructor
+};
+
+
+/**********************************
+ *          Tlb  Class            *
+ *********************************/
+
+//page sizes, as address bits below the page number
+const int smallPageBits = 12;                               //4K pages
+const int hugePageBits = 21;                                //2M pages
+const unsigned int emptyPage = 0xffffffff;                  //TLB key of an empty entry
+const unsigned int tableBase = 0xc0000000;                  //first page table frame
+
+//data address translation in front of the cache. Levels are looked up
+//nearest first and the ones that missed are filled from the first that
+//hit; a miss in every level walks a synthetic four level x86-64 style
+//page table, whose entry reads go to the cache ahead of the access that
+//needed them. A 2M page ends the walk one level early. Pages get
+//physical frames in first-touch order from 0 up, reused from 0 if they
+//reach the page tables at tableBase
+struct Tlb
+{
+  //one set-associative LRU level; entries hold page number << 1 | huge
+  struct Level
+  {
+    int entries;                                            //translations held
+    int ways;                                               //entries in each set
+    int setNum;                                             //entries / ways
+    std::vector<unsigned int> pages;                        //entry keys, emptyPage if empty
+    std::vector<unsigned long long> stamps;                 //clock at last use, 0 if empty
+    long long hits;                                         //lookups that hit
+    long long misses;                                       //lookups that missed
+
+    Level(int entries, int ways);                           //default constructor, empty
+    bool Lookup(unsigned int key, unsigned long long clock);  //true on hit, marks the entry used
+    void Fill(unsigned int key, unsigned long long clock);  //replace the set's LRU entry
+  };
+
+  std::vector<Level> levels;                                //nearest the core first
+  bool allHuge;                                             //every page is 2M
+  std::vector<std::pair<unsigned int, unsigned int> > hugeRanges;  //[start, end) in 2M pages
+  std::unordered_map<unsigned int, unsigned int> frames;    //page key -> physical frame
+  std::unordered_map<unsigned long long, unsigned int> tables;  //depth, address prefix -> table
+  unsigned int nextFrame;                                   //next free data frame
+  unsigned int nextTable;                                   //next free page table frame
+  unsigned long long clock;                                 //accesses translated
+  int referenceNum;                                         //next number of the physical stream
+
+  long long walks;                                          //misses in every level
+  long long hugeWalks;                                      //walks ending at a 2M page
+  long long walkReads;                                      //page table entries read
+  long long walkMisses;                                     //walk reads the cache missed
+  long long accesses;                                       //data accesses translated
+  std::vector<char> walkRefs;                               //[i] set if access i of the last
+                                                            //translated batch is a walk read
+  std::vector<Access> translated;                           //physical stream being built
+
+  Tlb();                                                    //default constructor, no levels
+  std::string ConfigError();                                //empty if configuration is usable
+  bool IsHuge(unsigned int address);                        //true if a 2M page maps address
+  unsigned int Frame(unsigned int page, bool huge);         //physical address of page
+  unsigned int Table(int depth, unsigned long long prefix); //physical address of a table
+  void Walk(const Access& access, bool huge);               //append the walk's entry reads
+  void Translate(std::vector<Access>& accessVec);           //to the physical stream, walks
+                                                            //included and renumbered
+  void Account(const std::vector<Access>& accessVec);       //count processed walk reads
+  void ShowSummary();                                       //display TLB summary
 };
 
 
@@ -120,9 +421,9 @@ struct Access
  *          Access Non-Member Operators            *
  **************************************************/
 
-std::ostream& operator << (std::ostream& os, Access access)
+std::ostream& operator << (std::ostream& os, const Access& access)
 {
-  std::cout << std::left << "   "
+  os << std::left << "   "
             << std::setw(5) << access.referenceNum
             << std::right << std::setw(5) << access.accessType
             << std::setw(5) << " "
@@ -132,7 +433,8 @@ std::ostream& operator << (std::ostream& os, Access access)
             << std::setw(8) << std::dec << access.index
             << std::setw(8) << access.offset
             << std::setw(10) << access.hitOrMiss
-            << std::endl;
+            << '\n';
+  return os;
 }
 
 
@@ -143,6 +445,9 @@ std::ostream& operator << (std::ostream& os, Access access)
 //create Cache object from configuration file
 Cache ReadConfig(std::ifstream& configFile);
 
+//create Tlb object from TLB configuration file
+Tlb ReadTlbConfig(std::ifstream& configFile);
+
 //create Access object from string
 Access parseAccess(std::string accessString, int referenceNum);
 
@@ -150,14 +455,54 @@ Access parseAccess(std::string accessString, int referenceNum);
 void ReadMemTrace(std::ifstream&, std::vector<Access>& accessVec);
 
 //get tag, index & offset for accesses   
-void ResolveAccessBits(std::vector<Access>& accessVec, Cache cache);
+void ResolveAccessBits(std::vector<Access>& accessVec, Cache& cache);
 
 //display cache memory access log
-void ShowAccesses(std::vector<Access> accessVec);
+void ShowAccesses(const std::vector<Access>& accessVec);
+
+//write access log as CSV
+void WriteAccessesCsv(const std::vector<Access>& accessVec, OutputBuffer& out);
+
+//write access results as a bitmap, bit i set if access i hit
+void WriteHitBitmap(const std::vector<Access>& accessVec, OutputBuffer& out);
 
 //determine hit/miss of each access    
 void ProcessAccesses(std::vector<Access>& accessVec, Cache& cache);
 
+//determine hit/miss of each access in a skewed-associative cache
+void ProcessSkewedAccesses(std::vector<Access>& accessVec, Cache& cache);
+
+//determine hit/miss of each access with the reference and the fast engine
+//in lockstep, keeping the reference's results; false at the first access
+//they differ on, after showing it and both engines' lines it could use
+bool VerifyAccesses(std::vector<Access>& accessVec, Cache& cache, FlatCache& flat);
+
+//verify the fast engine on runs random configurations and traces, run r
+//generated from seed + r; returns the exit status
+int FuzzEngines(int runs, unsigned int seed);
+
+//true if the trace argument names a MIPS source rather than a trace
+bool IsProgram(std::string path);
+
+//resolve, process, time and, if profile is set, profile one batch of
+//accesses; cache, timing and profile state carry over to the next batch.
+//With flat set the fast engine processes them, checked against the
+//reference if verify is set; false if that check fails. With tlb set the
+//accesses are translated first, page walks included
+bool SimulateBatch(std::vector<Access>& accessVec, Cache& cache, FlatCache* flat, bool verify,
+                   TimingModel& timing, PcProfile* profile, Tlb* tlb);
+
+//assemble and run the program at path, its loads and stores going to dataCache
+//and, if instCache is set, its instruction fetches to instCache; profileRows
+//above 0 adds a hot miss report per cache, engine, verify and, if set, the
+//data TLB are as for traces; returns the exit status
+int SimulateProgram(const char* path, Cache& dataCache, Cache* instCache, bool bench,
+                    int profileRows, std::string engine, bool verify, Tlb* tlb);
+
+//assemble the MIPS source at path for the source line of every text word,
+//false if it cannot be read or assembled
+bool ReadSourceLines(const char* path, std::vector<int>& srcLines);
+
 
 /******************************
  *            Main            *
@@ -165,7 +510,122 @@ void ProcessAccesses(std::vector<Access>& accessVec, Cache& cache);
 
 int main(int argc, char* argv[])
 {
-  //open configuration and memory trace files from command line
+  //random configurations and traces through both engines
+  if (argc >= 2 && std::strncmp(argv[1], "--fuzz", 6) == 0)
+  {
+    int runs = std::strncmp(argv[1], "--fuzz=", 7) == 0 ? std::atoi(argv[1] + 7) : 1000;
+    unsigned int seed = 1;
+    if (argc >= 3 && std::strncmp(argv[2], "--seed=", 7) == 0)
+      seed = (unsigned int)std::strtoul(argv[2] + 7, NULL, 10);
+    return FuzzEngines(runs, seed);
+  }
+
+  if (argc < 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " config trace [--output=table|csv|bitmap|none]"
+              << " [--out=file] [--bench] [--profile[=rows]] [--source=program.s]"
+              << " [--engine=reference|flat] [--verify] [--tlb=config]" << std::endl;
+    std::cerr << "       " << argv[0] << " config program.s [--icache=config] [--bench]"
+              << " [--profile[=rows]] [--engine=reference|flat] [--verify] [--tlb=config]"
+              << std::endl;
+    std::cerr << "       " << argv[0] << " --fuzz[=runs] [--seed=n]" << std::endl;
+    return 1;
+  }
+
+  //per-access output format and destination, table on stdout by default
+  std::string outputFormat = "table";
+  std::string outputPath;
+  std::string instConfigPath;
+  std::string sourcePath;
+  std::string tlbConfigPath;                      //empty = addresses are physical
+  std::string engine;                             //empty = reference, or flat if verifying
+  bool bench = false;
+  bool verify = false;                            //check engine against the reference
+  int profileRows = 0;                            //hot miss rows shown, 0 = no profile
+  for (int i = 3; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--bench")
+      bench = true;
+    else if (arg.compare(0, 9, "--output=") == 0)
+      outputFormat = arg.substr(9);
+    else if (arg.compare(0, 6, "--out=") == 0)
+      outputPath = arg.substr(6);
+    else if (arg.compare(0, 9, "--icache=") == 0)
+      instConfigPath = arg.substr(9);
+    else if (arg == "--profile")
+      profileRows = 20;
+    else if (arg.compare(0, 10, "--profile=") == 0 && std::atoi(arg.c_str() + 10) > 0)
+      profileRows = std::atoi(arg.c_str() + 10);
+    else if (arg.compare(0, 9, "--source=") == 0)
+      sourcePath = arg.substr(9);
+    else if (arg.compare(0, 9, "--engine=") == 0)
+      engine = arg.substr(9);
+    else if (arg == "--verify")
+      verify = true;
+    else if (arg.compare(0, 6, "--tlb=") == 0)
+      tlbConfigPath = arg.substr(6);
+    else
+    {
+      std::cerr << "Unknown option " << arg << "." << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+  }
+  if (outputFormat != "table" && outputFormat != "csv" && outputFormat != "bitmap" &&
+      outputFormat != "none")
+  {
+    std::cerr << "Unknown output format " << outputFormat << "." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (engine.empty())
+    engine = verify ? "flat" : "reference";
+  if (engine != "reference" && engine != "flat")
+  {
+    std::cerr << "Unknown engine " << engine << "." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (verify && engine == "reference")
+  {
+    std::cerr << "--verify checks a fast engine against the reference." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (outputFormat == "bitmap" && outputPath.empty())
+  {
+    std::cerr << "Bitmap output needs --out=file." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+
+  //a program's accesses are simulated in batches and never kept, so only
+  //the summaries can be shown
+  bool program = IsProgram(argv[2]);
+  if (program && (outputFormat != "table" || !outputPath.empty()))
+  {
+    std::cerr << "Per-access output needs a trace file." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (!program && !instConfigPath.empty())
+  {
+    std::cerr << "An instruction cache needs a program, not a trace." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (program && !sourcePath.empty())
+  {
+    std::cerr << "A program maps its own source lines, --source is for traces." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+
+  //rows are written through large buffers, never flushed per row
+  std::ios::sync_with_stdio(false);
+
+  //open configuration file from command line
   //check for errors
   std::ifstream configFile;
   configFile.open(argv[1]);
@@ -176,6 +636,66 @@ int main(int argc, char* argv[])
     return 1;
   }
   
+
+  //read configuration data, create cache object  
+  Cache newCache = ReadConfig(configFile);  
+  std::string configError = newCache.ConfigError();
+  if (!configError.empty())
+  {
+    std::cerr << "Invalid cache configuration: " << configError << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+
+  //optional data TLB translating every access before the cache sees it
+  Tlb tlb;
+  if (!tlbConfigPath.empty())
+  {
+    std::ifstream tlbConfigFile;
+    tlbConfigFile.open(tlbConfigPath.c_str());
+    if (!tlbConfigFile.is_open())
+    {
+      std::cerr << "Error opening TLB configuration file." << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+    tlb = ReadTlbConfig(tlbConfigFile);
+    configError = tlb.ConfigError();
+    if (!configError.empty())
+    {
+      std::cerr << "Invalid TLB configuration: " << configError << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+  }
+  Tlb* dataTlb = tlbConfigPath.empty() ? NULL : &tlb;
+
+  if (program)
+  {
+    if (instConfigPath.empty())
+      return SimulateProgram(argv[2], newCache, NULL, bench, profileRows, engine, verify,
+                             dataTlb);
+
+    std::ifstream instConfigFile;
+    instConfigFile.open(instConfigPath.c_str());
+    if (!instConfigFile.is_open())
+    {
+      std::cerr << "Error opening instruction cache configuation file." << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+    Cache instCache = ReadConfig(instConfigFile);
+    configError = instCache.ConfigError();
+    if (!configError.empty())
+    {
+      std::cerr << "Invalid instruction cache configuration: " << configError << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+    return SimulateProgram(argv[2], newCache, &instCache, bench, profileRows, engine, verify,
+                           dataTlb);
+  }
+  
   std::ifstream memFile;
   memFile.open(argv[2]);
   if (!memFile.is_open())
@@ -185,37 +705,140 @@ int main(int argc, char* argv[])
     return 1;
   }
 
-  //read configuration data, create cache object  
-  Cache newCache = ReadConfig(configFile);  
-  
   //read memory access data to access vector
+  std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
   std::vector<Access> accessVec;
   ReadMemTrace(memFile, accessVec);
+  std::chrono::steady_clock::time_point simStart = std::chrono::steady_clock::now();
+
+  //virtual to physical, each page walk's reads going in ahead of the
+  //access that missed; the cache sees and numbers that stream
+  if (dataTlb != NULL)
+    tlb.Translate(accessVec);
 
   //resolve tag, index and offset bit values for accesses in cache
   ResolveAccessBits(accessVec, newCache);
 
-  //process memory access, detemine if hit or miss
-  ProcessAccesses(accessVec,newCache);
+  //process memory access, detemine if hit or miss; the fast engine gives
+  //the same results, which --verify checks access by access
+  if (engine == "flat")
+  {
+    FlatCache flat(newCache);
+    if (!verify)
+    {
+      flat.ProcessAccesses(accessVec);
+      flat.CopyCounters(newCache);
+    }
+    else if (!VerifyAccesses(accessVec, newCache, flat))
+    {
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+  }
+  else
+    ProcessAccesses(accessVec,newCache);
+  if (dataTlb != NULL)
+    tlb.Account(accessVec);
+
+  //optional per-instruction miss profile of traces with a PC field
+  PcProfile profile;
+  if (profileRows > 0)
+    profile.Add(accessVec, newCache);
+
+  //optional timing layer, enabled by any latency or MSHR configuration line
+  TimingModel timing(newCache.hitLatency, newCache.missLatency, newCache.mshrNum);
+  if (newCache.mshrNum > 0)
+    timing.Run(accessVec, newCache);
+
+  //throughput of the read and simulate phases, output excluded
+  if (bench)
+  {
+    std::chrono::steady_clock::time_point simEnd = std::chrono::steady_clock::now();
+    double readSeconds = std::chrono::duration<double>(simStart - readStart).count();
+    double simSeconds = std::chrono::duration<double>(simEnd - simStart).count();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cerr << "bench: accesses=" << accessVec.size()
+              << " read_s=" << readSeconds
+              << " sim_s=" << simSeconds
+              << " sim_accesses_per_s=" << (simSeconds > 0 ? accessVec.size() / simSeconds : 0)
+              << " total_accesses_per_s="
+              << (readSeconds + simSeconds > 0 ? accessVec.size() / (readSeconds + simSeconds) : 0)
+              << " peak_rss_kb=" << usage.ru_maxrss << std::endl;
+  }
 
   newCache.ShowConfiguration();
-  ShowAccesses(accessVec);
+  if (outputFormat == "table" && outputPath.empty())
+    ShowAccesses(accessVec);
+  else if (outputFormat != "none")
+  {
+    std::FILE* outFile = outputPath.empty() ? stdout : std::fopen(outputPath.c_str(), "wb");
+    if (outFile == NULL)
+    {
+      std::cerr << "Error opening output file." << std::endl;
+      std::cerr << "Exiting cache simulation." << std::endl;
+      return 1;
+    }
+
+    std::cout.flush();
+    {
+      OutputBuffer out(outFile);
+      if (outputFormat == "bitmap")
+        WriteHitBitmap(accessVec, out);
+      else if (outputFormat == "csv")
+        WriteAccessesCsv(accessVec, out);
+      else
+      {
+        //table written to a file goes through a string stream per block
+        std::ostringstream rows;
+        for (int i = 0; i < accessVec.size(); ++i)
+        {
+          rows << accessVec[i];
+          if (rows.tellp() > (1 << 15))
+          {
+            std::string block = rows.str();
+            out.Write(block.data(), block.size());
+            rows.str("");
+          }
+        }
+        std::string block = rows.str();
+        out.Write(block.data(), block.size());
+      }
+    }
+    if (outFile != stdout)
+      std::fclose(outFile);
+  }
   newCache.ShowSummary();
+
+  if (newCache.mshrNum > 0)
+    timing.ShowTiming();
+  if (dataTlb != NULL)
+    tlb.ShowSummary();
+
+  //PCs of a trace map to lines of the source it was recorded from
+  if (profileRows > 0)
+  {
+    std::vector<int> srcLines;
+    if (!sourcePath.empty() && !ReadSourceLines(sourcePath.c_str(), srcLines))
+      std::cerr << "Error reading source file, showing no lines." << std::endl;
+    profile.ShowHotMisses(profileRows, srcLines);
+  }
   
   #ifdef DEBUG
 
   //Shows contents of each set's nextLineToEdit Vector
   //run through sets
-  for (int i = 0; i < cache.sets.size(); ++i)
+  for (int i = 0; i < newCache.sets.size(); ++i)
   {
     std::cout << "Set: " << i << std::endl;
     //run through lines
-    for (int j = 0; j < cache.sets[i].nextLineToEdit.size(); ++j)
+    for (int j = 0; j < newCache.sets[i].nextLineToEdit.size(); ++j)
     {  
       std::cout << "\tLine: " << j <<std::endl;;
       //run through bytes
-      for (std::list<int>::iterator k = cache.sets[i].nextLineToEdit.begin();
-           k != cache.sets[i].nextLineToEdit.end(); ++k)
+      for (std::list<int>::iterator k = newCache.sets[i].nextLineToEdit.begin();
+           k != newCache.sets[i].nextLineToEdit.end(); ++k)
         std::cout << "\t\t" << *k << " ";
       std::cout << std::endl;
     }
@@ -233,15 +856,27 @@ int main(int argc, char* argv[])
  *            Cache Member Definitions            *
  *************************************************/
 
-Cache::Cache(int maxLines, int maxBytes, int cacheSize) : maxLines(maxLines), maxBytes(maxBytes),
-                                                          cacheSize(cacheSize), hits(0), misses(0)
+Cache::Cache(int maxLines, int maxBytes, int cacheSize,
+             IndexFunction::Kind indexKind, int sectorBytes) : maxLines(maxLines), maxBytes(maxBytes),
+                                                               cacheSize(cacheSize),
+                                                               sectorBytes(sectorBytes),
+                                                               hits(0), misses(0), tagMisses(0),
+                                                               sectorMisses(0), bytesFetched(0),
+                                                               bytesWrittenBack(0), useClock(0),
+                                                               hitLatency(0), missLatency(0),
+                                                               mshrNum(0)
 { 
   //caclulate number of sets
   setNum = cacheSize / (maxLines * maxBytes);
+
+  //plain bit fields cannot select between a non-power-of-two number of sets
+  if (indexKind == IndexFunction::BITS && setNum > 0 && (setNum & (setNum - 1)) != 0)
+    indexKind = IndexFunction::MOD;
+  indexFunction = IndexFunction(indexKind, setNum);
   
   //calculate number of indexBits
   //number of bits needed to select between number of sets
-  indexBits = std::log2(float(setNum));
+  indexBits = indexFunction.indexBits;
     
   //calculate number of offsetBits
   //number of bits needed to select between number of bytes in a line
@@ -251,6 +886,14 @@ Cache::Cache(int maxLines, int maxBytes, int cacheSize) : maxLines(maxLines), ma
   //assuming 32b address
   tagBits = 32 - indexBits - offsetBits;
 
+  //an unsectored line is a line with a single sector
+  if (this->sectorBytes <= 0)
+    this->sectorBytes = maxBytes;
+  sectorBits = 0;
+  while ((1 << sectorBits) < this->sectorBytes)
+    ++sectorBits;
+  sectorNum = maxBytes / this->sectorBytes;
+
   //create cache structure
   for (int i = 0; i < setNum; ++i)
   {
@@ -259,12 +902,58 @@ Cache::Cache(int maxLines, int maxBytes, int cacheSize) : maxLines(maxLines), ma
   }  
 }
 
-void Cache::EditCache(int index, int line, int offset, int newTagValue)
+std::string Cache::ConfigError()
+{
+  if (maxLines <= 0 || maxBytes <= 0 || cacheSize <= 0)
+    return "line count, line size and cache size must be positive";
+  if ((maxBytes & (maxBytes - 1)) != 0)
+    return "line size must be a power of two";
+  if (setNum <= 0)
+    return "cache is smaller than one set";
+  if (setNum * maxLines * maxBytes != cacheSize)
+    return "cache size must be a multiple of the set size";
+  if ((setNum & (setNum - 1)) != 0 && indexFunction.kind != IndexFunction::MOD)
+    return indexFunction.Name() + " indexing requires a power-of-two number of sets";
+  if ((sectorBytes & (sectorBytes - 1)) != 0 || sectorBytes > maxBytes)
+    return "sector size must be a power of two no larger than the line size";
+  if (sectorNum > 64)
+    return "a line may hold at most 64 sectors";
+  if (hitLatency < 0 || missLatency < 0 || mshrNum < 0 || (mshrNum == 0 && (hitLatency || missLatency)))
+    return "timing needs non-negative latencies and at least one MSHR";
+  return "";
+}
+
+void Cache::EditCache(int index, int line, int newTagValue)
 {
-  sets[index].EditSet(line,offset,newTagValue);
+  //dirty sectors of the evicted block go back to the next level
+  unsigned long long dirty = sets[index].lines[line].dirtySectors;
+  bytesWrittenBack += (long long)__builtin_popcountll(dirty) * sectorBytes;
+
+  sets[index].EditSet(line,newTagValue);
   return;
 }
 
+bool Cache::AccessSectors(Line& line, Access& access)
+{
+  //sectors spanned by [offset, offset + size), clipped to the line
+  int last = access.offset + (access.size > 0 ? access.size : 1) - 1;
+  if (last >= maxBytes)
+    last = maxBytes - 1;
+  int firstSector = access.offset >> sectorBits;
+  int lastSector = last >> sectorBits;
+  unsigned long long touched = (lastSector - firstSector == 63) ? ~0ULL :
+                               ((1ULL << (lastSector - firstSector + 1)) - 1) << firstSector;
+
+  //only the missing sectors are fetched
+  unsigned long long missing = touched & ~line.validSectors;
+  bytesFetched += (long long)__builtin_popcountll(missing) * sectorBytes;
+  line.validSectors |= touched;
+  if (access.accessType == "Write")
+    line.dirtySectors |= touched;
+
+  return missing == 0;
+}
+
 void Cache::ShowCache()
 {
   std::cout << "sets:" << std::endl;
@@ -275,11 +964,13 @@ void Cache::ShowCache()
     for (int j = 0; j < sets[i].lines.size(); ++j)
     {
       std::cout << "\t\t" << j << std::endl;
-      std::cout << "\t\tbytes:" << std::endl;
-      for (int k = 0; k < sets[i].lines[j].bytes.size(); ++k)
+      std::cout << "\t\ttag: " << sets[i].lines[j].GetTag() << std::endl;
+      std::cout << "\t\tsectors:" << std::endl;
+      for (int k = 0; k < sectorNum; ++k)
       {
-        std::cout << "\t\t\t" << k << std::endl;
-        std::cout << "\t\t\ttag: " << sets[i].lines[j].bytes[k] << std::endl;
+        std::cout << "\t\t\t" << k
+                  << ((sets[i].lines[j].validSectors >> k) & 1 ? " valid" : " invalid")
+                  << ((sets[i].lines[j].dirtySectors >> k) & 1 ? " dirty" : "") << std::endl;
       }
     }
   }
@@ -292,6 +983,10 @@ void Cache::ShowConfiguration()
   std::cout << "Line Size:  " << maxBytes << "B" << std::endl;
   std::cout << "Set Size:  " << maxLines << std::endl;
   std::cout << "Number of Sets:  " << setNum << std::endl;
+  if (indexFunction.kind != IndexFunction::BITS)
+    std::cout << "Index Function:  " << indexFunction.Name() << std::endl;
+  if (sectorNum > 1)
+    std::cout << "Sector Size:  " << sectorBytes << "B" << std::endl;
   
   return;
 }
@@ -310,6 +1005,15 @@ void Cache::ShowSummary()
   std::cout << "Total Misses:\t" << misses << std::endl;
   std::cout << "Hit Rate:\t" << std::setprecision(5) << float(hits) / float((hits + misses)) << std::endl;
   std::cout << "Miss Rate:\t" << std::setprecision(5) << float(misses) / float((hits + misses)) << std::endl;
+
+  //unsectored caches always fetch whole lines, traffic is misses * line size
+  if (sectorNum > 1)
+  {
+    std::cout << "Tag Misses:\t" << tagMisses << std::endl;
+    std::cout << "Sector Misses:\t" << sectorMisses << std::endl;
+    std::cout << "Bytes Fetched:\t" << bytesFetched << std::endl;
+    std::cout << "Bytes Written Back:\t" << bytesWrittenBack << std::endl;
+  }
 }
 
 
@@ -327,9 +1031,9 @@ Set::Set(int maxLines, int maxBytes) : maxLines(maxLines), nextLineToEdit(0)
   }
 }
 
-void Set::EditSet(int line, int offset, int newTagValue)
+void Set::EditSet(int line, int newTagValue)
 {
-  lines[line].EditByte(offset,newTagValue);
+  lines[line].EditTag(newTagValue);
   return;
 }
 
@@ -337,11 +1041,8 @@ bool Set::IsTagInSet(int tag)
 {
   for (int i = 0; i < lines.size(); ++i)
   {
-    for (int j = 0; j < lines[i].bytes.size(); ++j)
-    {
-      if(lines[i].GetTag(j) == tag)
-        return true;
-    }
+    if (lines[i].HasTag(tag))
+      return true;
   }
   return false;
 }
@@ -350,11 +1051,8 @@ int Set::GetLine(int tag)
 {
   for (int i = 0; i < lines.size(); ++i)
   {
-    for (int j = 0; j < lines[i].bytes.size(); ++j)
-    {
-      if (lines[i].GetTag(j) == tag)
-        return i;
-    }
+    if (lines[i].HasTag(tag))
+      return i;
   }
   return -1;
 }
@@ -363,111 +1061,1215 @@ int Set::GetLine(int tag)
  *            Line Member Definitions            *
  **************************************************/
 
-Line::Line(int maxBytes) : maxBytes(maxBytes)
+Line::Line(int maxBytes) : maxBytes(maxBytes), tag(-1), validSectors(0), dirtySectors(0),
+                           lastUse(0)
 {
-  for (int i = 0; i < maxBytes; ++i)
-  {
-    int newTag = -1;
-    bytes.push_back(newTag);
-  }
 }
 
-void Line::EditByte(int offset, int newTagValue)
+void Line::EditTag(int newTagValue)
 {
-  bytes[offset] = newTagValue;
+  tag = newTagValue;
+  validSectors = 0;
+  dirtySectors = 0;
   return;
 }
 
-int Line::GetTag(int offset)
+int Line::GetTag()
 {
-  return bytes[offset];
+  return tag;
 }
 
+bool Line::HasTag(int tag)
+{
+  return this->tag == tag;
+}
 
-/***************************************************
- *            Access Member Definitions            *
- **************************************************/
 
-Access::Access(int r, std::string aT, int s, int a) : referenceNum(r), size(s), address(a), tag(0), index(0), offset(0),
-                                                      hitOrMiss("Miss")
+/****************************************************
+ *            FlatCache Member Definitions           *
+ ***************************************************/
+
+FlatCache::FlatCache(const Cache& cache) : maxLines(cache.maxLines), maxBytes(cache.maxBytes),
+                                           offsetBits(cache.offsetBits),
+                                           sectorBytes(cache.sectorBytes),
+                                           sectorBits(cache.sectorBits),
+                                           indexFunction(cache.indexFunction),
+                                           tags(cache.setNum * cache.maxLines, -1),
+                                           validSectors(cache.setNum * cache.maxLines, 0),
+                                           dirtySectors(cache.setNum * cache.maxLines, 0),
+                                           stamps(cache.setNum * cache.maxLines, 0), clock(0),
+                                           wayIndex(cache.maxLines), hits(0), misses(0),
+                                           tagMisses(0), sectorMisses(0), bytesFetched(0),
+                                           bytesWrittenBack(0)
 {
-  if(aT == "R" || aT == "r")
+  //skewed lines start unused, at 0; set lines start in way order
+  if (indexFunction.kind == IndexFunction::SKEW)
+    return;
+  for (size_t i = 0; i < stamps.size(); ++i)
+    stamps[i] = i % maxLines;
+  clock = maxLines;
+}
+
+bool FlatCache::Process(Access& access)
+{
+  ++clock;
+  int line = -1;
+  bool hit = false;
+
+  //every way of a skewed cache is indexed differently
+  if (indexFunction.kind == IndexFunction::SKEW)
   {
-    accessType = "Read";
+    unsigned int block = access.address >> offsetBits;
+    int hitWay = -1;
+    for (int w = 0; w < maxLines; ++w)
+    {
+      wayIndex[w] = indexFunction.Index(block, w);
+      if (hitWay < 0 && tags[wayIndex[w] * maxLines + w] == access.tag)
+        hitWay = w;
+    }
+
+    //never used lines (stamp 0) go first, then the least recently used
+    int way = hitWay;
+    if (way < 0)
+    {
+      way = 0;
+      for (int w = 1; w < maxLines; ++w)
+      {
+        if (stamps[wayIndex[w] * maxLines + w] < stamps[wayIndex[way] * maxLines + way])
+          way = w;
+      }
+    }
+    line = wayIndex[way] * maxLines + way;
+    access.index = wayIndex[way];
+    hit = hitWay >= 0;
   }
   else
   {
-    accessType = "Write";
-  }
-}
-
-
-/**********************************************
- *            Function Definitions            *
- *********************************************/
+    int first = access.index * maxLines;
+    for (int w = 0; w < maxLines; ++w)
+    {
+      if (tags[first + w] == access.tag)
+      {
+        line = first + w;
+        hit = true;
+        break;
+      }
+    }
 
-Access parseAccess(std::string accessString, int referenceNum)
-{
-  boost::char_separator<char> delimeter(": ");
-  boost::tokenizer < boost::char_separator < char > > tokens(accessString,delimeter);
-  boost::tokenizer < boost::char_separator < char > >::iterator it = tokens.begin();
+    //least recently used line, the only line if direct mapped
+    if (!hit)
+    {
+      line = first;
+      for (int w = 1; w < maxLines; ++w)
+      {
+        if (stamps[first + w] < stamps[line])
+          line = first + w;
+      }
+    }
+  }
 
-  std::stringstream strs;
-  
-  while (it != tokens.end())
+  //tag present, hit only if every touched sector is too; on a tag miss
+  //dirty sectors of the evicted block go back to the next level
+  if (hit)
   {
-    //get Access values
-    std::string accessType = *it;
-    ++it;
-    std::string sizeStr = *it;
-    ++it;
-    std::string addressStr = *it;
-    ++it;
-    
-    //convert numerical data to int's
-    int size = stoi(sizeStr);
-    strs << addressStr << std::hex;
-    int address;
-    strs >> address;
+    hit = AccessSectors(line, access);
+    if (!hit)
+      ++sectorMisses;
+  }
+  else
+  {
+    access.evicted = tags[line] != -1;
+    bytesWrittenBack += (long long)__builtin_popcountll(dirtySectors[line]) * sectorBytes;
+    tags[line] = access.tag;
+    validSectors[line] = 0;
+    dirtySectors[line] = 0;
+    AccessSectors(line, access);
+    ++tagMisses;
+  }
+  stamps[line] = indexFunction.kind == IndexFunction::SKEW ? (unsigned int)clock : clock;
 
-    //create and return Access
-    Access newAccess = Access(referenceNum,accessType,size,address);
-    return newAccess;
+  if (hit)
+  {
+    ++hits;
+    access.hitOrMiss = "Hit";
   }
-  
+  else
+    ++misses;
+  return hit;
 }
 
-Cache ReadConfig(std::ifstream& configFile)
+void FlatCache::ProcessAccesses(std::vector<Access>& accessVec)
 {
-  //holds data from input file
-  std::string lineIn;
-  int maxLines;
-  int maxBytes;
-  int cacheSize;
-  
-  //read/store configuration file  
-  std::ws(configFile);
-  std::getline(configFile, lineIn);
-  maxLines = stoi(lineIn);
-  std::ws(configFile);
-  std::getline(configFile, lineIn);
-  maxBytes = stoi(lineIn);
-  std::ws(configFile);
-  std::getline(configFile, lineIn);
-  cacheSize = stoi(lineIn);
+  for (size_t i = 0; i < accessVec.size(); ++i)
+    Process(accessVec[i]);
+  return;
+}
 
-  Cache newCache = Cache(maxLines,maxBytes,cacheSize);
-  
-  return newCache;
+bool FlatCache::AccessSectors(int line, Access& access)
+{
+  //sectors spanned by [offset, offset + size), clipped to the line
+  int last = access.offset + (access.size > 0 ? access.size : 1) - 1;
+  if (last >= maxBytes)
+    last = maxBytes - 1;
+  int firstSector = access.offset >> sectorBits;
+  int lastSector = last >> sectorBits;
+  unsigned long long touched = (lastSector - firstSector == 63) ? ~0ULL :
+                               ((1ULL << (lastSector - firstSector + 1)) - 1) << firstSector;
+
+  unsigned long long missing = touched & ~validSectors[line];
+  bytesFetched += (long long)__builtin_popcountll(missing) * sectorBytes;
+  validSectors[line] |= touched;
+  if (access.accessType[0] == 'W')
+    dirtySectors[line] |= touched;
+
+  return missing == 0;
 }
 
-void ReadMemTrace(std::ifstream& memFile, std::vector<Access>& accessVec)
+void FlatCache::CopyCounters(Cache& cache)
 {
-  //holds data from input file
-  std::string lineIn;
+  cache.hits = hits;
+  cache.misses = misses;
+  cache.tagMisses = tagMisses;
+  cache.sectorMisses = sectorMisses;
+  cache.bytesFetched = bytesFetched;
+  cache.bytesWrittenBack = bytesWrittenBack;
+  return;
+}
 
-  //tracks reference number of memory access
-  int referenceNum = 0;
+std::string FlatCache::Compare(Cache& cache, const Access& access)
+{
+  //nothing is formatted unless a difference is found, ShowLines has the
+  //lines' contents
+  unsigned int block = access.address >> offsetBits;
+  bool skew = indexFunction.kind == IndexFunction::SKEW;
+  for (int w = 0; w < maxLines; ++w)
+  {
+    int index = skew ? indexFunction.Index(block, w) : access.index;
+    Line& line = cache.sets[index].lines[w];
+    int at = index * maxLines + w;
+    if (line.tag != tags[at] || line.validSectors != validSectors[at]
+        || line.dirtySectors != dirtySectors[at]
+        || (skew && line.lastUse != (unsigned int)stamps[at]))
+      return "set " + std::to_string(index) + " way " + std::to_string(w);
+  }
+
+  //the reference's LRU list must run in increasing stamp order; direct
+  //mapped sets never reorder theirs
+  if (!skew && maxLines > 1)
+  {
+    std::list<int>& lru = cache.sets[access.index].nextLineToEdit;
+    const unsigned long long* stamp = &stamps[access.index * maxLines];
+    std::list<int>::iterator k = lru.begin();
+    for (std::list<int>::iterator previous = k++; k != lru.end(); previous = k++)
+    {
+      if (stamp[*previous] > stamp[*k])
+        return "set " + std::to_string(access.index) + " LRU order";
+    }
+  }
+
+  if (cache.hits == hits && cache.misses == misses && cache.tagMisses == tagMisses
+      && cache.sectorMisses == sectorMisses && cache.bytesFetched == bytesFetched
+      && cache.bytesWrittenBack == bytesWrittenBack)
+    return "";
+  std::ostringstream diff;
+  diff << "counters " << cache.hits << "/" << cache.misses << "/" << cache.tagMisses << "/"
+       << cache.sectorMisses << "/" << cache.bytesFetched << "/" << cache.bytesWrittenBack
+       << " vs " << hits << "/" << misses << "/" << tagMisses << "/" << sectorMisses << "/"
+       << bytesFetched << "/" << bytesWrittenBack
+       << " (hits/misses/tag misses/sector misses/bytes fetched/bytes written back)";
+  return diff.str();
+}
+
+void FlatCache::ShowLines(Cache& cache, const Access& access)
+{
+  unsigned int block = access.address >> offsetBits;
+  bool skew = indexFunction.kind == IndexFunction::SKEW;
+  for (int engine = 0; engine < 2; ++engine)
+  {
+    std::cerr << (engine == 0 ? "Reference" : "Flat") << " engine:" << std::endl;
+    for (int w = 0; w < maxLines; ++w)
+    {
+      int index = skew ? indexFunction.Index(block, w) : access.index;
+      Line& line = cache.sets[index].lines[w];
+      int at = index * maxLines + w;
+      std::cerr << "  set " << index << " way " << w << ": tag " << std::hex
+                << (engine == 0 ? line.tag : tags[at]) << ", valid "
+                << (engine == 0 ? line.validSectors : validSectors[at]) << ", dirty "
+                << (engine == 0 ? line.dirtySectors : dirtySectors[at]) << std::dec;
+      if (engine == 1)
+        std::cerr << ", stamp " << stamps[at];
+      else if (skew)
+        std::cerr << ", last use " << line.lastUse;
+      std::cerr << std::endl;
+    }
+    if (engine == 0 && !skew)
+    {
+      std::list<int>& lru = cache.sets[access.index].nextLineToEdit;
+      std::cerr << "  LRU order:";
+      for (std::list<int>::iterator k = lru.begin(); k != lru.end(); ++k)
+        std::cerr << " " << *k;
+      std::cerr << std::endl;
+    }
+  }
+  return;
+}
+
+
+/******************************************************
+ *            IndexFunction Member Definitions        *
+ *****************************************************/
+
+IndexFunction::IndexFunction() : kind(BITS), setNum(1), indexBits(0), indexMask(0), divMagic(0)
+{
+}
+
+IndexFunction::IndexFunction(Kind kind, int setNum) : kind(kind), setNum(setNum), indexBits(0),
+                                                      indexMask(0), divMagic(0)
+{
+  //smallest number of bits able to hold every set number
+  while ((1LL << indexBits) < setNum)
+    ++indexBits;
+  indexMask = (unsigned int)((1LL << indexBits) - 1);
+
+  //a power-of-two modulus is just the low index bits
+  if (kind == MOD && (setNum & (setNum - 1)) == 0)
+    this->kind = BITS;
+
+  //Lemire's fastmod: with M = ceil(2^64 / d), for every 32b n
+  //n / d = (M * n) >> 64 and n % d = ((M * n mod 2^64) * d) >> 64
+  if (this->kind == MOD)
+    divMagic = 0xFFFFFFFFFFFFFFFFULL / (unsigned long long)setNum + 1;
+}
+
+bool IndexFunction::Parse(std::string name, Kind& kind)
+{
+  if (name == "bits")
+    kind = BITS;
+  else if (name == "mod")
+    kind = MOD;
+  else if (name == "xor")
+    kind = XOR;
+  else if (name == "skew")
+    kind = SKEW;
+  else
+    return false;
+  return true;
+}
+
+std::string IndexFunction::Name() const
+{
+  switch (kind)
+  {
+    case MOD:  return "mod";
+    case XOR:  return "xor";
+    case SKEW: return "skew";
+    default:   return "bits";
+  }
+}
+
+unsigned int IndexFunction::Index(unsigned int block, int way) const
+{
+  switch (kind)
+  {
+    case MOD:
+    {
+      unsigned long long low = divMagic * block;
+      return (unsigned int)(((unsigned __int128)low * (unsigned int)setNum) >> 64);
+    }
+
+    case XOR:
+    {
+      //fold every index-sized chunk of the tag onto the index bits
+      unsigned int index = block & indexMask;
+      if (indexBits == 0)
+        return 0;
+      for (unsigned int high = block >> indexBits; high != 0; high >>= indexBits)
+        index ^= high & indexMask;
+      return index;
+    }
+
+    case SKEW:
+    {
+      //odd multipliers, one per way; the top indexBits of the product are
+      //the best-mixed bits of the tag
+      static const unsigned int wayMultiplier[8] = { 0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du,
+                                                     0x27D4EB2Fu, 0x165667B1u, 0xD3A2646Du,
+                                                     0xFD7046C5u, 0xB55A4F09u };
+      if (indexBits == 0)
+        return 0;
+      unsigned int high = block >> indexBits;
+      unsigned int hash = (high * wayMultiplier[way & 7] + (unsigned int)(way >> 3)) >> (32 - indexBits);
+      return (block ^ hash) & indexMask;
+    }
+
+    default:
+      return block & indexMask;
+  }
+}
+
+unsigned int IndexFunction::Tag(unsigned int block) const
+{
+  //a set index together with the tag must identify the block;
+  //for hashed functions the low bits are recoverable from index ^ hash(tag)
+  if (kind == MOD)
+    return (unsigned int)(((unsigned __int128)divMagic * block) >> 64);
+  return block >> indexBits;
+}
+
+
+/***************************************************
+ *            Access Member Definitions            *
+ **************************************************/
+
+Access::Access(int r, std::string aT, int s, int a, unsigned int pc) : referenceNum(r), size(s), address(a), tag(0),
+                                                      index(0), offset(0), hitOrMiss("Miss"), pc(pc),
+                                                      evicted(false)
+{
+  if(aT == "R" || aT == "r")
+  {
+    accessType = "Read";
+  }
+  else
+  {
+    accessType = "Write";
+  }
+}
+
+
+/*****************************************************
+ *            TimingModel Member Definitions           *
+ ****************************************************/
+
+TimingModel::TimingModel(int hitLatency, int missLatency, int mshrNum) : hitLatency(hitLatency),
+                                                                         missLatency(missLatency),
+                                                                         mshrNum(mshrNum), cycle(0),
+                                                                         accesses(0), totalLatency(0),
+                                                                         stallCycles(0), primaryMisses(0),
+                                                                         mergedMisses(0),
+                                                                         occupancyCycles(mshrNum + 1, 0),
+                                                                         latencyCount(1024, 0)
+{
+  mshrs.reserve(mshrNum);
+}
+
+void TimingModel::AdvanceTo(long long time)
+{
+  //retire outstanding misses in completion order, charging the cycles
+  //between events to the occupancy they were spent at
+  while (!mshrs.empty())
+  {
+    int first = 0;
+    for (int i = 1; i < mshrs.size(); ++i)
+    {
+      if (mshrs[i].ready < mshrs[first].ready)
+        first = i;
+    }
+    if (mshrs[first].ready > time)
+      break;
+
+    occupancyCycles[mshrs.size()] += mshrs[first].ready - cycle;
+    cycle = mshrs[first].ready;
+    mshrs[first] = mshrs.back();
+    mshrs.pop_back();
+  }
+
+  if (time > cycle)
+  {
+    occupancyCycles[mshrs.size()] += time - cycle;
+    cycle = time;
+  }
+  return;
+}
+
+void TimingModel::Run(std::vector<Access>& accessVec, Cache& cache)
+{
+  Issue(accessVec, cache);
+  Drain();
+  return;
+}
+
+void TimingModel::Issue(std::vector<Access>& accessVec, Cache& cache)
+{
+  long long lastBin = latencyCount.size() - 1;
+
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    long long issue = cycle;
+    unsigned int block = accessVec[i].address >> cache.offsetBits;
+    long long done;
+
+    //a fill already in flight for this block serves the access,
+    //whatever the functional model decided
+    int pending = -1;
+    for (int m = 0; m < mshrs.size(); ++m)
+    {
+      if (mshrs[m].block == block)
+      {
+        pending = m;
+        break;
+      }
+    }
+
+    if (pending >= 0)
+    {
+      ++mergedMisses;
+      done = std::max(mshrs[pending].ready, issue + hitLatency);
+    }
+    else if (accessVec[i].hitOrMiss == "Hit")
+      done = issue + hitLatency;
+    else
+    {
+      //no free MSHR, hold issue until the earliest fill retires
+      if (mshrs.size() == mshrNum)
+      {
+        long long earliest = mshrs[0].ready;
+        for (int m = 1; m < mshrs.size(); ++m)
+          earliest = std::min(earliest, mshrs[m].ready);
+        stallCycles += earliest - cycle;
+        AdvanceTo(earliest);
+      }
+
+      ++primaryMisses;
+      Mshr newMshr = { block, cycle + hitLatency + missLatency };
+      mshrs.push_back(newMshr);
+      done = newMshr.ready;
+    }
+
+    long long latency = done - issue;
+    totalLatency += latency;
+    ++latencyCount[std::min(latency, lastBin)];
+    ++accesses;
+
+    //next access issues on the following cycle
+    AdvanceTo(cycle + 1);
+  }
+
+  return;
+}
+
+void TimingModel::Drain()
+{
+  //retire outstanding misses
+  long long last = cycle;
+  for (int m = 0; m < mshrs.size(); ++m)
+    last = std::max(last, mshrs[m].ready);
+  AdvanceTo(last);
+
+  return;
+}
+
+long long TimingModel::LatencyPercentile(double fraction)
+{
+  long long target = (long long)std::ceil(fraction * accesses);
+  long long seen = 0;
+  for (int l = 0; l < latencyCount.size(); ++l)
+  {
+    seen += latencyCount[l];
+    if (seen >= target && seen > 0)
+      return l;
+  }
+  return latencyCount.size() - 1;
+}
+
+void TimingModel::ShowTiming()
+{
+  std::cout << std::endl;
+  std::cout << "      Timing Summary" << std::endl;
+  std::cout << "**************************" << std::endl;
+  std::cout << "Hit Latency:\t" << hitLatency << std::endl;
+  std::cout << "Miss Latency:\t" << missLatency << std::endl;
+  std::cout << "MSHRs:\t\t" << mshrNum << std::endl;
+  std::cout << "Total Cycles:\t" << cycle << std::endl;
+  std::cout << "Stall Cycles:\t" << stallCycles << std::endl;
+  std::cout << "Primary Misses:\t" << primaryMisses << std::endl;
+  std::cout << "Merged Misses:\t" << mergedMisses << std::endl;
+  std::cout << "AMAT:\t\t" << std::setprecision(5)
+            << (accesses ? double(totalLatency) / double(accesses) : 0.0) << std::endl;
+  std::cout << "Latency p50:\t" << LatencyPercentile(0.50) << std::endl;
+  std::cout << "Latency p99:\t" << LatencyPercentile(0.99) << std::endl;
+  std::cout << "Latency max:\t" << LatencyPercentile(1.0)
+            << (latencyCount.back() ? "+" : "") << std::endl;
+
+  std::cout << std::endl;
+  std::cout << "MSHR Occupancy (busy: cycles)" << std::endl;
+  for (int k = 0; k < occupancyCycles.size(); ++k)
+  {
+    std::cout << std::right << std::setw(6) << k << ":  " << occupancyCycles[k] << "  ("
+              << std::setprecision(3) << (cycle ? 100.0 * occupancyCycles[k] / cycle : 0.0)
+              << "%)" << std::endl;
+  }
+  return;
+}
+
+
+/******************************************************
+ *            OutputBuffer Member Definitions           *
+ *****************************************************/
+
+OutputBuffer::OutputBuffer(std::FILE* file, size_t capacity) : file(file), buffer(capacity), used(0)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  Flush();
+}
+
+void OutputBuffer::Reserve(size_t bytes)
+{
+  if (used + bytes > buffer.size())
+    Flush();
+  return;
+}
+
+void OutputBuffer::Put(char c)
+{
+  Reserve(1);
+  buffer[used++] = c;
+  return;
+}
+
+void OutputBuffer::Write(const char* data, size_t bytes)
+{
+  //large blocks bypass the buffer
+  if (bytes > buffer.size())
+  {
+    Flush();
+    std::fwrite(data, 1, bytes, file);
+    return;
+  }
+  Reserve(bytes);
+  std::memcpy(&buffer[used], data, bytes);
+  used += bytes;
+  return;
+}
+
+void OutputBuffer::PutDec(unsigned int value)
+{
+  //digits are produced backwards into a scratch array
+  char digits[10];
+  int count = 0;
+  do
+  {
+    digits[count++] = char('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  Reserve(count);
+  while (count > 0)
+    buffer[used++] = digits[--count];
+  return;
+}
+
+void OutputBuffer::PutHex(unsigned int value, int width)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+
+  //significant nibbles, at least one and at least width
+  int nibbles = 1;
+  while (nibbles < 8 && (value >> (4 * nibbles)) != 0)
+    ++nibbles;
+  if (nibbles < width)
+    nibbles = width;
+
+  Reserve(nibbles);
+  for (int shift = 4 * (nibbles - 1); shift >= 0; shift -= 4)
+    buffer[used++] = hexDigits[(value >> shift) & 0xf];
+  return;
+}
+
+void OutputBuffer::Flush()
+{
+  if (used > 0)
+    std::fwrite(&buffer[0], 1, used, file);
+  used = 0;
+  std::fflush(file);
+  return;
+}
+
+
+/*****************************************************
+ *            PcProfile Member Definitions           *
+ ****************************************************/
+
+PcProfile::PcProfile() : table(256), used(0), time(0)
+{
+}
+
+PcProfile::Entry& PcProfile::Find(unsigned int pc)
+{
+  //keep at most three quarters of the slots in use
+  if (4 * (used + 1) > 3 * (int)table.size())
+  {
+    std::vector<Entry> old(2 * table.size());
+    old.swap(table);
+    used = 0;
+    for (int i = 0; i < old.size(); ++i)
+    {
+      if (old[i].accesses > 0)
+        Find(old[i].pc) = old[i];
+    }
+  }
+
+  //fibonacci hash, linear probing
+  unsigned int mask = table.size() - 1;
+  unsigned int slot = (pc * 2654435769u) & mask;
+  while (table[slot].accesses > 0 && table[slot].pc != pc)
+    slot = (slot + 1) & mask;
+
+  //a free slot; callers count an access in it straight away
+  if (table[slot].accesses == 0)
+  {
+    Entry empty = { pc, 0, 0, 0, 0, 0 };
+    table[slot] = empty;
+    ++used;
+  }
+  return table[slot];
+}
+
+void PcProfile::Mark(long long t, int delta)
+{
+  //grow by doubling
+  if (t >= (long long)latest.size())
+  {
+    long long size = std::max<long long>(1024, 2 * latest.size());
+    while (size <= t)
+      size *= 2;
+    Rebuild(size);
+  }
+
+  latest[t] += delta;
+  for (long long i = t + 1; i < (long long)marks.size(); i += i & -i)
+    marks[i] += delta;
+  return;
+}
+
+long long PcProfile::Prefix(long long t)
+{
+  long long sum = 0;
+  for (long long i = t + 1; i > 0; i -= i & -i)
+    sum += marks[i];
+  return sum;
+}
+
+void PcProfile::Rebuild(long long size)
+{
+  //the tree is rebuilt from latest in linear time
+  latest.resize(size, 0);
+  marks.assign(size + 1, 0);
+  for (long long i = 1; i <= size; ++i)
+  {
+    marks[i] += latest[i - 1];
+    long long parent = i + (i & -i);
+    if (parent <= size)
+      marks[parent] += marks[i];
+  }
+  return;
+}
+
+void PcProfile::Compact()
+{
+  //a distance counts the marks between two times, which renumbering in
+  //order keeps; marks is rebuilt anyway, so it holds the new numbers
+  long long live = 0;
+  for (long long t = 0; t < time; ++t)
+  {
+    marks[t] = live;
+    live += latest[t];
+  }
+  for (std::unordered_map<unsigned int, long long>::iterator it = lastTouch.begin();
+       it != lastTouch.end(); ++it)
+    it->second = marks[it->second];
+
+  std::vector<char>(std::max<long long>(1024, 2 * live), 0).swap(latest);
+  std::fill(latest.begin(), latest.begin() + live, 1);
+  std::vector<long long>().swap(marks);
+  Rebuild(latest.size());
+  time = live;
+  return;
+}
+
+void PcProfile::Add(const std::vector<Access>& accessVec, Cache& cache)
+{
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    //out of times, and at least half of them stale
+    if (time >= (long long)latest.size() && time >= 2 * (long long)lastTouch.size())
+      Compact();
+
+    Entry& entry = Find(accessVec[i].pc);
+    ++entry.accesses;
+    if (accessVec[i].hitOrMiss != "Hit")
+    {
+      ++entry.misses;
+      if (accessVec[i].evicted)
+        ++entry.evictions;
+    }
+
+    //distinct blocks marked since this block's previous access
+    unsigned int block = accessVec[i].address >> cache.offsetBits;
+    std::unordered_map<unsigned int, long long>::iterator last = lastTouch.find(block);
+    if (last == lastTouch.end())
+    {
+      ++entry.coldAccesses;
+      lastTouch[block] = time;
+    }
+    else
+    {
+      entry.reuseSum += Prefix(time - 1) - Prefix(last->second);
+      Mark(last->second, -1);
+      last->second = time;
+    }
+    Mark(time, 1);
+    ++time;
+  }
+  return;
+}
+
+void PcProfile::ShowHotMisses(int rows, const std::vector<int>& srcLines)
+{
+  //most misses first, ties in address order
+  std::vector<const Entry*> ranked;
+  for (int i = 0; i < table.size(); ++i)
+  {
+    if (table[i].accesses > 0)
+      ranked.push_back(&table[i]);
+  }
+  std::sort(ranked.begin(), ranked.end(), [](const Entry* a, const Entry* b)
+  {
+    return a->misses != b->misses ? a->misses > b->misses : a->pc < b->pc;
+  });
+
+  std::cout << std::endl;
+  std::cout << "      Hot Miss Report" << std::endl;
+  std::cout << "**************************" << std::endl;
+  std::cout << "Instructions:\t" << ranked.size() << std::endl;
+  std::cout << std::endl;
+  std::cout << std::left
+            << std::setw(6) << "Rank"
+            << std::setw(10) << "PC"
+            << std::setw(7) << "Line"
+            << std::setw(11) << "Accesses"
+            << std::setw(10) << "Misses"
+            << std::setw(11) << "Miss Rate"
+            << std::setw(11) << "Evictions"
+            << std::setw(9) << "Cold"
+            << "Avg Reuse" << std::endl;
+  std::cout << "*****************************************************************************"
+            << "***" << std::endl;
+
+  for (int r = 0; r < rows && r < ranked.size(); ++r)
+  {
+    const Entry& entry = *ranked[r];
+    std::ostringstream pc;
+    std::ostringstream line;
+    std::ostringstream reuse;
+    if (entry.pc == noPc)
+      pc << "-";
+    else
+      pc << std::hex << std::setfill('0') << std::setw(8) << entry.pc;
+    if (entry.pc != noPc && entry.pc / 4 < srcLines.size())
+      line << srcLines[entry.pc / 4];
+    else
+      line << "-";
+    if (entry.accesses > entry.coldAccesses)
+      reuse << std::setprecision(5) << double(entry.reuseSum) / double(entry.accesses - entry.coldAccesses);
+    else
+      reuse << "-";
+
+    std::cout << std::left
+              << std::setw(6) << r + 1
+              << std::setw(10) << pc.str()
+              << std::setw(7) << line.str()
+              << std::setw(11) << entry.accesses
+              << std::setw(10) << entry.misses
+              << std::setw(11) << std::setprecision(5) << float(entry.misses) / float(entry.accesses)
+              << std::setw(11) << entry.evictions
+              << std::setw(9) << entry.coldAccesses
+              << reuse.str() << std::endl;
+  }
+  return;
+}
+
+
+/**********************************************
+ *            Tlb Member Definitions            *
+ *********************************************/
+
+Tlb::Level::Level(int entries, int ways) : entries(entries), ways(ways),
+                                           setNum(ways > 0 ? entries / ways : 0),
+                                           pages(entries > 0 ? entries : 0, emptyPage),
+                                           stamps(entries > 0 ? entries : 0, 0),
+                                           hits(0), misses(0)
+{
+}
+
+bool Tlb::Level::Lookup(unsigned int key, unsigned long long clock)
+{
+  int base = (key >> 1) % setNum * ways;
+  for (int w = base; w < base + ways; ++w)
+  {
+    if (pages[w] == key)
+    {
+      stamps[w] = clock;
+      ++hits;
+      return true;
+    }
+  }
+  ++misses;
+  return false;
+}
+
+void Tlb::Level::Fill(unsigned int key, unsigned long long clock)
+{
+  //empty entries have stamp 0, so they go before any used one
+  int base = (key >> 1) % setNum * ways;
+  int victim = base;
+  for (int w = base + 1; w < base + ways; ++w)
+  {
+    if (stamps[w] < stamps[victim])
+      victim = w;
+  }
+  pages[victim] = key;
+  stamps[victim] = clock;
+  return;
+}
+
+Tlb::Tlb() : allHuge(false), nextFrame(0), nextTable(tableBase), clock(0), referenceNum(0),
+             walks(0), hugeWalks(0), walkReads(0), walkMisses(0), accesses(0)
+{
+}
+
+std::string Tlb::ConfigError()
+{
+  if (levels.empty())
+    return "at least one level is needed";
+  for (int i = 0; i < levels.size(); ++i)
+  {
+    if (levels[i].entries <= 0 || levels[i].ways <= 0)
+      return "entries and ways must be positive";
+    if (levels[i].entries % levels[i].ways != 0)
+      return "entries must be a multiple of ways";
+  }
+  unsigned int hugeMask = (1u << hugePageBits) - 1;
+  for (int i = 0; i < hugeRanges.size(); ++i)
+  {
+    if (((hugeRanges[i].first | hugeRanges[i].second) & hugeMask) != 0 ||
+        hugeRanges[i].first >= hugeRanges[i].second)
+      return "huge ranges must be non-empty and 2M aligned";
+  }
+  return "";
+}
+
+bool Tlb::IsHuge(unsigned int address)
+{
+  if (allHuge)
+    return true;
+  for (int i = 0; i < hugeRanges.size(); ++i)
+  {
+    if (address >= hugeRanges[i].first && address < hugeRanges[i].second)
+      return true;
+  }
+  return false;
+}
+
+unsigned int Tlb::Frame(unsigned int page, bool huge)
+{
+  unsigned int key = page << 1 | huge;
+  std::unordered_map<unsigned int, unsigned int>::iterator found = frames.find(key);
+  if (found != frames.end())
+    return found->second;
+
+  //2M frames are 2M aligned, the 4K frames skipped over stay unused
+  unsigned int bytes = 1u << (huge ? hugePageBits : smallPageBits);
+  nextFrame = (nextFrame + bytes - 1) & ~(bytes - 1);
+  if (nextFrame >= tableBase)
+    nextFrame = 0;
+  frames[key] = nextFrame;
+  nextFrame += bytes;
+  return nextFrame - bytes;
+}
+
+unsigned int Tlb::Table(int depth, unsigned long long prefix)
+{
+  //32 bit addresses need at most 2054 tables, far below the 1G reserved
+  unsigned long long key = (unsigned long long)depth << 40 | prefix;
+  std::unordered_map<unsigned long long, unsigned int>::iterator found = tables.find(key);
+  if (found != tables.end())
+    return found->second;
+  tables[key] = nextTable;
+  nextTable += 1u << smallPageBits;
+  return nextTable - (1u << smallPageBits);
+}
+
+void Tlb::Walk(const Access& access, bool huge)
+{
+  //PML4, PDPT and PD entries, then the PT entry of a 4K page; each
+  //table is found by the address bits above the ones indexing it
+  unsigned long long address = access.address;
+  int depth = huge ? 3 : 4;
+  unsigned int table = Table(0, 0);
+  for (int d = 0; d < depth; ++d)
+  {
+    int shift = 39 - 9 * d;
+    unsigned int entry = table + (unsigned int)((address >> shift) & 511) * 8;
+    translated.push_back(Access(referenceNum++, "R", 8, entry, access.pc));
+    walkRefs.push_back(1);
+    if (d + 1 < depth)
+      table = Table(d + 1, address >> shift);
+  }
+  ++walks;
+  if (huge)
+    ++hugeWalks;
+  walkReads += depth;
+  return;
+}
+
+void Tlb::Translate(std::vector<Access>& accessVec)
+{
+  translated.clear();
+  walkRefs.clear();
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    unsigned int address = accessVec[i].address;
+    bool huge = IsHuge(address);
+    int pageBits = huge ? hugePageBits : smallPageBits;
+    unsigned int page = address >> pageBits;
+    unsigned int key = page << 1 | huge;
+
+    //levels before the one that hit are filled, all of them after a walk
+    ++clock;
+    int level = 0;
+    while (level < levels.size() && !levels[level].Lookup(key, clock))
+      ++level;
+    if (level == levels.size())
+      Walk(accessVec[i], huge);
+    for (int k = 0; k < level; ++k)
+      levels[k].Fill(key, clock);
+
+    translated.push_back(std::move(accessVec[i]));
+    translated.back().referenceNum = referenceNum++;
+    translated.back().address = Frame(page, huge) | (address & ((1u << pageBits) - 1));
+    walkRefs.push_back(0);
+  }
+  accesses += accessVec.size();
+  accessVec.swap(translated);
+  return;
+}
+
+void Tlb::Account(const std::vector<Access>& accessVec)
+{
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    if (walkRefs[i] && accessVec[i].hitOrMiss != "Hit")
+      ++walkMisses;
+  }
+  return;
+}
+
+void Tlb::ShowSummary()
+{
+  std::cout << std::endl;
+  std::cout << "       TLB Summary" << std::endl;
+  std::cout << "**************************" << std::endl;
+  for (int i = 0; i < levels.size(); ++i)
+  {
+    Level& level = levels[i];
+    long long lookups = level.hits + level.misses;
+    std::cout << "Level " << i + 1 << ":\t" << level.entries << " entries, "
+              << level.ways << " ways" << std::endl;
+    std::cout << "  Hits:\t" << level.hits << std::endl;
+    std::cout << "  Misses:\t" << level.misses << std::endl;
+    std::cout << "  Miss Rate:\t" << std::setprecision(5)
+              << (lookups > 0 ? float(level.misses) / float(lookups) : 0.0f) << std::endl;
+  }
+
+  long long smallPages = 0;
+  for (std::unordered_map<unsigned int, unsigned int>::iterator it = frames.begin();
+       it != frames.end(); ++it)
+    smallPages += (it->first & 1) == 0;
+  std::cout << "Pages Touched:\t" << smallPages << " 4K, "
+            << (long long)frames.size() - smallPages << " 2M" << std::endl;
+  std::cout << "Page Walks:\t" << walks << std::endl;
+  if (hugeWalks > 0)
+    std::cout << "2M Page Walks:\t" << hugeWalks << std::endl;
+  std::cout << "Walks per 1000:\t" << std::setprecision(5)
+            << (accesses > 0 ? 1000.0f * walks / accesses : 0.0f) << std::endl;
+  std::cout << "Walk Reads:\t" << walkReads << std::endl;
+  std::cout << "Walk Read Misses:\t" << walkMisses << std::endl;
+  return;
+}
+
+
+/**********************************************
+ *            Function Definitions            *
+ *********************************************/
+
+Access parseAccess(std::string accessString, int referenceNum)
+{
+  boost::char_separator<char> delimeter(": ");
+  boost::tokenizer < boost::char_separator < char > > tokens(accessString,delimeter);
+  boost::tokenizer < boost::char_separator < char > >::iterator it = tokens.begin();
+
+  std::stringstream strs;
+  
+  while (it != tokens.end())
+  {
+    //get Access values
+    std::string accessType = *it;
+    ++it;
+    std::string sizeStr = *it;
+    ++it;
+    std::string addressStr = *it;
+    ++it;
+    
+    //convert numerical data to int's
+    int size = stoi(sizeStr);
+    strs << addressStr << std::hex;
+    int address;
+    strs >> address;
+
+    //optional fourth field, hex byte address of the instruction
+    unsigned int pc = noPc;
+    if (it != tokens.end())
+      pc = (unsigned int)std::stoul(*it, NULL, 16);
+
+    //create and return Access
+    Access newAccess = Access(referenceNum,accessType,size,address,pc);
+    return newAccess;
+  }
+
+  //empty line, treat as a zero sized read of address 0
+  return Access(referenceNum,"R",0,0);
+}
+
+Cache ReadConfig(std::ifstream& configFile)
+{
+  //holds data from input file
+  std::string lineIn;
+  int maxLines;
+  int maxBytes;
+  int cacheSize;
+  IndexFunction::Kind indexKind = IndexFunction::BITS;
+  int sectorBytes = 0;
+  bool timed = false;                             //any timing option given
+  int hitLatency = 1;                             //timing defaults
+  int missLatency = 100;
+  int mshrNum = 8;
+  
+  //read/store configuration file  
+  std::ws(configFile);
+  std::getline(configFile, lineIn);
+  maxLines = stoi(lineIn);
+  std::ws(configFile);
+  std::getline(configFile, lineIn);
+  maxBytes = stoi(lineIn);
+  std::ws(configFile);
+  std::getline(configFile, lineIn);
+  cacheSize = stoi(lineIn);
+
+  //optional "key value" lines follow the three required values
+  while (std::getline(configFile, lineIn))
+  {
+    std::stringstream option(lineIn);
+    std::string key;
+    std::string value;
+    if (!(option >> key >> value))
+      continue;
+
+    if (key == "index")
+    {
+      if (!IndexFunction::Parse(value, indexKind))
+        std::cerr << "Unknown index function \"" << value << "\", using bits." << std::endl;
+    }
+    else if (key == "sector")
+      sectorBytes = stoi(value);
+    else if (key == "hitLatency")
+    {
+      hitLatency = stoi(value);
+      timed = true;
+    }
+    else if (key == "missLatency")
+    {
+      missLatency = stoi(value);
+      timed = true;
+    }
+    else if (key == "mshrs")
+    {
+      mshrNum = stoi(value);
+      timed = true;
+    }
+    else
+      std::cerr << "Ignoring unknown configuration option \"" << key << "\"." << std::endl;
+  }
+
+  Cache newCache = Cache(maxLines,maxBytes,cacheSize,indexKind,sectorBytes);
+
+  //any timing option enables the timing model, the rest take defaults;
+  //values are kept as given so ConfigError rejects negative ones
+  if (timed)
+  {
+    newCache.hitLatency = hitLatency;
+    newCache.missLatency = missLatency;
+    newCache.mshrNum = mshrNum;
+  }
+  
+  return newCache;
+}
+
+Tlb ReadTlbConfig(std::ifstream& configFile)
+{
+  //holds data from input file
+  std::string lineIn;
+  Tlb newTlb;
+
+  //"level entries ways" per level, nearest the core first, then the
+  //optional "page 4k|2m" and any number of "huge start end" hex ranges
+  while (std::getline(configFile, lineIn))
+  {
+    std::stringstream option(lineIn);
+    std::string key;
+    if (!(option >> key))
+      continue;
+
+    if (key == "level")
+    {
+      int entries = 0;
+      int ways = 0;
+      option >> entries >> ways;
+      newTlb.levels.push_back(Tlb::Level(entries, ways));
+    }
+    else if (key == "page")
+    {
+      std::string value;
+      option >> value;
+      if (value == "2m" || value == "2M")
+        newTlb.allHuge = true;
+      else if (value != "4k" && value != "4K")
+        std::cerr << "Unknown page size \"" << value << "\", using 4k." << std::endl;
+    }
+    else if (key == "huge")
+    {
+      //an unreadable range is left empty for ConfigError to reject
+      unsigned int start = 0;
+      unsigned int end = 0;
+      option >> std::hex >> start >> end;
+      newTlb.hugeRanges.push_back(std::make_pair(start, end));
+    }
+    else
+      std::cerr << "Ignoring unknown TLB option \"" << key << "\"." << std::endl;
+  }
+
+  return newTlb;
+}
+
+void ReadMemTrace(std::ifstream& memFile, std::vector<Access>& accessVec)
+{
+  //holds data from input file
+  std::string lineIn;
+
+  //tracks reference number of memory access
+  int referenceNum = 0;
   
   //read each line of input file, create Access objects, push onto vector
   while (!memFile.eof())
@@ -486,8 +2288,25 @@ void ReadMemTrace(std::ifstream& memFile, std::vector<Access>& accessVec)
   return;
 }
 
-void ResolveAccessBits(std::vector<Access>& accessVec, Cache cache)
+void ResolveAccessBits(std::vector<Access>& accessVec, Cache& cache)
 {
+  //hashed and modulo index functions work on the block address, as do
+  //caches with a single set or one byte lines, for which the shifts below
+  //would be by 32; the switch is hoisted so each loop body stays branch free
+  if (cache.indexFunction.kind != IndexFunction::BITS || cache.indexBits == 0
+      || cache.offsetBits == 0)
+  {
+    IndexFunction& indexFunction = cache.indexFunction;
+    unsigned int offsetMask = (unsigned int)cache.maxBytes - 1;
+    for (int i = 0; i < accessVec.size(); ++i)
+    {
+      unsigned int block = accessVec[i].address >> cache.offsetBits;
+      accessVec[i].tag = indexFunction.Tag(block);
+      accessVec[i].index = indexFunction.Index(block, 0);
+      accessVec[i].offset = accessVec[i].address & offsetMask;
+    }
+    return;
+  }
 
   //for each access in accessVec
   for (int i = 0; i < accessVec.size(); ++i)
@@ -511,7 +2330,7 @@ void ResolveAccessBits(std::vector<Access>& accessVec, Cache cache)
   return;
 }
 
-void ShowAccesses(std::vector<Access> accessVec)
+void ShowAccesses(const std::vector<Access>& accessVec)
 {
   
   std::cout << std::endl;
@@ -530,20 +2349,98 @@ void ShowAccesses(std::vector<Access> accessVec)
   {
     std::cout << accessVec[i];
   }
+  std::cout.flush();
   
   return;
 }
 
+void WriteAccessesCsv(const std::vector<Access>& accessVec, OutputBuffer& out)
+{
+  static const char header[] = "ref,type,address,tag,index,offset,result\n";
+  out.Write(header, sizeof(header) - 1);
+
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    const Access& access = accessVec[i];
+    bool write = access.accessType == "Write";
+    bool hit = access.hitOrMiss == "Hit";
+
+    out.PutDec(access.referenceNum);
+    out.Write(write ? ",Write," : ",Read,", write ? 7 : 6);
+    out.PutHex(access.address, 8);
+    out.Put(',');
+    out.PutHex(access.tag, 1);
+    out.Put(',');
+    out.PutDec(access.index);
+    out.Put(',');
+    out.PutDec(access.offset);
+    out.Write(hit ? ",Hit\n" : ",Miss\n", hit ? 5 : 6);
+  }
+  return;
+}
+
+void WriteHitBitmap(const std::vector<Access>& accessVec, OutputBuffer& out)
+{
+  //header: "CHMB" then the access count as 8 little-endian bytes,
+  //followed by one bit per access, least significant bit first
+  unsigned long long count = accessVec.size();
+  out.Write("CHMB", 4);
+  for (int b = 0; b < 8; ++b)
+    out.Put(char((count >> (8 * b)) & 0xff));
+
+  unsigned char bits = 0;
+  for (size_t i = 0; i < accessVec.size(); ++i)
+  {
+    if (accessVec[i].hitOrMiss == "Hit")
+      bits |= (unsigned char)(1 << (i & 7));
+    if ((i & 7) == 7)
+    {
+      out.Put(char(bits));
+      bits = 0;
+    }
+  }
+  if ((accessVec.size() & 7) != 0)
+    out.Put(char(bits));
+  return;
+}
+
 void ProcessAccesses(std::vector<Access>& accessVec, Cache& cache)
 {
+  //every way of a skewed cache is indexed differently, sets do not apply
+  if (cache.indexFunction.kind == IndexFunction::SKEW)
+  {
+    ProcessSkewedAccesses(accessVec, cache);
+    return;
+  }
+
   int maxLines = cache.maxLines;
   
   for(int i = 0; i < accessVec.size(); ++i)
   {
+    Set& set = cache.sets[accessVec[i].index];
+
     //determines if Access is already in cache,
     //marks Access with result
-    bool hit;
-    hit = cache.HitOrMiss(accessVec[i]);
+    int line = set.GetLine(accessVec[i].tag);
+    bool hit = false;
+    if (line >= 0)
+    {
+      //tag present, hit only if every touched sector is too
+      hit = cache.AccessSectors(set.lines[line], accessVec[i]);
+      if (!hit)
+        ++cache.sectorMisses;
+    }
+    else
+    {
+      //tag miss, replace least recently used line (the only line if
+      //direct mapped) and fetch just the touched sectors
+      line = set.nextLineToEdit.front();
+      accessVec[i].evicted = set.lines[line].tag != -1;
+      cache.EditCache(accessVec[i].index,line,accessVec[i].tag);
+      cache.AccessSectors(set.lines[line], accessVec[i]);
+      ++cache.tagMisses;
+    }
+
     if(hit)
     {
       ++cache.hits;
@@ -554,34 +2451,361 @@ void ProcessAccesses(std::vector<Access>& accessVec, Cache& cache)
 
     //if - direct mapped cache (single line in set); no use for LRU logic
     if (maxLines == 1)
-    {
-      cache.EditCache(accessVec[i].index,0,accessVec[i].offset,accessVec[i].tag);
       continue;
-    }
 
-    //else - associative cache; use least recently used logic to determine which
-    //lines to update
+    //else - associative cache; move used line to the back of the LRU list
+    if (set.nextLineToEdit.front() == line)
+      set.nextLineToEdit.pop_front();
     else
+      set.nextLineToEdit.remove(line);
+    set.nextLineToEdit.push_back(line);
+  }
+  
+  return;
+}
+
+void ProcessSkewedAccesses(std::vector<Access>& accessVec, Cache& cache)
+{
+  int maxLines = cache.maxLines;
+  IndexFunction& indexFunction = cache.indexFunction;
+
+  //way w of the cache is column w of the set array; a block may only live
+  //in sets[Index(block, w)].lines[w]
+  std::vector<unsigned int> wayIndex(maxLines);
+
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    unsigned int block = accessVec[i].address >> cache.offsetBits;
+    int tag = accessVec[i].tag;
+    ++cache.useClock;
+
+    int hitWay = -1;
+    for (int w = 0; w < maxLines; ++w)
     {
-      if(hit)
+      wayIndex[w] = indexFunction.Index(block, w);
+      if (hitWay < 0 && cache.sets[wayIndex[w]].lines[w].HasTag(tag))
+        hitWay = w;
+    }
+
+    if (hitWay >= 0)
+    {
+      Line& line = cache.sets[wayIndex[hitWay]].lines[hitWay];
+      accessVec[i].index = wayIndex[hitWay];
+      line.lastUse = cache.useClock;
+      if (cache.AccessSectors(line, accessVec[i]))
       {
-        //get line where tag is found, remove it from list, add it to the end
-        int tagFoundAt = cache.sets[accessVec[i].index].GetLine(accessVec[i].tag);
-        cache.sets[accessVec[i].index].nextLineToEdit.remove(tagFoundAt);
-        cache.sets[accessVec[i].index].nextLineToEdit.push_back(tagFoundAt);
+        ++cache.hits;
+        accessVec[i].hitOrMiss = "Hit";
       }
-
       else
       {
-        int front = cache.sets[accessVec[i].index].nextLineToEdit.front();
-        cache.EditCache(accessVec[i].index,front,accessVec[i].offset,accessVec[i].tag);
-        cache.sets[accessVec[i].index].nextLineToEdit.pop_front();
-        cache.sets[accessVec[i].index].nextLineToEdit.push_back(front);
+        ++cache.sectorMisses;
+        ++cache.misses;
       }
+      continue;
+    }
+    ++cache.tagMisses;
+    ++cache.misses;
+
+    //replace the least recently used of the candidate lines,
+    //never used lines (lastUse 0) go first
+    int victim = 0;
+    for (int w = 1; w < maxLines; ++w)
+    {
+      if (cache.sets[wayIndex[w]].lines[w].lastUse < cache.sets[wayIndex[victim]].lines[victim].lastUse)
+        victim = w;
     }
+
+    accessVec[i].index = wayIndex[victim];
+    accessVec[i].evicted = cache.sets[wayIndex[victim]].lines[victim].tag != -1;
+    cache.EditCache(wayIndex[victim],victim,tag);
+    cache.sets[wayIndex[victim]].lines[victim].lastUse = cache.useClock;
+    cache.AccessSectors(cache.sets[wayIndex[victim]].lines[victim], accessVec[i]);
   }
-  
+
   return;
 }
 
+bool VerifyAccesses(std::vector<Access>& accessVec, Cache& cache, FlatCache& flat)
+{
+  //the reference runs one access at a time through a reused one element
+  //vector, so both engines stop at the same access
+  std::vector<Access> one;
+  for (int i = 0; i < accessVec.size(); ++i)
+  {
+    Access fast = accessVec[i];
+    one.assign(1, accessVec[i]);
+    ProcessAccesses(one, cache);
+    flat.Process(fast);
+    Access& reference = accessVec[i] = one[0];
+
+    std::string difference;
+    if (reference.hitOrMiss != fast.hitOrMiss)
+      difference = reference.hitOrMiss + " vs " + fast.hitOrMiss;
+    else if (reference.evicted != fast.evicted)
+      difference = std::string("eviction ") + (reference.evicted ? "yes" : "no") + " vs "
+                   + (fast.evicted ? "yes" : "no");
+    else if (reference.index != fast.index)
+      difference = "set " + std::to_string(reference.index) + " vs " + std::to_string(fast.index);
+    else
+      difference = flat.Compare(cache, reference);
+    if (!difference.empty())
+    {
+      std::cerr << "Engines differ at access " << reference.referenceNum << ": " << difference
+                << "." << std::endl;
+      std::cerr << reference;
+      flat.ShowLines(cache, reference);
+      return false;
+    }
+  }
+  return true;
+}
+
+int FuzzEngines(int runs, unsigned int seed)
+{
+  static const int wayChoices[] = { 1, 2, 3, 4, 5, 8, 16 };
+  long long accesses = 0;
+  int configs = 0;
+  for (int run = 0; run < runs; ++run)
+  {
+    //geometry, index function and sectors; the few invalid mixes are skipped
+    std::mt19937 random(seed + run);
+    int maxLines = wayChoices[random() % 7];
+    int maxBytes = 1 << (random() % 8);
+    IndexFunction::Kind indexKind = IndexFunction::Kind(random() % 4);
+    int setNum = indexKind == IndexFunction::MOD ? 1 + random() % 300 : 1 << (random() % 9);
+    int sectorBytes = random() % 2 ? 0 : maxBytes >> (random() % 7);
+    Cache cache(maxLines, maxBytes, setNum * maxLines * maxBytes, indexKind, sectorBytes);
+    if (!cache.ConfigError().empty())
+      continue;
+
+    //hot regions a few times the cache's size, line-sized strides, random
+    //addresses anywhere, and sizes that cross lines
+    std::vector<Access> accessVec;
+    unsigned int hot[4] = { (unsigned int)random(), (unsigned int)random(), 0,
+                            0xffffffffu - 4 * (unsigned int)cache.cacheSize };
+    unsigned int footprint = cache.cacheSize * (1 + random() % 4);
+    unsigned int address = 0;
+    int count = 1 + random() % 4000;
+    for (int i = 0; i < count; ++i)
+    {
+      int pattern = random() % 8;
+      if (pattern < 5)
+        address = hot[random() % 4] + random() % footprint;
+      else if (pattern < 7)
+        address += maxBytes;
+      else
+        address = random();
+      int size = random() % 3 == 0 ? random() % (2 * maxBytes + 1) : 4;
+      accessVec.push_back(Access(i, random() % 3 == 0 ? "W" : "R", size, (int)address));
+    }
+
+    ResolveAccessBits(accessVec, cache);
+    FlatCache flat(cache);
+    if (!VerifyAccesses(accessVec, cache, flat))
+    {
+      std::cerr << maxLines << " lines of " << maxBytes << "B, " << setNum << " sets, "
+                << cache.indexFunction.Name() << " indexing, " << cache.sectorBytes
+                << "B sectors; rerun alone with --fuzz=1 --seed=" << seed + run << "."
+                << std::endl;
+      return 1;
+    }
+    accesses += count;
+    ++configs;
+  }
+  std::cout << configs << " configurations, " << accesses << " accesses: engines agree."
+            << std::endl;
+  return 0;
+}
+
+bool IsProgram(std::string path)
+{
+  return path.size() > 2 && path.compare(path.size() - 2, 2, ".s") == 0;
+}
+
+bool SimulateBatch(std::vector<Access>& accessVec, Cache& cache, FlatCache* flat, bool verify,
+                   TimingModel& timing, PcProfile* profile, Tlb* tlb)
+{
+  if (tlb != NULL)
+    tlb->Translate(accessVec);
+  ResolveAccessBits(accessVec, cache);
+  if (flat == NULL)
+    ProcessAccesses(accessVec, cache);
+  else if (!verify)
+    flat->ProcessAccesses(accessVec);
+  else if (!VerifyAccesses(accessVec, cache, *flat))
+    return false;
+  if (cache.mshrNum > 0)
+    timing.Issue(accessVec, cache);
+  if (profile != NULL)
+    profile->Add(accessVec, cache);
+  if (tlb != NULL)
+    tlb->Account(accessVec);
+  return true;
+}
+
+int SimulateProgram(const char* path, Cache& dataCache, Cache* instCache, bool bench,
+                    int profileRows, std::string engine, bool verify, Tlb* tlb)
+{
+  std::ifstream sourceFile;
+  sourceFile.open(path);
+  if (!sourceFile.is_open())
+  {
+    std::cerr << "Error opening program file." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+
+  //assemble in memory, text then data form the loaded image
+  std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
+  std::stringstream source;
+  source << sourceFile.rdbuf();
+  Assembly assembly = Assemble(source.str());
+  for (int i = 0; i < assembly.diagnostics.size(); ++i)
+    std::cerr << assembly.diagnostics[i] << std::endl;
+  if (!assembly.ok)
+  {
+    std::cerr << "Error assembling program." << std::endl;
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  std::vector<unsigned int> image = assembly.text;
+  image.insert(image.end(), assembly.data.begin(), assembly.data.end());
+
+  //a megabyte of stack above the data, as the assembler's --run gives
+  Machine machine;
+  machine.Load(image, assembly.text.size(), 1 << 18);
+
+  TimingModel dataTiming(dataCache.hitLatency, dataCache.missLatency, dataCache.mshrNum);
+  TimingModel instTiming(instCache ? instCache->hitLatency : 0,
+                         instCache ? instCache->missLatency : 0,
+                         instCache ? instCache->mshrNum : 0);
+  PcProfile dataProfile;
+  PcProfile instProfile;
+
+  //fast engines, one per cache, only when selected
+  std::vector<FlatCache> flats;
+  if (engine == "flat")
+  {
+    flats.push_back(FlatCache(dataCache));
+    if (instCache != NULL)
+      flats.push_back(FlatCache(*instCache));
+  }
+  FlatCache* dataFlat = flats.empty() ? NULL : &flats[0];
+  FlatCache* instFlat = flats.size() > 1 ? &flats[1] : NULL;
+
+  //each batch of references becomes one batch of word sized accesses
+  //per cache; the vectors are reused so only the first batch allocates
+  std::vector<Access> dataVec;
+  std::vector<Access> instVec;
+  int dataRefs = 0;
+  int instRefs = 0;
+  bool agreed = true;                             //false once --verify failed
+  std::chrono::steady_clock::time_point simStart = std::chrono::steady_clock::now();
+  StopReason stop = machine.Trace(std::cin, std::cout, instCache != NULL, 1 << 16,
+                                  [&](const std::vector<MemRef>& batch)
+  {
+    //after a failed check the program runs on, unsimulated
+    if (!agreed)
+      return;
+    dataVec.clear();
+    instVec.clear();
+    for (int i = 0; i < batch.size(); ++i)
+    {
+      if (batch[i].kind == 'I')
+        instVec.push_back(Access(instRefs++, "R", 4, batch[i].address, 4 * batch[i].pc));
+      else
+        dataVec.push_back(Access(dataRefs++, batch[i].kind == 'W' ? "W" : "R", 4,
+                                 batch[i].address, 4 * batch[i].pc));
+    }
+    agreed = SimulateBatch(dataVec, dataCache, dataFlat, verify, dataTiming,
+                           profileRows > 0 ? &dataProfile : NULL, tlb)
+             && (instCache == NULL || SimulateBatch(instVec, *instCache, instFlat, verify,
+                                                    instTiming,
+                                                    profileRows > 0 ? &instProfile : NULL,
+                                                    NULL));
+  });
+  if (dataCache.mshrNum > 0)
+    dataTiming.Drain();
+  if (instCache != NULL && instCache->mshrNum > 0)
+    instTiming.Drain();
+  std::chrono::steady_clock::time_point simEnd = std::chrono::steady_clock::now();
+  std::cout << std::flush;
+  if (!agreed)
+  {
+    std::cerr << "Exiting cache simulation." << std::endl;
+    return 1;
+  }
+  if (dataFlat != NULL && !verify)
+    dataFlat->CopyCounters(dataCache);
+  if (instFlat != NULL && !verify)
+    instFlat->CopyCounters(*instCache);
+
+  //how the program stopped; the cache results stand either way
+  if (stop == STOP_FAULT)
+    std::cerr << std::endl << "Instruction " << machine.pc << ": " << machine.fault << "."
+              << std::endl;
+  else if (stop == STOP_END)
+    std::cerr << std::endl << "Program left the text segment." << std::endl;
+  std::cerr << "Executed " << machine.executed << " instructions, " << dataRefs
+            << " data and " << instRefs << " fetch references." << std::endl;
+
+  //assembly counts as reading, execution and cache work as simulating
+  if (bench)
+  {
+    double readSeconds = std::chrono::duration<double>(simStart - readStart).count();
+    double simSeconds = std::chrono::duration<double>(simEnd - simStart).count();
+    long long accesses = (long long)dataRefs + instRefs;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cerr << "bench: accesses=" << accesses
+              << " read_s=" << readSeconds
+              << " sim_s=" << simSeconds
+              << " sim_accesses_per_s=" << (simSeconds > 0 ? accesses / simSeconds : 0)
+              << " total_accesses_per_s="
+              << (readSeconds + simSeconds > 0 ? accesses / (readSeconds + simSeconds) : 0)
+              << " peak_rss_kb=" << usage.ru_maxrss << std::endl;
+  }
+
+  if (instCache != NULL)
+    std::cout << std::endl << "Data Cache" << std::endl;
+  dataCache.ShowConfiguration();
+  dataCache.ShowSummary();
+  if (dataCache.mshrNum > 0)
+    dataTiming.ShowTiming();
+  if (profileRows > 0)
+    dataProfile.ShowHotMisses(profileRows, assembly.srcLines);
+  if (tlb != NULL)
+    tlb->ShowSummary();
+
+  if (instCache != NULL)
+  {
+    std::cout << std::endl << "Instruction Cache" << std::endl;
+    instCache->ShowConfiguration();
+    instCache->ShowSummary();
+    if (instCache->mshrNum > 0)
+      instTiming.ShowTiming();
+    if (profileRows > 0)
+      instProfile.ShowHotMisses(profileRows, assembly.srcLines);
+  }
+  return 0;
+}
+
+bool ReadSourceLines(const char* path, std::vector<int>& srcLines)
+{
+  std::ifstream sourceFile;
+  sourceFile.open(path);
+  if (!sourceFile.is_open())
+    return false;
+
+  std::stringstream source;
+  source << sourceFile.rdbuf();
+  Assembly assembly = Assemble(source.str());
+  if (!assembly.ok)
+    return false;
+  srcLines.swap(assembly.srcLines);
+  return true;
+}
+
 #endif
@@ -0,0 +1,337 @@
+/**
+ * @file   tracegen.cpp
+ * @brief  Synthetic memory trace generator
+ *
+ * @description
+ * This program writes reproducible memory traces in the
+ * cache simulator's "R:size:address" format. The same
+ * pattern, count and seed always produce the same trace.
+ *
+ * usage: tracegen pattern count [key=value ...]
+ *
+ *   patterns  seq     sequential stream
+ *             stride  fixed stride, wraps at footprint
+ *             random  uniform random within footprint
+ *             zipf    Zipfian popularity over footprint/grain items
+ *             chase   pointer chase through a random cycle
+ *             mix     each access drawn from one of the above
+ *
+ *   options   seed=N        generator seed              (default 1)
+ *             footprint=N   bytes touched               (default 1048576)
+ *             stride=N      bytes between accesses      (default 64)
+ *             grain=N       item size, zipf/chase/random (default 64)
+ *             size=N        access size in bytes        (default 4)
+ *             writes=F      fraction of writes, 0 - 1   (default 0.3)
+ *             alpha=F       zipf skew                   (default 0.99)
+ *             base=HEX      address of first byte       (default 10000000)
+ *             out=FILE      output file                 (default stdout)
+ *****************************************************/
+
+#ifndef tracegen_CPP
+#define tracegen_CPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+
+/***************************************
+ *          Random  Class              *
+ **************************************/
+
+//splitmix64; portable so traces are identical across standard libraries
+struct Random
+{
+  unsigned long long state;                       //generator state
+
+  Random(unsigned long long seed);                //default constructor
+  unsigned long long Next();                      //next 64 random bits
+  unsigned int Below(unsigned int bound);         //uniform in [0, bound)
+  double Unit();                                  //uniform in [0, 1)
+};
+
+
+/***************************************
+ *          TraceGen  Class            *
+ **************************************/
+
+struct TraceGen
+{
+  enum Pattern { SEQ, STRIDE, RANDOM, ZIPF, CHASE, MIX };
+
+  Pattern pattern;                                //access pattern
+  unsigned int footprint;                         //bytes touched
+  unsigned int stride;                            //bytes between accesses
+  unsigned int grain;                             //item size in bytes
+  unsigned int size;                              //access size
+  double writes;                                  //fraction of writes
+  double alpha;                                   //zipf skew
+  unsigned int base;                              //first address
+  Random random;                                  //shared generator
+
+  unsigned int cursor;                            //seq/stride position
+  unsigned int chaseAt;                           //current chase item
+  std::vector<unsigned int> chaseNext;            //chase successor of each item
+  std::vector<double> zipfCdf;                    //cumulative popularity by rank
+  std::vector<unsigned int> zipfItem;             //item holding each rank
+
+  TraceGen(Pattern pattern, unsigned long long seed);  //default constructor
+  static bool Parse(std::string name, Pattern& pattern);  //name -> pattern, false if unknown
+  void Prepare();                                 //build chase/zipf tables
+  unsigned int Items();                           //footprint / grain
+  unsigned int NextAddress(Pattern kind);         //address of next access of kind
+};
+
+
+/***************************************
+ *          Random Definitions         *
+ **************************************/
+
+Random::Random(unsigned long long seed) : state(seed)
+{
+}
+
+unsigned long long Random::Next()
+{
+  unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+unsigned int Random::Below(unsigned int bound)
+{
+  //multiply-shift, bias is below 2^-32
+  return (unsigned int)(((Next() >> 32) * bound) >> 32);
+}
+
+double Random::Unit()
+{
+  return (Next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/***************************************
+ *          TraceGen Definitions       *
+ **************************************/
+
+TraceGen::TraceGen(Pattern pattern, unsigned long long seed) : pattern(pattern),
+                                                              footprint(1 << 20), stride(64),
+                                                              grain(64), size(4), writes(0.3),
+                                                              alpha(0.99), base(0x10000000),
+                                                              random(seed), cursor(0),
+                                                              chaseAt(0)
+{
+}
+
+bool TraceGen::Parse(std::string name, Pattern& pattern)
+{
+  static const char* names[] = { "seq", "stride", "random", "zipf", "chase", "mix" };
+  for (int i = 0; i < 6; ++i)
+  {
+    if (name == names[i])
+    {
+      pattern = Pattern(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int TraceGen::Items()
+{
+  return std::max(1u, footprint / grain);
+}
+
+void TraceGen::Prepare()
+{
+  unsigned int items = Items();
+
+  //Sattolo's algorithm gives a single cycle through every item
+  if (pattern == CHASE || pattern == MIX)
+  {
+    std::vector<unsigned int> order(items);
+    for (unsigned int i = 0; i < items; ++i)
+      order[i] = i;
+    for (unsigned int i = items - 1; i > 0; --i)
+      std::swap(order[i], order[random.Below(i)]);
+    chaseNext.assign(items, 0);
+    for (unsigned int i = 0; i < items; ++i)
+      chaseNext[order[i]] = order[(i + 1) % items];
+  }
+
+  //popularity of rank r is 1 / (r + 1)^alpha; ranks are scattered over
+  //the footprint so hot items do not share lines
+  if (pattern == ZIPF || pattern == MIX)
+  {
+    zipfCdf.resize(items);
+    double total = 0;
+    for (unsigned int r = 0; r < items; ++r)
+    {
+      total += 1.0 / std::pow(double(r + 1), alpha);
+      zipfCdf[r] = total;
+    }
+    for (unsigned int r = 0; r < items; ++r)
+      zipfCdf[r] /= total;
+
+    zipfItem.resize(items);
+    for (unsigned int i = 0; i < items; ++i)
+      zipfItem[i] = i;
+    for (unsigned int i = items - 1; i > 0; --i)
+      std::swap(zipfItem[i], zipfItem[random.Below(i + 1)]);
+  }
+  return;
+}
+
+unsigned int TraceGen::NextAddress(Pattern kind)
+{
+  switch (kind)
+  {
+    case SEQ:
+    {
+      unsigned int address = base + cursor;
+      cursor = (cursor + size) % footprint;
+      return address;
+    }
+    case STRIDE:
+    {
+      unsigned int address = base + cursor;
+      cursor = (cursor + stride) % footprint;
+      return address;
+    }
+    case RANDOM:
+      return base + random.Below(Items()) * grain;
+    case ZIPF:
+    {
+      double u = random.Unit();
+      unsigned int rank = std::lower_bound(zipfCdf.begin(), zipfCdf.end(), u) - zipfCdf.begin();
+      if (rank >= zipfItem.size())
+        rank = zipfItem.size() - 1;
+      return base + zipfItem[rank] * grain;
+    }
+    case CHASE:
+      chaseAt = chaseNext[chaseAt];
+      return base + chaseAt * grain;
+    default:
+      //mix, any of the single patterns
+      return NextAddress(Pattern(random.Below(5)));
+  }
+}
+
+
+/******************************
+ *            Main            *
+ *****************************/
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " seq|stride|random|zipf|chase|mix count [key=value ...]"
+              << std::endl;
+    return 1;
+  }
+
+  TraceGen::Pattern pattern;
+  if (!TraceGen::Parse(argv[1], pattern))
+  {
+    std::cerr << "Unknown pattern " << argv[1] << "." << std::endl;
+    return 1;
+  }
+  unsigned long long count = std::strtoull(argv[2], NULL, 10);
+
+  //options
+  unsigned long long seed = 1;
+  std::string outPath;
+  for (int i = 3; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg.compare(0, 5, "seed=") == 0)
+      seed = std::strtoull(arg.c_str() + 5, NULL, 10);
+    else if (arg.compare(0, 4, "out=") == 0)
+      outPath = arg.substr(4);
+  }
+
+  TraceGen gen(pattern, seed);
+  for (int i = 3; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : arg.c_str() + eq + 1;
+
+    if (key == "footprint")
+      gen.footprint = std::strtoul(value, NULL, 10);
+    else if (key == "stride")
+      gen.stride = std::strtoul(value, NULL, 10);
+    else if (key == "grain")
+      gen.grain = std::strtoul(value, NULL, 10);
+    else if (key == "size")
+      gen.size = std::strtoul(value, NULL, 10);
+    else if (key == "writes")
+      gen.writes = std::strtod(value, NULL);
+    else if (key == "alpha")
+      gen.alpha = std::strtod(value, NULL);
+    else if (key == "base")
+      gen.base = std::strtoul(value, NULL, 16);
+    else if (key != "seed" && key != "out")
+    {
+      std::cerr << "Unknown option " << arg << "." << std::endl;
+      return 1;
+    }
+  }
+  if (gen.footprint == 0 || gen.grain == 0 || gen.size == 0)
+  {
+    std::cerr << "footprint, grain and size must be positive." << std::endl;
+    return 1;
+  }
+  gen.Prepare();
+
+  std::FILE* out = outPath.empty() ? stdout : std::fopen(outPath.c_str(), "wb");
+  if (out == NULL)
+  {
+    std::cerr << "Error opening output file." << std::endl;
+    return 1;
+  }
+
+  //lines are formatted by hand into one large buffer
+  static const char hexDigits[] = "0123456789abcdef";
+  std::vector<char> buffer(1 << 16);
+  size_t used = 0;
+  std::string sizeStr = std::to_string(gen.size);
+
+  for (unsigned long long n = 0; n < count; ++n)
+  {
+    if (used + 32 > buffer.size())
+    {
+      std::fwrite(&buffer[0], 1, used, out);
+      used = 0;
+    }
+
+    unsigned int address = gen.NextAddress(pattern);
+    buffer[used++] = gen.random.Unit() < gen.writes ? 'W' : 'R';
+    buffer[used++] = ':';
+    for (size_t c = 0; c < sizeStr.size(); ++c)
+      buffer[used++] = sizeStr[c];
+    buffer[used++] = ':';
+
+    //at least two hex digits, like the hand written traces
+    int nibbles = 2;
+    while (nibbles < 8 && (address >> (4 * nibbles)) != 0)
+      ++nibbles;
+    for (int shift = 4 * (nibbles - 1); shift >= 0; shift -= 4)
+      buffer[used++] = hexDigits[(address >> shift) & 0xf];
+    buffer[used++] = '\n';
+  }
+  std::fwrite(&buffer[0], 1, used, out);
+
+  if (out != stdout)
+    std::fclose(out);
+  return 0;
+}
+
+#endif